@@ -23,6 +23,11 @@
 #include "tdb_error.h"
 #include "tdb_io.h"
 #include "tdb_huffman.h"
+#include "tdb_trail_cache.h"
+#include "tdb_lexicon_hash.h"
+#include "tdb_lexicon_order.h"
+#include "tdb_front_coding.h"
+#include "tdb_uuid_index.h"
 #include "tdb_package.h"
 
 #define DEFAULT_OPT_CURSOR_EVENT_BUFFER_SIZE 1000
@@ -105,18 +110,25 @@ static int file_fclose(FILE *f)
 
 void tdb_lexicon_read(const tdb *db, tdb_field field, struct tdb_lexicon *lex)
 {
+    /* front-coded lexicons have the block size before offsets */
+    const uint64_t header = db->version >= TDB_VERSION_V0_2 ? 2: 1;
+
     lex->version = db->version;
     lex->data = db->lexicons[field - 1].data;
     lex->size = 0;
+    lex->block_size = 0;
+    lex->cache_id = db->lexicon_cache_id;
+    lex->field = field;
     if (db->lexicons[field - 1].size > UINT32_MAX){
         lex->width = 8;
-        lex->toc.toc64 = (const uint64_t*)&lex->data[lex->width];
-        memcpy(&lex->size, lex->data, 8);
+        lex->toc.toc64 = (const uint64_t*)&lex->data[header * lex->width];
     }else{
         lex->width = 4;
-        lex->toc.toc32 = (const uint32_t*)&lex->data[lex->width];
-        memcpy(&lex->size, lex->data, 4);
+        lex->toc.toc32 = (const uint32_t*)&lex->data[header * lex->width];
     }
+    memcpy(&lex->size, lex->data, lex->width);
+    if (header == 2)
+        memcpy(&lex->block_size, &lex->data[lex->width], lex->width);
 }
 
 static inline uint64_t tdb_lex_offset(const struct tdb_lexicon *lex, tdb_val i)
@@ -131,7 +143,9 @@ const char *tdb_lexicon_get(const struct tdb_lexicon *lex,
                             tdb_val i,
                             uint64_t *length)
 {
-    if (lex->version == TDB_VERSION_V0){
+    if (lex->block_size)
+        return lexicon_blocks_get(lex, i, length);
+    else if (lex->version == TDB_VERSION_V0){
         /* backwards compatibility with 0-terminated strings in v0 */
         *length = (uint64_t)strlen(&lex->data[tdb_lex_offset(lex, i)]);
     }else
@@ -180,6 +194,20 @@ static tdb_error fields_open(tdb *db, const char *root, struct io_ops *io)
             ret = TDB_ERR_NOMEM;
             goto done;
         }
+        if (!(db->lexicon_hashes = calloc(num_ofields,
+                                          sizeof(struct lexicon_hash*)))){
+            ret = TDB_ERR_NOMEM;
+            goto done;
+        }
+        if (!(db->sorted_lexicons = calloc(num_ofields,
+                                           sizeof(struct tdb_file)))){
+            ret = TDB_ERR_NOMEM;
+            goto done;
+        }
+        if (!(db->lexicon_orders = calloc(num_ofields, sizeof(char*)))){
+            ret = TDB_ERR_NOMEM;
+            goto done;
+        }
     }else
         db->lexicons = NULL;
 
@@ -192,6 +220,9 @@ static tdb_error fields_open(tdb *db, const char *root, struct io_ops *io)
 
     db->field_names[0] = "time";
 
+    if (db->version >= TDB_VERSION_V0_2)
+        db->lexicon_cache_id = lexicon_cache_new_id();
+
     for (i = 1; getline(&line, &n, f) != -1 && i < db->num_fields; i++){
 
         line[strlen(line) - 1] = 0;
@@ -212,6 +243,29 @@ static tdb_error fields_open(tdb *db, const char *root, struct io_ops *io)
             ret = TDB_ERR_INVALID_LEXICON_FILE;
             goto done;
         }
+
+        if (db->version >= TDB_VERSION_V0_2){
+            struct tdb_lexicon lex;
+            tdb_lexicon_read(db, i, &lex);
+            if (lex.block_size != LEXICON_BLOCK_SIZE){
+                ret = TDB_ERR_INVALID_LEXICON_FILE;
+                goto done;
+            }
+        }
+
+        /* lexicon.<field>.sorted is optional */
+        TDB_PATH(path, "lexicon.%s.sorted", line);
+        if (io->mmap(path, root, &db->sorted_lexicons[i - 1], db))
+            memset(&db->sorted_lexicons[i - 1], 0, sizeof(struct tdb_file));
+        else{
+            struct tdb_lexicon lex;
+            tdb_lexicon_read(db, i, &lex);
+            if (db->sorted_lexicons[i - 1].size !=
+                lex.size * LEXICON_ORDER_WIDTH(lex.size)){
+                ret = TDB_ERR_INVALID_LEXICON_FILE;
+                goto done;
+            }
+        }
     }
 
     if (i != db->num_fields){
@@ -262,7 +316,7 @@ static tdb_error read_version(tdb *db, const char *root, struct io_ops *io)
     else{
         if (fscanf(f, "%"PRIu64, &db->version) != 1)
             ret = TDB_ERR_INVALID_VERSION_FILE;
-        else if (db->version > TDB_VERSION_LATEST)
+        else if (db->version > TDB_VERSION_MAX_READABLE)
             ret = TDB_ERR_INCOMPATIBLE_VERSION;
         io->fclose(f);
     }
@@ -290,6 +344,25 @@ static tdb_error read_info(tdb *db, const char *root, struct io_ops *io)
     return ret;
 }
 
+/*
+build or free the UUID index according to TDB_OPT_UUID_INDEX. The index
+is built only once UUIDs are available, i.e. after tdb_open().
+*/
+static tdb_error update_uuid_index(tdb *db)
+{
+    if (!db->opt_uuid_index){
+        uuid_index_free(db->uuid_index);
+        db->uuid_index = NULL;
+    }else if (!db->uuid_index && db->num_trails && db->uuids.data){
+        /* V0 doesn't guarantee that UUIDs would be ordered */
+        if (!(db->uuid_index = uuid_index_new(db->uuids.data,
+                                              db->num_trails,
+                                              db->version != TDB_VERSION_V0)))
+            return TDB_ERR_NOMEM;
+    }
+    return 0;
+}
+
 TDB_EXPORT tdb *tdb_init(void)
 {
     return calloc(1, sizeof(tdb));
@@ -377,6 +450,12 @@ TDB_EXPORT tdb_error tdb_open(tdb *db, const char *orig_root)
             if ((ret = huff_convert_v0_codebook(&db->codebook)))
                 goto done;
 
+        if ((ret = huff_create_decoder(
+                (const struct huff_codebook*)db->codebook.data,
+                db->field_stats,
+                &db->decoder)))
+            goto done;
+
         if (io.mmap("trails.toc", root, &db->toc, db)){
             ret = TDB_ERR_INVALID_TRAILS_FILE;
             goto done;
@@ -386,6 +465,55 @@ TDB_EXPORT tdb_error tdb_open(tdb *db, const char *orig_root)
             ret = TDB_ERR_INVALID_TRAILS_FILE;
             goto done;
         }
+
+        /* trails.summary is missing in tdbs created by older versions */
+        if (io.mmap("trails.summary", root, &db->summary, db))
+            memset(&db->summary, 0, sizeof(struct tdb_file));
+        else if (db->summary.size != db->num_trails * 2 *
+                                     tdb_summary_width(db)){
+            ret = TDB_ERR_INVALID_TRAILS_FILE;
+            goto done;
+        }
+
+        /* so is trails.lengths */
+        if (io.mmap("trails.lengths", root, &db->lengths, db))
+            memset(&db->lengths, 0, sizeof(struct tdb_file));
+        else{
+            uint64_t width;
+            if (db->lengths.size < 8){
+                ret = TDB_ERR_INVALID_TRAILS_FILE;
+                goto done;
+            }
+            memcpy(&width, db->lengths.data, 8);
+            if (width == 0 || width > 64 ||
+                db->lengths.size != (db->num_trails * width + 7) / 8 + 16){
+                ret = TDB_ERR_INVALID_TRAILS_FILE;
+                goto done;
+            }
+        }
+
+        /* and trails.index */
+        if (io.mmap("trails.index", root, &db->index, db))
+            memset(&db->index, 0, sizeof(struct tdb_file));
+        else{
+            const uint64_t *index = (const uint64_t*)db->index.data;
+            uint64_t num_indexed, num_checkpoints;
+            if (db->index.size < 24 || db->index.size & 7){
+                ret = TDB_ERR_INVALID_TRAILS_FILE;
+                goto done;
+            }
+            num_indexed = index[db->index.size / 8 - 1];
+            num_checkpoints = index[db->index.size / 8 - 2];
+            if (num_indexed > db->num_trails ||
+                db->index.size != (num_checkpoints * (db->num_fields + 1) +
+                                   num_indexed * 2 + 3) * 8){
+                ret = TDB_ERR_INVALID_TRAILS_FILE;
+                goto done;
+            }
+        }
+
+        if ((ret = update_uuid_index(db)))
+            goto done;
     }
 done:
     free_package(db);
@@ -396,15 +524,26 @@ static void tdb_madvise(const tdb *db, int advice)
 {
     if (db && db->num_fields > 0){
         tdb_field i;
-        for (i = 0; i < db->num_fields - 1; i++)
+        for (i = 0; i < db->num_fields - 1; i++){
             madvise(db->lexicons[i].ptr,
                     db->lexicons[i].mmap_size,
                     advice);
+            if (db->sorted_lexicons[i].ptr)
+                madvise(db->sorted_lexicons[i].ptr,
+                        db->sorted_lexicons[i].mmap_size,
+                        advice);
+        }
 
         madvise(db->uuids.ptr, db->uuids.mmap_size, advice);
         madvise(db->codebook.ptr, db->codebook.mmap_size, advice);
         madvise(db->toc.ptr, db->toc.mmap_size, advice);
         madvise(db->trails.ptr, db->trails.mmap_size, advice);
+        if (db->summary.ptr)
+            madvise(db->summary.ptr, db->summary.mmap_size, advice);
+        if (db->lengths.ptr)
+            madvise(db->lengths.ptr, db->lengths.mmap_size, advice);
+        if (db->index.ptr)
+            madvise(db->index.ptr, db->index.mmap_size, advice);
     }
 }
 
@@ -429,6 +568,13 @@ TDB_EXPORT void tdb_close(tdb *db)
                 free(db->field_names[i + 1]);
                 if (db->lexicons[i].ptr)
                     munmap(db->lexicons[i].ptr, db->lexicons[i].mmap_size);
+                if (db->lexicon_hashes)
+                    lexicon_hash_free(db->lexicon_hashes[i]);
+                if (db->sorted_lexicons && db->sorted_lexicons[i].ptr)
+                    munmap(db->sorted_lexicons[i].ptr,
+                           db->sorted_lexicons[i].mmap_size);
+                if (db->lexicon_orders)
+                    free(db->lexicon_orders[i]);
             }
         }
 
@@ -440,12 +586,24 @@ TDB_EXPORT void tdb_close(tdb *db)
             munmap(db->toc.ptr, db->toc.mmap_size);
         if (db->trails.ptr)
             munmap(db->trails.ptr, db->trails.mmap_size);
+        if (db->summary.ptr)
+            munmap(db->summary.ptr, db->summary.mmap_size);
+        if (db->lengths.ptr)
+            munmap(db->lengths.ptr, db->lengths.mmap_size);
+        if (db->index.ptr)
+            munmap(db->index.ptr, db->index.mmap_size);
 
         JLFA(tmp, db->opt_trail_event_filters);
+        trail_cache_free(db->trail_cache);
+        uuid_index_free(db->uuid_index);
 
         free(db->lexicons);
+        free(db->lexicon_hashes);
+        free(db->sorted_lexicons);
+        free(db->lexicon_orders);
         free(db->field_names);
         free(db->field_stats);
+        huff_free_decoder(db->decoder);
         free(db);
     }
 out_of_memory:
@@ -485,6 +643,58 @@ TDB_EXPORT const char *tdb_get_field_name(const tdb *db,
     return NULL;
 }
 
+/*
+return the hash index of a field, building it on the first call. The
+index is published with a compare-and-swap, so concurrent lookups may
+build it more than once but all of them see the same index. Returns
+NULL for small lexicons and if there's not enough memory, in which case
+the lexicon is scanned.
+*/
+static const struct lexicon_hash *get_lexicon_hash(
+    const tdb *db,
+    tdb_field field,
+    const struct tdb_lexicon *lex)
+{
+    struct lexicon_hash **ptr = &db->lexicon_hashes[field - 1];
+    struct lexicon_hash *hash = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+
+    if (!hash && lex->size >= LEXICON_HASH_MIN_SIZE){
+        struct lexicon_hash *existing = NULL;
+        if ((hash = lexicon_hash_new(lex))){
+            if (!__atomic_compare_exchange_n(ptr,
+                                             &existing,
+                                             hash,
+                                             0,
+                                             __ATOMIC_ACQ_REL,
+                                             __ATOMIC_ACQUIRE)){
+                lexicon_hash_free(hash);
+                hash = existing;
+            }
+        }
+    }
+    return hash;
+}
+
+static tdb_val lexicon_scan(const struct tdb_lexicon *lex,
+                            const char *value,
+                            uint64_t value_length)
+{
+    struct lexicon_scratch scratch = LEXICON_SCRATCH_INIT;
+    tdb_val i, val = 0;
+    for (i = 0; i < lex->size; i++){
+        uint64_t length;
+        const char *token = tdb_lexicon_peek(lex, i, &length, &scratch);
+        if (!token)
+            break;
+        if (length == value_length && !memcmp(token, value, length)){
+            val = i + 1;
+            break;
+        }
+    }
+    lexicon_scratch_free(&scratch);
+    return val;
+}
+
 TDB_EXPORT tdb_item tdb_get_item(const tdb *db,
                                  tdb_field field,
                                  const char *value,
@@ -497,19 +707,50 @@ TDB_EXPORT tdb_item tdb_get_item(const tdb *db,
         return 0;
     else{
         struct tdb_lexicon lex;
-        tdb_val i;
+        const struct lexicon_hash *hash;
+        tdb_val val;
         tdb_lexicon_read(db, field, &lex);
 
-        for (i = 0; i < lex.size; i++){
-            uint64_t length;
-            const char *token = tdb_lexicon_get(&lex, i, &length);
-            if (length == value_length && !memcmp(token, value, length))
-                return tdb_make_item(field, i + 1);
-        }
-        return 0;
+        if ((hash = get_lexicon_hash(db, field, &lex)))
+            val = lexicon_hash_find(hash, &lex, value, value_length);
+        else
+            val = lexicon_scan(&lex, value, value_length);
+        return val ? tdb_make_item(field, val): 0;
     }
 }
 
+TDB_EXPORT tdb_error tdb_get_items(const tdb *db,
+                                   tdb_field field,
+                                   const char **values,
+                                   const uint64_t *value_lengths,
+                                   uint64_t num_values,
+                                   tdb_item *items)
+{
+    struct tdb_lexicon lex;
+    const struct lexicon_hash *hash;
+    uint64_t i;
+
+    if (field == 0 || field >= db->num_fields)
+        return TDB_ERR_UNKNOWN_FIELD;
+
+    tdb_lexicon_read(db, field, &lex);
+    if ((hash = get_lexicon_hash(db, field, &lex))){
+        /* items and vals have the same size, so resolve in place */
+        lexicon_hash_find_many(hash,
+                               &lex,
+                               values,
+                               value_lengths,
+                               num_values,
+                               items);
+        for (i = 0; i < num_values; i++)
+            if (items[i] || !value_lengths[i])
+                items[i] = tdb_make_item(field, items[i]);
+    }else
+        for (i = 0; i < num_values; i++)
+            items[i] = tdb_get_item(db, field, values[i], value_lengths[i]);
+    return 0;
+}
+
 TDB_EXPORT const char *tdb_get_value(const tdb *db,
                                      tdb_field field,
                                      tdb_val val,
@@ -556,7 +797,11 @@ TDB_EXPORT tdb_error tdb_get_trail_id(const tdb *db,
     __uint128_t cmp, key;
     memcpy(&key, uuid, 16);
 
-    if (db->version == TDB_VERSION_V0){
+    if (db->uuid_index){
+        if (uuid_index_find(db->uuid_index, uuid, trail_id))
+            return TDB_ERR_UNKNOWN_UUID;
+        return 0;
+    }else if (db->version == TDB_VERSION_V0){
         /* V0 doesn't guarantee that UUIDs would be ordered */
         uint64_t idx;
         for (idx = 0; idx < db->num_trails; idx++){
@@ -669,6 +914,8 @@ TDB_EXPORT const char *tdb_error_str(tdb_error errcode)
             return "TDB_ERR_INVALID_RANGE";
         case        TDB_ERR_INCORRECT_TERM_TYPE:
             return "TDB_ERR_INCORRECT_TERM_TYPE";
+        case        TDB_ERR_SCAN_ABORTED:
+            return "TDB_ERR_SCAN_ABORTED";
         default:
             return "Unknown error";
     }
@@ -719,6 +966,7 @@ TDB_EXPORT tdb_error tdb_set_opt(tdb *db,
             return 0;
         case TDB_OPT_EVENT_FILTER:
             db->opt_event_filter = (const struct tdb_event_filter*)value.ptr;
+            ++db->opt_filter_generation;
             return 0;
         case TDB_OPT_CURSOR_EVENT_BUFFER_SIZE:
             if (value.value > 0){
@@ -726,6 +974,20 @@ TDB_EXPORT tdb_error tdb_set_opt(tdb *db,
                 return 0;
             }else
                 return TDB_ERR_INVALID_OPTION_VALUE;
+        case TDB_OPT_TRAIL_CACHE_SIZE:
+            /* the cache is kept until tdb_close(), cursors may refer to it */
+            if (!db->trail_cache){
+                if (!value.value)
+                    return 0;
+                if (!(db->trail_cache = trail_cache_new()))
+                    return TDB_ERR_NOMEM;
+            }
+            trail_cache_set_size(db->trail_cache, value.value);
+            return 0;
+        case TDB_OPT_UUID_INDEX:
+            db->opt_uuid_index = value.value ? 1: 0;
+            /* tdb_open() builds the index if the tdb isn't open yet */
+            return update_uuid_index(db);
         default:
             return TDB_ERR_UNKNOWN_OPTION;
     }
@@ -745,6 +1007,13 @@ TDB_EXPORT tdb_error tdb_get_opt(tdb *db,
         case TDB_OPT_CURSOR_EVENT_BUFFER_SIZE:
             value->value = db->opt_cursor_event_buffer_size;
             return 0;
+        case TDB_OPT_TRAIL_CACHE_SIZE:
+            value->value = db->trail_cache ?
+                           trail_cache_get_size(db->trail_cache): 0;
+            return 0;
+        case TDB_OPT_UUID_INDEX:
+            *value = db->opt_uuid_index ? TDB_TRUE: TDB_FALSE;
+            return 0;
         default:
             return TDB_ERR_UNKNOWN_OPTION;
     }
@@ -769,6 +1038,7 @@ TDB_EXPORT tdb_error tdb_set_trail_opt(tdb *db,
             }else{
                 JLD(tmp, db->opt_trail_event_filters, trail_id);
             }
+            ++db->opt_filter_generation;
             return 0;
         default:
             return TDB_ERR_UNKNOWN_OPTION;
@@ -800,6 +1070,17 @@ tdb_error tdb_get_trail_opt(tdb *db,
     }
 }
 
+TDB_EXPORT void tdb_get_trail_cache_stats(const tdb *db,
+                                          uint64_t *hits,
+                                          uint64_t *misses,
+                                          uint64_t *size)
+{
+    if (db->trail_cache)
+        trail_cache_stats(db->trail_cache, hits, misses, size);
+    else
+        *hits = *misses = *size = 0;
+}
+
 TDB_EXPORT struct tdb_event_filter *tdb_event_filter_new(void)
 {
     struct tdb_event_filter *f = calloc(1, sizeof(struct tdb_event_filter));
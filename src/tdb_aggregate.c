@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb_internal.h"
+
+/*
+Aggregates over all trails, computed by the decoder.
+
+Instead of materializing events and returning them to the caller, the
+decoder updates counters directly from the decoded items (see
+tdb_cursor_aggregate()). Trails are processed in parallel with
+tdb_parallel_scan(). Each thread has its own counters, which are summed
+up at the end. The first thread uses the caller's arrays directly.
+*/
+
+static int aggregate_trail(tdb_cursor *cursor,
+                           uint64_t trail_id __attribute__((unused)),
+                           void *state)
+{
+    tdb_cursor_aggregate(cursor, (struct tdb_aggregate*)state);
+    return 0;
+}
+
+static void free_counters(struct tdb_aggregate *aggs, uint64_t num_threads)
+{
+    uint64_t i;
+    for (i = 0; i < num_threads; i++){
+        if (i > 0){
+            free(aggs[i].event_counts);
+            free(aggs[i].trail_counts);
+            free(aggs[i].buckets);
+        }
+        free(aggs[i].last_trail);
+    }
+    free(aggs);
+}
+
+/* sum up src to dst */
+static void merge_counts(uint64_t *dst, const uint64_t *src, uint64_t n)
+{
+    uint64_t i;
+    if (dst && src)
+        for (i = 0; i < n; i++)
+            dst[i] += src[i];
+}
+
+/*
+run the aggregation in proto with num_threads threads. Counters of
+proto are the results, num_counters is the size of each array.
+*/
+static tdb_error aggregate(const tdb *db,
+                           const struct tdb_event_filter *filter,
+                           const struct tdb_aggregate *proto,
+                           uint64_t num_counters,
+                           uint64_t num_threads)
+{
+    struct tdb_aggregate *aggs = NULL;
+    void **states = NULL;
+    const uint64_t size = num_counters * sizeof(uint64_t);
+    uint64_t i;
+    tdb_error err = 0;
+
+    if (!num_threads)
+        return TDB_ERR_INVALID_OPTION_VALUE;
+
+    if (!(aggs = calloc(num_threads, sizeof(struct tdb_aggregate))) ||
+        !(states = malloc(num_threads * sizeof(void*)))){
+        err = TDB_ERR_NOMEM;
+        goto done;
+    }
+
+    for (i = 0; i < num_threads; i++){
+        struct tdb_aggregate *agg = &aggs[i];
+        *agg = *proto;
+        agg->last_trail = NULL;
+        states[i] = agg;
+        if (i > 0){
+            agg->event_counts = NULL;
+            agg->trail_counts = NULL;
+            agg->buckets = NULL;
+            if (proto->event_counts &&
+                !(agg->event_counts = calloc(num_counters, sizeof(uint64_t))))
+                goto nomem;
+            if (proto->trail_counts &&
+                !(agg->trail_counts = calloc(num_counters, sizeof(uint64_t))))
+                goto nomem;
+            if (proto->buckets &&
+                !(agg->buckets = calloc(num_counters, sizeof(uint64_t))))
+                goto nomem;
+        }else{
+            if (proto->event_counts)
+                memset(agg->event_counts, 0, size);
+            if (proto->trail_counts)
+                memset(agg->trail_counts, 0, size);
+            if (proto->buckets)
+                memset(agg->buckets, 0, size);
+        }
+        if (proto->trail_counts &&
+            !(agg->last_trail = calloc(num_counters, sizeof(uint64_t))))
+            goto nomem;
+    }
+
+    if ((err = tdb_parallel_scan(db,
+                                 filter,
+                                 NULL,
+                                 0,
+                                 aggregate_trail,
+                                 states,
+                                 num_threads)))
+        goto done;
+
+    /*
+    a trail is processed by a single thread, so distinct trail counts
+    of threads can be summed up too
+    */
+    for (i = 1; i < num_threads; i++){
+        merge_counts(aggs[0].event_counts, aggs[i].event_counts, num_counters);
+        merge_counts(aggs[0].trail_counts, aggs[i].trail_counts, num_counters);
+        merge_counts(aggs[0].buckets, aggs[i].buckets, num_counters);
+    }
+    goto done;
+nomem:
+    err = TDB_ERR_NOMEM;
+done:
+    if (aggs)
+        free_counters(aggs, num_threads);
+    free(states);
+    return err;
+}
+
+TDB_EXPORT tdb_error tdb_count_items(const tdb *db,
+                                     const struct tdb_event_filter *filter,
+                                     tdb_field field,
+                                     uint64_t *event_counts,
+                                     uint64_t *trail_counts,
+                                     uint64_t num_threads)
+{
+    struct tdb_aggregate proto;
+
+    if (field == 0 || field >= db->num_fields)
+        return TDB_ERR_UNKNOWN_FIELD;
+
+    memset(&proto, 0, sizeof(proto));
+    proto.field = field;
+    proto.event_counts = event_counts;
+    proto.trail_counts = trail_counts;
+
+    return aggregate(db,
+                     filter,
+                     &proto,
+                     tdb_lexicon_size(db, field),
+                     num_threads);
+}
+
+TDB_EXPORT tdb_error tdb_histogram_time(const tdb *db,
+                                        const struct tdb_event_filter *filter,
+                                        uint64_t start,
+                                        uint64_t bucket_width,
+                                        uint64_t *buckets,
+                                        uint64_t num_buckets,
+                                        uint64_t num_threads)
+{
+    struct tdb_aggregate proto;
+
+    if (!bucket_width || (num_buckets && !buckets))
+        return TDB_ERR_INVALID_OPTION_VALUE;
+
+    memset(&proto, 0, sizeof(proto));
+    proto.start = start;
+    proto.bucket_width = bucket_width;
+    proto.num_buckets = num_buckets;
+    proto.buckets = buckets;
+
+    return aggregate(db, filter, &proto, num_buckets, num_threads);
+}
@@ -14,6 +14,19 @@ static inline uint64_t read_bits(const char *src, uint64_t offs, uint32_t bits)
     return (*src_w >> (offs & 7)) & (((1LLU << bits) - 1));
 }
 
+/*
+read a window of bits starting at offs with a single unaligned load. At
+least READ_WINDOW_BITS low bits of the result are valid, the rest are
+garbage.
+*/
+#define READ_WINDOW_BITS 57
+
+static inline uint64_t read_window(const char *src, uint64_t offs)
+{
+    const uint64_t *src_w = (const uint64_t*)&src[offs >> 3];
+    return *src_w >> (offs & 7);
+}
+
 static inline void write_bits(char *dst, uint64_t offs, uint64_t val)
 {
     /* this assumes that (val >> 48) == 0 */
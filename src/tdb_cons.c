@@ -4,6 +4,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -22,6 +23,8 @@
 #include "tdb_error.h"
 #include "tdb_io.h"
 #include "tdb_package.h"
+#include "tdb_lexicon_order.h"
+#include "tdb_front_coding.h"
 #include "arena.h"
 
 #ifndef EVENTS_ARENA_INCREMENT
@@ -106,6 +109,164 @@ done:
     return ret;
 }
 
+struct fc_fold_state{
+    char *buf;
+    uint64_t size;
+    uint64_t offset;
+    uint64_t *block_offsets;
+    const char *prev;
+    uint64_t prev_length;
+    tdb_error ret;
+};
+
+static void *front_coded_lexicon_fun(uint64_t id,
+                                     const char *value,
+                                     uint64_t len,
+                                     void *state)
+{
+    struct fc_fold_state *s = (struct fc_fold_state*)state;
+    /* NOTE: vals start at 1 */
+    const uint64_t i = id - 1;
+    uint64_t shared = 0;
+
+    if (s->ret)
+        return state;
+
+    /* two varints take at most 20 bytes */
+    if (s->offset + len + 20 > s->size){
+        char *buf;
+        uint64_t size = s->size ? s->size: 65536;
+        while (size < s->offset + len + 20)
+            size *= 2;
+        if (!(buf = realloc(s->buf, size))){
+            s->ret = TDB_ERR_NOMEM;
+            return state;
+        }
+        s->buf = buf;
+        s->size = size;
+    }
+
+    if (i % LEXICON_BLOCK_SIZE)
+        while (shared < len &&
+               shared < s->prev_length &&
+               value[shared] == s->prev[shared])
+            ++shared;
+    else
+        s->block_offsets[i / LEXICON_BLOCK_SIZE] = s->offset;
+
+    if (i % LEXICON_BLOCK_SIZE)
+        s->offset += write_varint(&s->buf[s->offset], shared);
+    s->offset += write_varint(&s->buf[s->offset], len - shared);
+    memcpy(&s->buf[s->offset], &value[shared], len - shared);
+    s->offset += len - shared;
+
+    s->prev = value;
+    s->prev_length = len;
+    return state;
+}
+
+static tdb_error front_coded_lexicon_store(const struct judy_str_map *lexicon,
+                                           const char *path)
+{
+    /* see tdb_front_coding.h for the format */
+    struct fc_fold_state state = {0};
+    FILE *out = NULL;
+    const uint64_t count = jsm_num_keys(lexicon);
+    const uint64_t num_blocks = (count + LEXICON_BLOCK_SIZE - 1) /
+                                LEXICON_BLOCK_SIZE;
+    const uint64_t block_size = LEXICON_BLOCK_SIZE;
+    uint64_t i, width, header_size;
+    int ret = 0;
+
+    if (!(state.block_offsets = malloc((num_blocks + 1) * sizeof(uint64_t)))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+
+    jsm_fold(lexicon, front_coded_lexicon_fun, &state);
+    if ((ret = state.ret))
+        goto done;
+    state.block_offsets[num_blocks] = state.offset;
+
+    width = 4;
+    header_size = (num_blocks + 3) * width;
+    if (header_size + state.offset > UINT32_MAX){
+        width = 8;
+        header_size = (num_blocks + 3) * width;
+    }
+
+    if (header_size + state.offset > TDB_MAX_LEXICON_SIZE){
+        ret = TDB_ERR_LEXICON_TOO_LARGE;
+        goto done;
+    }
+
+    TDB_OPEN(out, path, "w");
+    TDB_WRITE(out, &count, width);
+    TDB_WRITE(out, &block_size, width);
+    for (i = 0; i < num_blocks + 1; i++){
+        uint64_t offset = header_size + state.block_offsets[i];
+        TDB_WRITE(out, &offset, width);
+    }
+    if (state.offset)
+        TDB_WRITE(out, state.buf, state.offset);
+
+done:
+    free(state.buf);
+    free(state.block_offsets);
+    TDB_CLOSE_FINAL(out);
+    return ret;
+}
+
+static void *sorted_lexicon_fun(uint64_t id,
+                                const char *value,
+                                uint64_t len,
+                                void *state)
+{
+    struct lexicon_sort_entry *entries = (struct lexicon_sort_entry*)state;
+
+    /* NOTE: vals start at 1 */
+    entries[id - 1].value = value;
+    entries[id - 1].length = len;
+    entries[id - 1].val = id;
+    return state;
+}
+
+static tdb_error sorted_lexicon_store(const struct judy_str_map *lexicon,
+                                      const char *path)
+{
+    /* see tdb_lexicon_order.h for the format */
+    struct lexicon_sort_entry *entries = NULL;
+    char *order = NULL;
+    FILE *out = NULL;
+    uint64_t count = jsm_num_keys(lexicon);
+    int ret = 0;
+
+    /* tdb_open() doesn't accept an empty file, the order is trivial anyway */
+    if (!count)
+        return 0;
+
+    if (!(entries = malloc(count * sizeof(struct lexicon_sort_entry)))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+    if (!(order = malloc(count * LEXICON_ORDER_WIDTH(count)))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+
+    jsm_fold(lexicon, sorted_lexicon_fun, entries);
+    lexicon_sort(entries, count, order);
+
+    TDB_OPEN(out, path, "w");
+    TDB_WRITE(out, order, count * LEXICON_ORDER_WIDTH(count));
+
+done:
+    free(entries);
+    free(order);
+    TDB_CLOSE_FINAL(out);
+    return ret;
+}
+
 static tdb_error store_lexicons(tdb_cons *cons)
 {
     tdb_field i;
@@ -118,8 +279,20 @@ static tdb_error store_lexicons(tdb_cons *cons)
 
     for (i = 0; i < cons->num_ofields; i++){
         TDB_PATH(path, "%s/lexicon.%s", cons->root, cons->ofield_names[i]);
-        if ((ret = lexicon_store(&cons->lexicons[i], path)))
+        if (cons->front_coded_lexicons)
+            ret = front_coded_lexicon_store(&cons->lexicons[i], path);
+        else
+            ret = lexicon_store(&cons->lexicons[i], path);
+        if (ret)
             goto done;
+        if (cons->sorted_lexicons){
+            TDB_PATH(path,
+                     "%s/lexicon.%s.sorted",
+                     cons->root,
+                     cons->ofield_names[i]);
+            if ((ret = sorted_lexicon_store(&cons->lexicons[i], path)))
+                goto done;
+        }
         TDB_FPRINTF(out, "%s\n", cons->ofield_names[i]);
     }
     TDB_FPRINTF(out, "\n");
@@ -136,7 +309,11 @@ static tdb_error store_version(tdb_cons *cons)
 
     TDB_PATH(path, "%s/version", cons->root);
     TDB_OPEN(out, path, "w");
-    TDB_FPRINTF(out, "%llu", TDB_VERSION_LATEST);
+    /* readers of older versions can read tdbs without front coding */
+    TDB_FPRINTF(out,
+                "%llu",
+                cons->front_coded_lexicons ? TDB_VERSION_V0_2:
+                                             TDB_VERSION_V0_1);
 done:
     TDB_CLOSE_FINAL(out);
     return ret;
@@ -494,6 +671,7 @@ static uint64_t **append_lexicons(tdb_cons *cons, const tdb *db)
         return NULL;
 
     for (field = 0; field < cons->num_ofields; field++){
+        struct lexicon_scratch scratch = LEXICON_SCRATCH_INIT;
         struct tdb_lexicon lex;
         uint64_t *map;
 
@@ -504,15 +682,21 @@ static uint64_t **append_lexicons(tdb_cons *cons, const tdb *db)
 
         for (i = 0; i < lex.size; i++){
             uint64_t value_length;
-            const char *value = tdb_lexicon_get(&lex, i, &value_length);
+            const char *value = tdb_lexicon_peek(&lex,
+                                                 i,
+                                                 &value_length,
+                                                 &scratch);
             tdb_val val;
-            if ((val = (tdb_val)jsm_insert(&cons->lexicons[field],
-                                            value,
-                                            value_length)))
+            if (value && (val = (tdb_val)jsm_insert(&cons->lexicons[field],
+                                                     value,
+                                                     value_length)))
                 map[i] = val;
-            else
+            else{
+                lexicon_scratch_free(&scratch);
                 goto error;
+            }
         }
+        lexicon_scratch_free(&scratch);
     }
     return lexicon_maps;
 error:
@@ -656,6 +840,38 @@ TDB_EXPORT tdb_error tdb_cons_append(tdb_cons *cons, const tdb *db)
         return tdb_cons_append_full_lexicon(cons, db);
 }
 
+/*
+like file_mmap() but the mapping is writable, so that
+tdb_encode_renumbered() can renumber items in place
+*/
+static int items_mmap(const char *path, struct tdb_file *dst)
+{
+    struct stat stats;
+    int fd, ret = 0;
+
+    if ((fd = open(path, O_RDWR)) == -1)
+        return -1;
+
+    if (fstat(fd, &stats)){
+        ret = -1;
+        goto done;
+    }
+
+    dst->size = dst->mmap_size = (uint64_t)stats.st_size;
+    dst->data = dst->ptr = mmap(NULL,
+                                dst->size,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED,
+                                fd,
+                                0);
+    if (dst->ptr == MAP_FAILED){
+        dst->data = dst->ptr = NULL;
+        ret = -1;
+    }
+done:
+    close(fd);
+    return ret;
+}
 
 TDB_EXPORT tdb_error tdb_cons_finalize(tdb_cons *cons)
 {
@@ -678,7 +894,11 @@ TDB_EXPORT tdb_error tdb_cons_finalize(tdb_cons *cons)
 
     if (cons->tempfile[0]){
         if (num_events && cons->num_ofields) {
-            if (file_mmap(cons->tempfile, NULL, &items_mmapped, NULL)){
+            if (cons->frequency_ordered_values)
+                ret = items_mmap(cons->tempfile, &items_mmapped);
+            else
+                ret = file_mmap(cons->tempfile, NULL, &items_mmapped, NULL);
+            if (ret){
                 ret = TDB_ERR_IO_READ;
                 goto done;
             }
@@ -686,10 +906,13 @@ TDB_EXPORT tdb_error tdb_cons_finalize(tdb_cons *cons)
 
         TDB_TIMER_DEF
 
-        TDB_TIMER_START
-        if ((ret = store_lexicons(cons)))
-            goto done;
-        TDB_TIMER_END("encoder/store_lexicons")
+        /* renumbering values in tdb_encode_renumbered() changes lexicons */
+        if (!cons->frequency_ordered_values){
+            TDB_TIMER_START
+            if ((ret = store_lexicons(cons)))
+                goto done;
+            TDB_TIMER_END("encoder/store_lexicons")
+        }
 
         TDB_TIMER_START
         if ((ret = store_uuids(cons)))
@@ -702,9 +925,20 @@ TDB_EXPORT tdb_error tdb_cons_finalize(tdb_cons *cons)
         TDB_TIMER_END("encoder/store_version")
 
         TDB_TIMER_START
-        if ((ret = tdb_encode(cons, (const tdb_item*)items_mmapped.data)))
+        if (cons->frequency_ordered_values)
+            ret = tdb_encode_renumbered(cons, (tdb_item*)items_mmapped.ptr);
+        else
+            ret = tdb_encode(cons, (const tdb_item*)items_mmapped.data);
+        if (ret)
             goto done;
         TDB_TIMER_END("encoder/encode")
+
+        if (cons->frequency_ordered_values){
+            TDB_TIMER_START
+            if ((ret = store_lexicons(cons)))
+                goto done;
+            TDB_TIMER_END("encoder/store_lexicons")
+        }
     }
 done:
     if (items_mmapped.ptr)
@@ -741,6 +975,15 @@ TDB_EXPORT tdb_error tdb_cons_set_opt(tdb_cons *cons,
         case TDB_OPT_CONS_NO_BIGRAMS:
             cons->no_bigrams = !(!(value.value));
             return 0;
+        case TDB_OPT_CONS_SORTED_LEXICONS:
+            cons->sorted_lexicons = !(!(value.value));
+            return 0;
+        case TDB_OPT_CONS_FRONT_CODED_LEXICONS:
+            cons->front_coded_lexicons = !(!(value.value));
+            return 0;
+        case TDB_OPT_CONS_FREQUENCY_ORDERED_VALUES:
+            cons->frequency_ordered_values = !(!(value.value));
+            return 0;
         default:
             return TDB_ERR_UNKNOWN_OPTION;
     }
@@ -757,6 +1000,15 @@ TDB_EXPORT tdb_error tdb_cons_get_opt(tdb_cons *cons,
         case TDB_OPT_CONS_NO_BIGRAMS:
             value->value = cons->no_bigrams;
             return 0;
+        case TDB_OPT_CONS_SORTED_LEXICONS:
+            value->value = cons->sorted_lexicons;
+            return 0;
+        case TDB_OPT_CONS_FRONT_CODED_LEXICONS:
+            value->value = cons->front_coded_lexicons;
+            return 0;
+        case TDB_OPT_CONS_FREQUENCY_ORDERED_VALUES:
+            value->value = cons->frequency_ordered_values;
+            return 0;
         default:
             return TDB_ERR_UNKNOWN_OPTION;
     }
@@ -28,6 +28,9 @@ static const char *HEADER_FILES[] = {"version",
 static const char *DATA_FILES[] = {"fields",
                                    "trails.codebook",
                                    "trails.toc",
+                                   "trails.summary",
+                                   "trails.lengths",
+                                   "trails.index",
                                    "trails.data",
                                    "uuids"};
 
@@ -178,6 +181,7 @@ static tdb_error init_tar_toc(struct archive *tar,
     /* VALUE_SIZE = len(' %d %d\n' % (2**64, 2**64)) */
     static const uint64_t VALUE_SIZE = 43;
     static const uint64_t LEXICON_PREFIX_LEN = 8; /* = len("lexicon.") */
+    static const uint64_t SORTED_SUFFIX_LEN = 7; /* = len(".sorted") */
     uint64_t i, size = strlen(TOC_FILE) + VALUE_SIZE + strlen(TDB_TAR_MAGIC);
     char *buffer = NULL;
     int ret = 0;
@@ -188,8 +192,12 @@ static tdb_error init_tar_toc(struct archive *tar,
     for (i = 0; i < sizeof(DATA_FILES) / sizeof(DATA_FILES[0]); i++)
         size += strlen(DATA_FILES[i]) + VALUE_SIZE;
 
-    for (i = 0; i < cons->num_ofields; i++)
+    for (i = 0; i < cons->num_ofields; i++){
         size += strlen(cons->ofield_names[i]) + LEXICON_PREFIX_LEN + VALUE_SIZE;
+        if (cons->sorted_lexicons)
+            size += strlen(cons->ofield_names[i]) + LEXICON_PREFIX_LEN +
+                    SORTED_SUFFIX_LEN + VALUE_SIZE;
+    }
 
     *toc_max_size = ++size; /* empty line in the end */
 
@@ -246,6 +254,16 @@ static tdb_error write_lexicons(struct archive *tar,
         TDB_PATH(path, "lexicon.%s", cons->ofield_names[i]);
         if ((ret = write_file_entry(tar, entry, path, cons->root, toc_file)))
             goto done;
+        /* sorted lexicons are not stored for empty fields */
+        if (cons->sorted_lexicons && jsm_num_keys(&cons->lexicons[i])){
+            TDB_PATH(path, "lexicon.%s.sorted", cons->ofield_names[i]);
+            if ((ret = write_file_entry(tar,
+                                        entry,
+                                        path,
+                                        cons->root,
+                                        toc_file)))
+                goto done;
+        }
     }
 done:
     return ret;
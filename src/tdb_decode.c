@@ -1,65 +1,41 @@
+#define _DEFAULT_SOURCE /* for madvise() */
+#define _BSD_SOURCE /* for madvise() */
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "tdb_internal.h"
 #include "tdb_huffman.h"
+#include "tdb_filter.h"
+#include "tdb_trail_cache.h"
 
 #define CURSOR_FILTER 1
 #define TRAIL_FILTER 2
 
-static inline uint64_t tdb_get_trail_offs(const tdb *db, uint64_t trail_id)
-{
-    if (db->trails.size < UINT32_MAX)
-        return ((const uint32_t*)db->toc.data)[trail_id];
-    else
-        return ((const uint64_t*)db->toc.data)[trail_id];
-}
+/*
+tdb_cursor_scan_range() prefetches this many bytes of trails.data ahead
+of the cursor and releases pages once they are this far behind it
+*/
+#define SCAN_WINDOW_SIZE (16 * 1024 * 1024)
 
-static int event_satisfies_filter(const tdb_item *event,
-                                  uint64_t timestamp,
-                                  const tdb_item *filter,
-                                  uint64_t filter_len)
-{
-    uint64_t i = 0;
-    while (i < filter_len){
-        uint64_t clause_len = filter[i++];
-        uint64_t next_clause = i + clause_len;
-        int match = 0;
-        if (next_clause > filter_len)
-            return 0;
+/*
+decoding routines are specialized for these properties of the tdb and
+the cursor, so that the per-item loop has no mode checks. See
+select_decoders() below.
+*/
+/* TDB_OPT_ONLY_DIFF_ITEMS */
+#define DECODE_EDGE 1
+/* all fields fit in 7 bits, so tdb_item_field32() works for all items */
+#define DECODE_NARROW 2
+/* the codebook has no bigrams, e.g. due to TDB_OPT_CONS_NO_BIGRAMS */
+#define DECODE_UNIGRAMS 4
 
-        while (i < next_clause){
-            uint64_t op_flags = filter[i++];
-            uint64_t filter_item = filter[i++];
-
-            /* Time range queries */
-            if (op_flags & TDB_EVENT_TIME_RANGE) {
-                uint64_t end_filter = filter[i++];
-                if (filter_item <= timestamp && timestamp < end_filter) {
-                    match = 1;
-                    break;
-                }
-            } else { /* Item-matching queries */
-                uint64_t is_negative = op_flags & TDB_EVENT_NEGATED;
-                tdb_field field = tdb_item_field(filter_item);
-                if (field){
-                    if ((event[field] == filter_item) != is_negative){
-                        match = 1;
-                        break;
-                    }
-                } else {
-                    if (is_negative) {
-                        match = 1;
-                        break;
-                    }
-                }
-            }
-        }
-        if (!match){
-            return 0;
-        }
-        i = next_clause;
-    }
-    return 1;
-}
+/* the specialized routines are useful only if flags are constants */
+#define DECODE_INLINE static inline __attribute__((always_inline))
 
+static const struct decoder_variant *select_decoders(const tdb *db,
+                                                     int edge_encoded);
 
 TDB_EXPORT tdb_cursor *tdb_cursor_new(const tdb *db)
 {
@@ -74,7 +50,11 @@ TDB_EXPORT tdb_cursor *tdb_cursor_new(const tdb *db)
 
     c->state->db = db;
     c->state->edge_encoded = db->opt_edge_encoded;
+    c->state->decoders = select_decoders(db, c->state->edge_encoded);
     c->state->events_buffer_len = db->opt_cursor_event_buffer_size;
+    c->state->num_projected = db->num_fields - 1;
+    /* no trail is selected until tdb_get_trail() */
+    c->state->trail_id = UINT64_MAX;
     /*
     set the filter type to TRAIL_FILTER initially so it can be
     overriden with the right value in tdb_get_trail()
@@ -86,25 +66,227 @@ TDB_EXPORT tdb_cursor *tdb_cursor_new(const tdb *db)
                                            sizeof(tdb_item))))
         goto err;
 
+    if (!(c->state->projected = malloc(db->num_fields)))
+        goto err;
+    memset(c->state->projected, 1, db->num_fields);
+
+    if (!(c->state->compiled_filter = calloc(1,
+                                             sizeof(struct compiled_filter))))
+        goto err;
+
     return c;
 err:
     tdb_cursor_free(c);
     return NULL;
 }
 
+static void free_filters(struct tdb_decode_state *s)
+{
+    uint64_t i;
+    for (i = 0; i < s->num_filters; i++)
+        filter_free(&s->compiled_filters[i]);
+    free(s->filters);
+    free(s->compiled_filters);
+    free(s->active_filters);
+    free(s->match_masks);
+    s->filters = NULL;
+    s->compiled_filters = NULL;
+    s->active_filters = NULL;
+    s->match_masks = NULL;
+    s->num_filters = s->num_active_filters = 0;
+}
+
+static void release_cached_trail(struct tdb_decode_state *s)
+{
+    if (s->cache_entry){
+        trail_cache_release(s->db->trail_cache, s->cache_entry);
+        s->cache_entry = NULL;
+    }
+}
+
 TDB_EXPORT void tdb_cursor_free(tdb_cursor *c)
 {
     if (c){
-        free(c->state->events_buffer);
+        if (c->state){
+            free(c->state->events_buffer);
+            free(c->state->projection);
+            free(c->state->columns);
+            free(c->state->projected);
+            if (c->state->compiled_filter){
+                filter_free(c->state->compiled_filter);
+                free(c->state->compiled_filter);
+            }
+            free_filters(c->state);
+            free(c->state->batch_items);
+            release_cached_trail(c->state);
+        }
         free(c->state);
         free(c);
     }
 }
 
+/*
+events in the buffer would be invalidated, so changing the projection
+resets the cursor as if tdb_get_trail() had failed
+*/
+static tdb_error set_projection(tdb_cursor *cursor,
+                                tdb_field *projection,
+                                tdb_field *columns,
+                                uint64_t num_projected,
+                                uint8_t *projected)
+{
+    struct tdb_decode_state *s = cursor->state;
+    void *buffer;
+
+    if (!(buffer = realloc(s->events_buffer,
+                           s->events_buffer_len *
+                           (num_projected + 2) *
+                           sizeof(tdb_item)))){
+        free(projection);
+        free(columns);
+        free(projected);
+        return TDB_ERR_NOMEM;
+    }
+
+    free(s->projection);
+    free(s->columns);
+    free(s->projected);
+    s->events_buffer = buffer;
+    s->projection = projection;
+    s->columns = columns;
+    s->num_projected = num_projected;
+    s->projected = projected;
+
+    cursor->num_events_left = 0;
+    cursor->next_event = NULL;
+    s->size = 0;
+    s->offset = 0;
+    return 0;
+}
+
+TDB_EXPORT tdb_error tdb_cursor_set_fields(tdb_cursor *cursor,
+                                           const tdb_field *fields,
+                                           uint64_t num_fields)
+{
+    const tdb *db = cursor->state->db;
+    tdb_field *projection = NULL;
+    tdb_field *columns = NULL;
+    uint8_t *projected = NULL;
+    uint64_t i;
+
+    for (i = 0; i < num_fields; i++)
+        if (fields[i] == 0 || fields[i] >= db->num_fields)
+            return TDB_ERR_UNKNOWN_FIELD;
+
+    /* make sure that malloc() succeeds with num_fields == 0 */
+    if (!(projection = malloc((num_fields + 1) * sizeof(tdb_field))))
+        goto err;
+    if (!(columns = malloc(db->num_fields * sizeof(tdb_field))))
+        goto err;
+    if (!(projected = calloc(db->num_fields, 1)))
+        goto err;
+
+    for (i = 0; i < num_fields; i++){
+        projection[i] = fields[i];
+        projected[fields[i]] = 1;
+    }
+    /* the first column of a field listed many times is the one returned */
+    for (i = num_fields; i > 0; i--)
+        columns[fields[i - 1]] = (tdb_field)(i - 1);
+    return set_projection(cursor, projection, columns, num_fields, projected);
+err:
+    free(projection);
+    free(columns);
+    return TDB_ERR_NOMEM;
+}
+
+TDB_EXPORT tdb_error tdb_cursor_unset_fields(tdb_cursor *cursor)
+{
+    const tdb *db = cursor->state->db;
+    uint8_t *projected;
+
+    if (!(projected = malloc(db->num_fields)))
+        return TDB_ERR_NOMEM;
+    memset(projected, 1, db->num_fields);
+
+    return set_projection(cursor, NULL, NULL, db->num_fields - 1, projected);
+}
+
+/*
+copy events from the row-oriented event buffer to columns: column k
+corresponds to the k-th materialized field of the cursor. Edge-encoded
+events don't contain unchanged fields which are returned as 0.
+*/
+static inline uint64_t next_columns(tdb_cursor *cursor,
+                                    uint64_t *timestamps,
+                                    uint64_t **columns,
+                                    uint64_t max_events,
+                                    int values)
+{
+    const struct tdb_decode_state *s = cursor->state;
+    const uint64_t num_columns = s->num_projected;
+    uint64_t n = 0;
+    uint64_t j, k;
+
+    while (n < max_events &&
+           (cursor->num_events_left > 0 || _tdb_cursor_next_batch(cursor))){
+
+        const tdb_event *e = (const tdb_event*)cursor->next_event;
+
+        if (timestamps)
+            timestamps[n] = e->timestamp;
+
+        if (s->edge_encoded){
+            for (k = 0; k < num_columns; k++)
+                columns[k][n] = 0;
+            for (j = 0; j < e->num_items; j++){
+                tdb_field field = tdb_item_field(e->items[j]);
+                k = s->columns ? s->columns[field]: field - 1U;
+                columns[k][n] = values ? tdb_item_val(e->items[j]):
+                                         e->items[j];
+            }
+        }else if (values)
+            for (k = 0; k < num_columns; k++)
+                columns[k][n] = tdb_item_val(e->items[k]);
+        else
+            for (k = 0; k < num_columns; k++)
+                columns[k][n] = e->items[k];
+
+        cursor->next_event += sizeof(tdb_event) +
+                              e->num_items * sizeof(tdb_item);
+        --cursor->num_events_left;
+        ++n;
+    }
+    return n;
+}
+
+TDB_EXPORT uint64_t tdb_cursor_next_columns(tdb_cursor *cursor,
+                                            uint64_t *timestamps,
+                                            tdb_item **columns,
+                                            uint64_t max_events)
+{
+    return next_columns(cursor, timestamps, columns, max_events, 0);
+}
+
+TDB_EXPORT uint64_t tdb_cursor_next_value_columns(tdb_cursor *cursor,
+                                                  uint64_t *timestamps,
+                                                  tdb_val **columns,
+                                                  uint64_t max_events)
+{
+    return next_columns(cursor, timestamps, columns, max_events, 1);
+}
+
+TDB_EXPORT void tdb_cursor_set_limit(tdb_cursor *cursor, uint64_t limit)
+{
+    cursor->state->limit = limit;
+}
+
 TDB_EXPORT void tdb_cursor_unset_event_filter(tdb_cursor *cursor)
 {
+    free_filters(cursor->state);
     cursor->state->filter = NULL;
     cursor->state->filter_type = TRAIL_FILTER;
+    cursor->state->batch_filter = 0;
 }
 
 TDB_EXPORT tdb_error tdb_cursor_set_event_filter(tdb_cursor *cursor,
@@ -113,25 +295,222 @@ TDB_EXPORT tdb_error tdb_cursor_set_event_filter(tdb_cursor *cursor,
     if (cursor->state->edge_encoded)
         return TDB_ERR_ONLY_DIFF_FILTER;
     else{
+        free_filters(cursor->state);
         cursor->state->filter = filter;
         cursor->state->filter_type = CURSOR_FILTER;
+        /* the filter may have changed even if the pointer is the same */
+        cursor->state->compiled_filter->source = NULL;
         return TDB_ERR_OK;
     }
 }
 
-TDB_EXPORT tdb_error tdb_get_trail(tdb_cursor *cursor,
-                                   uint64_t trail_id)
+TDB_EXPORT tdb_error tdb_cursor_set_event_filters(
+    tdb_cursor *cursor,
+    const struct tdb_event_filter **filters,
+    uint64_t num_filters)
+{
+    struct tdb_decode_state *s = cursor->state;
+    uint64_t mask_words = (num_filters + 63) / 64;
+
+    if (s->edge_encoded)
+        return TDB_ERR_ONLY_DIFF_FILTER;
+
+    free_filters(s);
+    s->filter = NULL;
+    s->filter_type = CURSOR_FILTER;
+
+    /* events in the buffer don't have masks, so reset the cursor */
+    cursor->num_events_left = 0;
+    cursor->next_event = NULL;
+    s->size = 0;
+    s->offset = 0;
+    s->batch_num_events = 0;
+
+    if (!num_filters){
+        s->filter_type = TRAIL_FILTER;
+        return 0;
+    }
+
+    if (!(s->filters = malloc(num_filters * sizeof(s->filters[0]))))
+        goto nomem;
+    if (!(s->compiled_filters = calloc(num_filters,
+                                       sizeof(struct compiled_filter))))
+        goto nomem;
+    if (!(s->active_filters = malloc(num_filters * sizeof(uint64_t))))
+        goto nomem;
+    if (!(s->match_masks = malloc(s->events_buffer_len *
+                                  mask_words *
+                                  sizeof(uint64_t))))
+        goto nomem;
+
+    memcpy(s->filters, filters, num_filters * sizeof(s->filters[0]));
+    s->num_filters = num_filters;
+    s->mask_words = mask_words;
+    return 0;
+nomem:
+    free_filters(s);
+    s->filter_type = TRAIL_FILTER;
+    return TDB_ERR_NOMEM;
+}
+
+TDB_EXPORT const uint64_t *tdb_cursor_event_matches(const tdb_cursor *cursor)
+{
+    const struct tdb_decode_state *s = cursor->state;
+    uint64_t i;
+
+    /* the last event returned by tdb_cursor_next() */
+    if (!s->num_filters || cursor->num_events_left >= s->batch_num_events)
+        return NULL;
+    i = s->batch_num_events - cursor->num_events_left - 1;
+    return &s->match_masks[i * s->mask_words];
+}
+
+static tdb_error update_compiled_filter(const tdb *db,
+                                       const struct tdb_event_filter *filter,
+                                       struct compiled_filter *f)
+{
+    if (f->source != filter ||
+        f->source_count != filter->count ||
+        f->generation != db->opt_filter_generation)
+        return filter_compile(db, filter, f);
+    else
+        return 0;
+}
+
+static inline int trail_overlaps_filter(const tdb *db,
+                                        uint64_t trail_id,
+                                        const struct compiled_filter *f)
+{
+    uint64_t first, last;
+    tdb_get_trail_summary(db, trail_id, &first, &last);
+    return first < f->stop_time && last >= f->start_time;
+}
+
+/*
+find the filters of tdb_cursor_set_event_filters() that may match
+events of the trail, and the time when all of them stop matching
+*/
+static tdb_error select_filters(struct tdb_decode_state *s, uint64_t trail_id)
+{
+    uint64_t i;
+    tdb_error err;
+
+    s->num_active_filters = 0;
+    s->stop_time = 0;
+    for (i = 0; i < s->num_filters; i++){
+        const struct compiled_filter *f = &s->compiled_filters[i];
+        if ((err = update_compiled_filter(s->db,
+                                          s->filters[i],
+                                          &s->compiled_filters[i])))
+            return err;
+        if (f->match_none)
+            continue;
+        if (s->db->summary.data && !trail_overlaps_filter(s->db, trail_id, f))
+            continue;
+        s->active_filters[s->num_active_filters++] = i;
+        if (f->stop_time > s->stop_time)
+            s->stop_time = f->stop_time;
+    }
+    return 0;
+}
+
+/*
+decode the grams of the current trail to a new entry of the trail cache.
+Returns NULL if out of memory.
+*/
+static struct trail_cache_entry *cache_trail(const struct tdb_decode_state *s)
+{
+    const struct huff_decoder *decoder = s->db->decoder;
+    const struct field_stats *fstats = s->db->field_stats;
+    struct trail_cache_entry *entry, *tmp;
+    /* a guess, grows if needed */
+    uint64_t max_grams = HUFF_MULTI_MAX_GRAMS + (s->size - s->offset) / 16;
+    uint64_t offset = s->offset;
+    uint64_t n = 0;
+
+    if (!(entry = malloc(sizeof(struct trail_cache_entry) +
+                         max_grams * sizeof(__uint128_t))))
+        return NULL;
+
+    while (offset < s->size){
+        if (n + HUFF_MULTI_MAX_GRAMS > max_grams){
+            max_grams *= 2;
+            if (!(tmp = realloc(entry, sizeof(struct trail_cache_entry) +
+                                       max_grams * sizeof(__uint128_t)))){
+                free(entry);
+                return NULL;
+            }
+            entry = tmp;
+        }
+        if (decoder->multi){
+            uint64_t ends[HUFF_MULTI_MAX_GRAMS];
+            uint32_t j, k = huff_decode_multi(decoder,
+                                              s->data,
+                                              offset,
+                                              fstats,
+                                              &entry->grams[n],
+                                              ends);
+            /* the last lookup may decode padding past the end */
+            for (j = 0; j < k && offset < s->size; j++)
+                offset = ends[j];
+            n += j;
+        }else
+            entry->grams[n++] = huff_decode_value(decoder,
+                                                  s->data,
+                                                  &offset,
+                                                  fstats);
+    }
+
+    entry->trail_id = s->trail_id;
+    entry->num_grams = n;
+    entry->size = sizeof(struct trail_cache_entry) + n * sizeof(__uint128_t);
+    /* shrinking doesn't fail in practice, but keep the original if it does */
+    if ((tmp = realloc(entry, entry->size)))
+        entry = tmp;
+
+    return trail_cache_put(s->db->trail_cache, entry);
+}
+
+/*
+replay the current trail from the trail cache, adding it to the cache
+first if it's missing. The trail is decoded from trails.data as usual
+if the cache is disabled or out of memory.
+
+Range scans read each trail once, so they replay cached trails but
+don't add new ones, which would only evict trails that are hot.
+*/
+static void use_trail_cache(struct tdb_decode_state *s)
+{
+    int miss;
+
+    if (!(s->cache_entry = trail_cache_get(s->db->trail_cache,
+                                           s->trail_id,
+                                           &miss)) && miss && !s->in_scan)
+        s->cache_entry = cache_trail(s);
+
+    if (s->cache_entry){
+        s->size = s->cache_entry->num_grams;
+        s->offset = 0;
+    }
+}
+
+static tdb_error open_trail(tdb_cursor *cursor, uint64_t trail_id, int in_scan)
 {
     struct tdb_decode_state *s = cursor->state;
     const tdb *db = s->db;
     tdb_error err = 0;
 
+    s->batch_num_events = 0;
+    s->in_scan = in_scan;
+    release_cached_trail(s);
     if (trail_id < db->num_trails){
         /* initialize cursor for a new trail */
 
         uint64_t trail_size;
         tdb_field field;
 
+        s->trail_id = trail_id;
+
         /*
         db->opt_event_filter may have changed since the last
         tdb_get_trail call, so we will always reset it. Also
@@ -180,12 +559,52 @@ TDB_EXPORT tdb_error tdb_get_trail(tdb_cursor *cursor,
             }
         }
 
-        if (s->filter && (s->filter->options & TDB_FILTER_MATCH_NONE)){
+        /* recompile the filter if it has changed since the last trail */
+        if (s->filter && (err = update_compiled_filter(db,
+                                                       s->filter,
+                                                       s->compiled_filter)))
+            goto done;
+
+        if (s->num_filters && (err = select_filters(s, trail_id)))
+            goto done;
+
+        /*
+        evaluate a single filter over blocks of events, see
+        next_batch_filtered(). Edge-encoded events don't have all the
+        fields.
+        */
+        s->batch_filter = s->filter &&
+                          !s->edge_encoded &&
+                          s->compiled_filter->cost >= FILTER_BATCH_MIN_COST;
+        if (s->batch_filter && !s->batch_items){
+            if (!(s->batch_items = calloc(db->num_fields * FILTER_BATCH_SIZE,
+                                          sizeof(tdb_item)))){
+                err = TDB_ERR_NOMEM;
+                goto done;
+            }
+        }
+
+        if (s->filter && s->compiled_filter->match_none){
             /*
             no need to evaluate anything if the filter matches nothing
             */
             err = 0;
             goto done;
+        }else if (s->filter &&
+                  db->summary.data &&
+                  !trail_overlaps_filter(db,
+                                         trail_id,
+                                         s->compiled_filter)){
+            /*
+            no need to decode the trail if its events are outside
+            the time ranges of the filter
+            */
+            err = 0;
+            goto done;
+        }else if (s->num_filters && !s->num_active_filters){
+            /* none of the filters can match events of the trail */
+            err = 0;
+            goto done;
         }else{
             /*
             edge encoding: some fields may be inherited from previous events.
@@ -201,7 +620,15 @@ TDB_EXPORT tdb_error tdb_get_trail(tdb_cursor *cursor,
             s->offset = 3;
             s->tstamp = db->min_timestamp;
 
-            s->trail_id = trail_id;
+            if (db->trail_cache)
+                use_trail_cache(s);
+
+            if (s->filter)
+                s->stop_time = s->compiled_filter->stop_time;
+            else if (!s->num_filters)
+                s->stop_time = UINT64_MAX;
+            s->limit_left = s->limit ? s->limit: UINT64_MAX;
+
             cursor->num_events_left = 0;
             cursor->next_event = s->events_buffer;
             return 0;
@@ -216,38 +643,611 @@ done:
     return err;
 }
 
+TDB_EXPORT tdb_error tdb_get_trail(tdb_cursor *cursor,
+                                   uint64_t trail_id)
+{
+    return open_trail(cursor, trail_id, 0);
+}
+
+static inline uint64_t tdb_get_trail_num_events(const tdb *db,
+                                                uint64_t trail_id)
+{
+    uint64_t width;
+    memcpy(&width, db->lengths.data, 8);
+    return read_bits64(&db->lengths.data[8], trail_id * width, (uint32_t)width);
+}
+
 TDB_EXPORT uint64_t tdb_get_trail_length(tdb_cursor *cursor)
 {
+    struct tdb_decode_state *s = cursor->state;
     uint64_t count = 0;
+
+    /*
+    if nothing has been decoded since tdb_get_trail() and every event
+    would be returned, we can use the stored length of the trail
+    */
+    if (s->db->lengths.data &&
+        !s->filter &&
+        !s->num_filters &&
+        s->limit_left == UINT64_MAX &&
+        s->offset == (s->cache_entry ? 0: 3) &&
+        s->offset < s->size &&
+        !cursor->num_events_left){
+
+        s->offset = s->size;
+        return tdb_get_trail_num_events(s->db, s->trail_id);
+    }
+
     while (_tdb_cursor_next_batch(cursor))
         count += cursor->num_events_left;
     return count;
 }
 
-TDB_EXPORT int _tdb_cursor_next_batch(tdb_cursor *cursor)
+TDB_EXPORT tdb_error tdb_trail_num_events(const tdb *db,
+                                          uint64_t trail_id,
+                                          uint64_t *num_events)
+{
+    tdb_cursor *cursor;
+    tdb_error err;
+
+    if (trail_id >= db->num_trails)
+        return TDB_ERR_INVALID_TRAIL_ID;
+
+    if (db->lengths.data){
+        *num_events = tdb_get_trail_num_events(db, trail_id);
+        return 0;
+    }
+
+    /*
+    tdbs created by older versions don't have trails.lengths, so we need
+    to decode the trail, ignoring any event filters like
+    tdb_trail_time_bounds() does
+    */
+    if (!(cursor = tdb_cursor_new(db)))
+        return TDB_ERR_NOMEM;
+    cursor->state->filter = NULL;
+    cursor->state->filter_type = CURSOR_FILTER;
+
+    if (!(err = tdb_get_trail(cursor, trail_id)))
+        *num_events = tdb_get_trail_length(cursor);
+
+    tdb_cursor_free(cursor);
+    return err;
+}
+
+TDB_EXPORT tdb_error tdb_trail_time_bounds(const tdb *db,
+                                           uint64_t trail_id,
+                                           uint64_t *first,
+                                           uint64_t *last)
+{
+    tdb_cursor *cursor = NULL;
+    const tdb_event *event;
+    tdb_error err = 0;
+
+    if (trail_id >= db->num_trails)
+        return TDB_ERR_INVALID_TRAIL_ID;
+
+    if (db->summary.data){
+        tdb_get_trail_summary(db, trail_id, first, last);
+        return 0;
+    }
+
+    /*
+    tdbs created by older versions don't have trails.summary, so we need
+    to decode the trail. An empty cursor-level filter overrides any
+    db-level and trail-level filters.
+    */
+    if (!(cursor = tdb_cursor_new(db)))
+        return TDB_ERR_NOMEM;
+    cursor->state->filter = NULL;
+    cursor->state->filter_type = CURSOR_FILTER;
+
+    if ((err = tdb_get_trail(cursor, trail_id)))
+        goto done;
+
+    /* trails are never empty unless the tdb is corrupted */
+    if (!(event = tdb_cursor_next(cursor))){
+        err = TDB_ERR_INVALID_TRAILS_FILE;
+        goto done;
+    }
+    *first = *last = event->timestamp;
+    while ((event = tdb_cursor_next(cursor)))
+        *last = event->timestamp;
+done:
+    tdb_cursor_free(cursor);
+    return err;
+}
+
+/* apply advice to the pages of trails.data between byte offsets */
+static void scan_advise(const tdb *db, uint64_t start, uint64_t end, int advice)
+{
+    const uint64_t page_mask = ~((uint64_t)getpagesize() - 1);
+    const uint64_t shift = (uint64_t)(db->trails.data - db->trails.ptr);
+
+    if (advice == MADV_WILLNEED){
+        /* prefetch pages that are partially in the range */
+        start = (start + shift) & page_mask;
+        end = (end + shift + ~page_mask) & page_mask;
+        if (end > db->trails.mmap_size)
+            end = db->trails.mmap_size;
+    }else{
+        /* but don't release them, they may be still needed */
+        start = (start + shift + ~page_mask) & page_mask;
+        end = (end + shift) & page_mask;
+    }
+    if (start < end){
+        if (advice == MADV_DONTNEED){
+#ifdef MADV_COLD
+            /*
+            MADV_COLD only deactivates pages, so they are reclaimed
+            before the pages of other processes. It requires Linux 5.4.
+            */
+            if (!madvise(&db->trails.ptr[start], end - start, MADV_COLD))
+                return;
+#endif
+        }
+        madvise(&db->trails.ptr[start], end - start, advice);
+    }
+}
+
+TDB_EXPORT tdb_error tdb_cursor_scan_range(tdb_cursor *cursor,
+                                           uint64_t start_trail,
+                                           uint64_t end_trail)
 {
     struct tdb_decode_state *s = cursor->state;
-    const struct huff_codebook *codebook =
-        (const struct huff_codebook*)s->db->codebook.data;
+    const tdb *db = s->db;
+
+    if (start_trail > end_trail || end_trail > db->num_trails)
+        return TDB_ERR_INVALID_TRAIL_ID;
+
+    s->scan_next_trail = start_trail;
+    s->scan_end_trail = end_trail;
+    if (db->num_trails)
+        s->scan_advised = s->scan_released = tdb_get_trail_offs(db,
+                                                                start_trail);
+
+    cursor->num_events_left = 0;
+    cursor->next_event = NULL;
+    s->size = 0;
+    s->offset = 0;
+    return 0;
+}
+
+TDB_EXPORT tdb_error tdb_cursor_next_trail(tdb_cursor *cursor,
+                                           uint64_t *trail_id)
+{
+    struct tdb_decode_state *s = cursor->state;
+    const tdb *db = s->db;
+    uint64_t start, end;
+
+    if (s->scan_next_trail == s->scan_end_trail){
+        if (s->scan_end_trail){
+            /* release the tail of the range */
+            end = tdb_get_trail_offs(db, s->scan_end_trail);
+            scan_advise(db, s->scan_released, end, MADV_DONTNEED);
+            s->scan_released = end;
+        }
+        return TDB_ERR_INVALID_TRAIL_ID;
+    }
+
+    *trail_id = s->scan_next_trail++;
+    start = tdb_get_trail_offs(db, *trail_id);
+    end = tdb_get_trail_offs(db, *trail_id + 1);
+
+    /* keep at least half a window prefetched ahead of the cursor */
+    if (end + SCAN_WINDOW_SIZE / 2 > s->scan_advised){
+        uint64_t advised = end + SCAN_WINDOW_SIZE;
+        uint64_t range_end = tdb_get_trail_offs(db, s->scan_end_trail);
+        if (advised > range_end)
+            advised = range_end;
+        if (advised > s->scan_advised){
+            scan_advise(db, s->scan_advised, advised, MADV_WILLNEED);
+            s->scan_advised = advised;
+        }
+    }
+
+    /* release pages that the cursor has left behind */
+    if (start >= s->scan_released + SCAN_WINDOW_SIZE){
+        scan_advise(db, s->scan_released, start, MADV_DONTNEED);
+        s->scan_released = start;
+    }
+
+    return open_trail(cursor, *trail_id, 1);
+}
+
+/*
+find the last checkpoint of the trail in trails.index that precedes
+the first event at or after timestamp. Returns NULL if there is none.
+*/
+static const uint64_t *find_checkpoint(const tdb *db,
+                                       uint64_t trail_id,
+                                       uint64_t timestamp)
+{
+    const uint64_t *index = (const uint64_t*)db->index.data;
+    const uint64_t num_indexed = index[db->index.size / 8 - 1];
+    const uint64_t num_checkpoints = index[db->index.size / 8 - 2];
+    const uint64_t record_size = db->num_fields + 1;
+    const uint64_t *directory = &index[num_checkpoints * record_size];
+    uint64_t left = 0;
+    uint64_t right = num_indexed;
+    uint64_t first;
+
+    /* find the trail in the directory */
+    while (left < right){
+        uint64_t mid = left + (right - left) / 2;
+        if (directory[mid * 2] < trail_id)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+    if (left == num_indexed || directory[left * 2] != trail_id)
+        return NULL;
+
+    /*
+    a checkpoint stores the timestamp of the event preceding it, so
+    we can start from it if the timestamp is smaller than the target
+    */
+    first = directory[left * 2 + 1];
+    right = directory[left * 2 + 3];
+    left = first;
+    while (left < right){
+        uint64_t mid = left + (right - left) / 2;
+        if (index[mid * record_size + 1] < timestamp)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+    return left > first ? &index[(left - 1) * record_size]: NULL;
+}
+
+TDB_EXPORT tdb_error tdb_cursor_seek_time(tdb_cursor *cursor,
+                                          uint64_t timestamp)
+{
+    struct tdb_decode_state *s = cursor->state;
+    const tdb *db = s->db;
+    const uint64_t *checkpoint;
+    uint64_t limit_left;
+    tdb_error err;
+
+    /* a trail must be selected first */
+    if (s->trail_id >= db->num_trails)
+        return TDB_ERR_INVALID_TRAIL_ID;
+
+    /* restart the trail, bypassing the trail cache if it is being scanned */
+    if ((err = open_trail(cursor, s->trail_id, s->in_scan)))
+        return err;
+
+    /* nothing to decode */
+    if (s->offset >= s->size)
+        return 0;
+
+    /*
+    checkpoints refer to bit offsets of trails.data. A cached trail is
+    replayed from the start, which is cheap without Huffman decoding.
+    */
+    if (!s->cache_entry &&
+        db->index.data &&
+        (checkpoint = find_checkpoint(db, s->trail_id, timestamp))){
+        s->offset = checkpoint[0];
+        s->tstamp = checkpoint[1];
+        memcpy(&s->previous_items[1],
+               &checkpoint[2],
+               (db->num_fields - 1) * sizeof(tdb_item));
+    }
+
+    /* skipped events don't count towards the limit */
+    limit_left = s->limit_left;
+    s->limit_left = UINT64_MAX;
+
+    while (_tdb_cursor_next_batch(cursor)){
+        while (cursor->num_events_left){
+            const tdb_event *e = (const tdb_event*)cursor->next_event;
+            if (e->timestamp >= timestamp){
+                if (cursor->num_events_left >= limit_left){
+                    cursor->num_events_left = limit_left;
+                    s->limit_left = 0;
+                    s->offset = s->size;
+                }else
+                    s->limit_left = limit_left - cursor->num_events_left;
+                return 0;
+            }
+            cursor->next_event += sizeof(tdb_event) +
+                                  e->num_items * sizeof(tdb_item);
+            --cursor->num_events_left;
+        }
+    }
+    return 0;
+}
+
+/* set the bits of filters that match the event in match_masks */
+static inline int event_matches_filters(const struct tdb_decode_state *s,
+                                        uint64_t event_idx)
+{
+    uint64_t *mask = &s->match_masks[event_idx * s->mask_words];
+    uint64_t i, matches = 0;
+
+    memset(mask, 0, s->mask_words * sizeof(uint64_t));
+    for (i = 0; i < s->num_active_filters; i++){
+        const uint64_t idx = s->active_filters[i];
+        if (filter_match(&s->compiled_filters[idx],
+                         s->previous_items,
+                         s->tstamp)){
+            mask[idx >> 6] |= 1LLU << (idx & 63);
+            matches = 1;
+        }
+    }
+    return (int)matches;
+}
+
+static inline int event_matches(const struct tdb_decode_state *s,
+                                uint64_t event_idx)
+{
+    if (s->num_filters)
+        return event_matches_filters(s, event_idx);
+    return !s->filter ||
+           filter_match(s->compiled_filter, s->previous_items, s->tstamp);
+}
+
+DECODE_INLINE tdb_field item_field(tdb_item item, const int flags)
+{
+    if (flags & DECODE_NARROW)
+        return (tdb_field)tdb_item_field32(item);
+    else
+        return tdb_item_field(item);
+}
+
+/*
+add the items of a gram to the current event. Returns 0 if the gram
+starts the next event, i.e. its first item is a timestamp
+*/
+DECODE_INLINE int push_items(struct tdb_decode_state *s,
+                             __uint128_t gram,
+                             uint64_t *dst,
+                             uint64_t *i,
+                             const int flags)
+{
+    tdb_item item = HUFF_BIGRAM_TO_ITEM(gram);
+    tdb_field field = item_field(item, flags);
+
+    if (!field)
+        return 0;
+
+    /* value may be either a unigram or a bigram */
+    do{
+        s->previous_items[field] = item;
+        if ((flags & DECODE_EDGE) && s->projected[field])
+            dst[(*i)++] = item;
+        if (flags & DECODE_UNIGRAMS)
+            break;
+        item = HUFF_BIGRAM_OTHER_ITEM(gram);
+        gram = item;
+    }while ((field = item_field(item, flags)));
+    return 1;
+}
+
+static inline void aggregate_event(struct tdb_aggregate *agg,
+                                   const struct tdb_decode_state *s)
+{
+    if (agg->field){
+        const tdb_val val = tdb_item_val(s->previous_items[agg->field]);
+        if (agg->event_counts)
+            ++agg->event_counts[val];
+        if (agg->trail_counts && agg->last_trail[val] != s->trail_id + 1){
+            agg->last_trail[val] = s->trail_id + 1;
+            ++agg->trail_counts[val];
+        }
+    }else if (s->tstamp >= agg->start){
+        const uint64_t bucket = (s->tstamp - agg->start) / agg->bucket_width;
+        if (bucket < agg->num_buckets)
+            ++agg->buckets[bucket];
+    }
+}
+
+/*
+finalize the event starting at dst[orig_i]. Returns the new end of
+the events buffer
+*/
+DECODE_INLINE uint64_t finish_event(struct tdb_decode_state *s,
+                                    uint64_t *dst,
+                                    uint64_t i,
+                                    uint64_t orig_i,
+                                    uint64_t *num_events,
+                                    const int flags)
+{
+    const int edge_encoded = flags & DECODE_EDGE;
+    tdb_field field;
+
+    if (s->batch_filter){
+        /*
+        the filter is evaluated by next_batch_filtered(), store the
+        fields it needs column by column
+        */
+        const struct compiled_filter *f = s->compiled_filter;
+        tdb_item *column = &s->batch_items[*num_events];
+        uint64_t k;
+        column[0] = s->tstamp;
+        for (k = 0; k < f->num_fields; k++)
+            column[f->fields[k] * FILTER_BATCH_SIZE] =
+                s->previous_items[f->fields[k]];
+    }else if (!event_matches(s, s->visit ? 0: *num_events))
+        /*
+        filter doesn't match - ignore this event. A callback sees only
+        one event at a time, so its matches are stored as the first one.
+        */
+        return orig_i;
+
+    if (s->aggregate){
+        /* count the event, the buffer is used only as scratch space */
+        aggregate_event(s->aggregate, s);
+        ++*num_events;
+        return orig_i;
+    }
+
+    if (s->visit){
+        /*
+        pass the event to the callback and reuse its space. Without
+        edge encoding and projection, items are the current values of
+        all fields, which don't need to be copied.
+        */
+        int stop;
+        if (edge_encoded)
+            stop = s->visit(s->tstamp,
+                            &dst[orig_i + 2],
+                            i - (orig_i + 2),
+                            s->visit_ctx);
+        else if (s->projection){
+            uint64_t k;
+            for (k = 0; k < s->num_projected; k++)
+                dst[i++] = s->previous_items[s->projection[k]];
+            stop = s->visit(s->tstamp,
+                            &dst[orig_i + 2],
+                            s->num_projected,
+                            s->visit_ctx);
+        }else
+            stop = s->visit(s->tstamp,
+                            &s->previous_items[1],
+                            s->db->num_fields - 1,
+                            s->visit_ctx);
+        ++*num_events;
+        if (stop){
+            /* decoding stops at the next timestamp */
+            s->visit_stopped = 1;
+            s->stop_time = 0;
+        }
+        return orig_i;
+    }
+
+    /*
+    no filter, the filter matches or it is evaluated later, finalize
+    the event
+    */
+    if (!edge_encoded){
+        /* dump all the fields of this event in the result, if edge
+           encoding is not requested
+        */
+        if (s->projection){
+            uint64_t k;
+            for (k = 0; k < s->num_projected; k++)
+                dst[i++] = s->previous_items[s->projection[k]];
+        }else
+            for (field = 1; field < s->db->num_fields; field++)
+                dst[i++] = s->previous_items[field];
+    }
+    ++*num_events;
+    dst[orig_i + 1] = (i - (orig_i + 2));
+    return i;
+}
+
+/*
+decode at most max_events events to dst from a stream of grams, so that
+grams resolved by a single lookup of the multi-symbol decoding table can
+span event boundaries. The grams are either decoded from trails.data or
+replayed from the trail cache if cached is set. Returns the number of
+events.
+*/
+DECODE_INLINE uint64_t decode_grams(struct tdb_decode_state *s,
+                                    uint64_t *dst,
+                                    uint64_t max_events,
+                                    const int cached,
+                                    const int flags)
+{
+    const struct huff_decoder *decoder = s->db->decoder;
     const struct field_stats *fstats = s->db->field_stats;
-    uint64_t *dst = (uint64_t*)s->events_buffer;
+    const char *data = s->data;
+    const uint64_t size = s->size;
+    uint64_t offset = s->offset;
+    uint64_t i = 0;
+    uint64_t orig_i = 0;
+    uint64_t num_events = 0;
+    int in_event = 0;
+
+    while (offset < size){
+        __uint128_t decoded[HUFF_MULTI_MAX_GRAMS];
+        uint64_t ends[HUFF_MULTI_MAX_GRAMS];
+        const __uint128_t *grams;
+        uint64_t j, n;
+
+        if (cached){
+            /* offset is the index of the next gram */
+            grams = &s->cache_entry->grams[offset];
+            n = size - offset;
+        }else{
+            n = huff_decode_multi(decoder,
+                                  data,
+                                  offset,
+                                  fstats,
+                                  decoded,
+                                  ends);
+            grams = decoded;
+        }
+
+        for (j = 0; j < n && offset < size; j++){
+            if (!push_items(s, grams[j], dst, &i, flags)){
+                /* timestamp: the previous event is complete */
+                if (in_event)
+                    i = finish_event(s, dst, i, orig_i, &num_events, flags);
+                /* exit early if destination buffer runs out of space */
+                if (num_events == max_events){
+                    in_event = 0;
+                    goto done;
+                }
+                s->tstamp += tdb_item_val(HUFF_BIGRAM_TO_ITEM(grams[j]));
+                if (s->tstamp >= s->stop_time){
+                    /* no later event can match the filter */
+                    in_event = 0;
+                    offset = size;
+                    goto done;
+                }
+                in_event = 1;
+                orig_i = i;
+                dst[i++] = s->tstamp;
+                ++i;
+                /* handle a possible latter part of the first bigram */
+                if (!(flags & DECODE_UNIGRAMS))
+                    push_items(s,
+                               HUFF_BIGRAM_OTHER_ITEM(grams[j]),
+                               dst,
+                               &i,
+                               flags);
+            }
+            offset = cached ? offset + 1: ends[j];
+        }
+    }
+done:
+    if (in_event)
+        finish_event(s, dst, i, orig_i, &num_events, flags);
+
+    s->offset = offset;
+    return num_events;
+}
+
+/*
+decode at most max_events events to dst with the single-symbol decoding
+table. Returns the number of events.
+*/
+DECODE_INLINE uint64_t decode_values(struct tdb_decode_state *s,
+                                     uint64_t *dst,
+                                     uint64_t max_events,
+                                     const int flags)
+{
+    const struct huff_decoder *decoder = s->db->decoder;
+    const struct field_stats *fstats = s->db->field_stats;
+    const char *data = s->data;
+    const uint64_t size = s->size;
+    uint64_t offset = s->offset;
     uint64_t i = 0;
     uint64_t num_events = 0;
-    tdb_field field;
-    tdb_item item;
-    const int edge_encoded = s->edge_encoded;
 
     /* decode the trail - exit early if destination buffer runs out of space */
-    while (s->offset < s->size && num_events < s->events_buffer_len){
+    while (offset < size && num_events < max_events){
         /* Every event starts with a timestamp.
            Timestamp may be the first member of a bigram */
-        __uint128_t gram = huff_decode_value(codebook,
-                                             s->data,
-                                             &s->offset,
+        __uint128_t gram = huff_decode_value(decoder,
+                                             data,
+                                             &offset,
                                              fstats);
         uint64_t orig_i = i;
         uint64_t delta = tdb_item_val(HUFF_BIGRAM_TO_ITEM(gram));
-        uint64_t *num_items;
 
         /*
         events buffer format:
@@ -262,69 +1262,260 @@ TDB_EXPORT int _tdb_cursor_next_batch(tdb_cursor *cursor)
         */
 
         s->tstamp += delta;
+        if (s->tstamp >= s->stop_time){
+            /* no later event can match the filter */
+            offset = size;
+            break;
+        }
         dst[i++] = s->tstamp;
-        num_items = &dst[i++];
-
-        item = HUFF_BIGRAM_OTHER_ITEM(gram);
+        /* num_items is set by finish_event() */
+        ++i;
 
         /* handle a possible latter part of the first bigram */
-        if (item){
-            field = tdb_item_field(item);
-            s->previous_items[field] = item;
-            if (edge_encoded)
-                dst[i++] = item;
-        }
+        if (!(flags & DECODE_UNIGRAMS))
+            push_items(s, HUFF_BIGRAM_OTHER_ITEM(gram), dst, &i, flags);
 
         /* decode one event: timestamp is followed by at most num_ofields
            field values */
-        while (s->offset < s->size){
-            uint64_t prev_offs = s->offset;
-            gram = huff_decode_value(codebook,
-                                     s->data,
-                                     &s->offset,
+        while (offset < size){
+            uint64_t prev_offs = offset;
+            gram = huff_decode_value(decoder,
+                                     data,
+                                     &offset,
                                      fstats);
-            item = HUFF_BIGRAM_TO_ITEM(gram);
-            field = tdb_item_field(item);
-            if (field){
-                /* value may be either a unigram or a bigram */
-                do{
-                    s->previous_items[field] = item;
-                    if (edge_encoded)
-                        dst[i++] = item;
-                    gram = item = HUFF_BIGRAM_OTHER_ITEM(gram);
-                }while ((field = tdb_item_field(item)));
-            }else{
+            if (!push_items(s, gram, dst, &i, flags)){
                 /* we hit the next timestamp, take a step back and break */
-                s->offset = prev_offs;
+                offset = prev_offs;
                 break;
             }
         }
 
-        if (!s->filter ||
-            (s->filter->options & TDB_FILTER_MATCH_ALL) ||
-            event_satisfies_filter(s->previous_items,
-                                   s->tstamp,
-                                   s->filter->items,
-                                   s->filter->count)){
-
-            /* no filter or filter matches, finalize the event */
-            if (!edge_encoded){
-                /* dump all the fields of this event in the result, if edge
-                   encoding is not requested
-                */
-                for (field = 1; field < s->db->num_fields; field++)
-                    dst[i++] = s->previous_items[field];
+        i = finish_event(s, dst, i, orig_i, &num_events, flags);
+    }
+
+    s->offset = offset;
+    return num_events;
+}
+
+typedef uint64_t (*decode_fn)(struct tdb_decode_state *s,
+                              uint64_t *dst,
+                              uint64_t max_events);
+
+/*
+decoding routines for trails.data with the multi-symbol or the
+single-symbol decoding table, and for trails replayed from the trail
+cache
+*/
+struct decoder_variant{
+    decode_fn multi;
+    decode_fn single;
+    decode_fn cached;
+};
+
+#define DECODER_FUNCTIONS(isa, attr, flags)                              \
+attr static uint64_t decode_multi_##isa##flags(                          \
+    struct tdb_decode_state *s,                                          \
+    uint64_t *dst,                                                       \
+    uint64_t max_events)                                                 \
+{                                                                        \
+    return decode_grams(s, dst, max_events, 0, flags);                   \
+}                                                                        \
+attr static uint64_t decode_single_##isa##flags(                         \
+    struct tdb_decode_state *s,                                          \
+    uint64_t *dst,                                                       \
+    uint64_t max_events)                                                 \
+{                                                                        \
+    return decode_values(s, dst, max_events, flags);                     \
+}                                                                        \
+attr static uint64_t decode_cached_##isa##flags(                         \
+    struct tdb_decode_state *s,                                          \
+    uint64_t *dst,                                                       \
+    uint64_t max_events)                                                 \
+{                                                                        \
+    return decode_grams(s, dst, max_events, 1, flags);                   \
+}
+
+#define DECODERS(isa, flags)          \
+    {decode_multi_##isa##flags,       \
+     decode_single_##isa##flags,      \
+     decode_cached_##isa##flags}
+
+#define DECODER_TABLE(isa)                                  \
+    {DECODERS(isa, 0), DECODERS(isa, 1), DECODERS(isa, 2),  \
+     DECODERS(isa, 3), DECODERS(isa, 4), DECODERS(isa, 5),  \
+     DECODERS(isa, 6), DECODERS(isa, 7)}
+
+/*
+flags are combinations of DECODE_EDGE, DECODE_NARROW and DECODE_UNIGRAMS.
+On x86-64, the routines are compiled also for BMI2, which has shifts and
+bit field extraction that don't clobber flags, selected at runtime.
+*/
+#define DECODER_VARIANTS(isa, attr)   \
+    DECODER_FUNCTIONS(isa, attr, 0)   \
+    DECODER_FUNCTIONS(isa, attr, 1)   \
+    DECODER_FUNCTIONS(isa, attr, 2)   \
+    DECODER_FUNCTIONS(isa, attr, 3)   \
+    DECODER_FUNCTIONS(isa, attr, 4)   \
+    DECODER_FUNCTIONS(isa, attr, 5)   \
+    DECODER_FUNCTIONS(isa, attr, 6)   \
+    DECODER_FUNCTIONS(isa, attr, 7)
+
+DECODER_VARIANTS(generic_, )
+
+static const struct decoder_variant GENERIC_DECODERS[] =
+    DECODER_TABLE(generic_);
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define DECODE_BMI2
+
+DECODER_VARIANTS(bmi2_, __attribute__((target("bmi2"))))
+
+static const struct decoder_variant BMI2_DECODERS[] =
+    DECODER_TABLE(bmi2_);
+#endif
+
+static const struct decoder_variant *select_decoders(const tdb *db,
+                                                     int edge_encoded)
+{
+    int flags = 0;
+
+    if (edge_encoded)
+        flags |= DECODE_EDGE;
+    if (db->num_fields <= TDB_FIELD32_MAX + 1)
+        flags |= DECODE_NARROW;
+    /* tdbs without events don't have a decoder */
+    if (db->decoder && !db->decoder->has_bigrams)
+        flags |= DECODE_UNIGRAMS;
+
+#ifdef DECODE_BMI2
+    if (__builtin_cpu_supports("bmi2"))
+        return &BMI2_DECODERS[flags];
+#endif
+    return &GENERIC_DECODERS[flags];
+}
+
+static inline uint64_t decode_events(struct tdb_decode_state *s,
+                                     uint64_t *dst,
+                                     uint64_t max_events)
+{
+    if (s->cache_entry)
+        return s->decoders->cached(s, dst, max_events);
+    /* tdbs without events don't have a decoder */
+    else if (s->offset < s->size && s->db->decoder->multi)
+        return s->decoders->multi(s, dst, max_events);
+    else
+        return s->decoders->single(s, dst, max_events);
+}
+
+/*
+decode events in blocks of FILTER_BATCH_SIZE events, evaluate the
+filter over each block at once with filter_match_batch() and drop
+events that don't match from the events buffer
+*/
+static uint64_t next_batch_filtered(struct tdb_decode_state *s,
+                                    uint64_t max_events)
+{
+    const uint64_t event_size = 2 + (s->projection ? s->num_projected:
+                                                     s->db->num_fields - 1);
+    uint64_t *dst = (uint64_t*)s->events_buffer;
+    uint64_t i = 0;
+    uint64_t num_events = 0;
+
+    while (num_events < max_events && s->offset < s->size){
+        uint64_t *block = &dst[i];
+        uint64_t mask[FILTER_BATCH_SIZE / 64];
+        uint64_t j, k, n = max_events - num_events;
+
+        if (n > FILTER_BATCH_SIZE)
+            n = FILTER_BATCH_SIZE;
+        n = decode_events(s, block, n);
+        filter_match_batch(s->compiled_filter, s->batch_items, n, mask);
+
+        /* events are of fixed size without edge encoding */
+        for (j = 0, k = 0; j < n; j++){
+            if ((mask[j >> 6] >> (j & 63)) & 1){
+                if (k != j)
+                    memcpy(&block[k * event_size],
+                           &block[j * event_size],
+                           event_size * sizeof(uint64_t));
+                ++k;
             }
-            ++num_events;
-            *num_items = (i - (orig_i + 2));
-        }else{
-            /* filter doesn't match - ignore this event */
-            i = orig_i;
         }
+        i += k * event_size;
+        num_events += k;
     }
+    return num_events;
+}
+
+/*
+decode the rest of the current trail to the counters of agg, without
+materializing events
+*/
+void tdb_cursor_aggregate(tdb_cursor *cursor, struct tdb_aggregate *agg)
+{
+    struct tdb_decode_state *s = cursor->state;
+
+    /* the filter is evaluated event by event in finish_event() */
+    s->batch_filter = 0;
+    s->aggregate = agg;
+    decode_events(s, (uint64_t*)s->events_buffer, s->limit_left);
+    s->aggregate = NULL;
+
+    s->offset = s->size;
+    cursor->num_events_left = 0;
+    s->batch_num_events = 0;
+}
+
+TDB_EXPORT tdb_error tdb_trail_foreach(tdb_cursor *cursor,
+                                       uint64_t trail_id,
+                                       tdb_event_callback callback,
+                                       void *ctx)
+{
+    struct tdb_decode_state *s = cursor->state;
+    tdb_error err;
+
+    if ((err = tdb_get_trail(cursor, trail_id)))
+        return err;
+
+    /*
+    the filter is evaluated event by event in finish_event(). Matches of
+    multiple filters are available to the callback through
+    tdb_cursor_event_matches() as if it was the only event returned.
+    */
+    s->batch_filter = 0;
+    s->batch_num_events = 1;
+    s->visit = callback;
+    s->visit_ctx = ctx;
+    s->visit_stopped = 0;
+    decode_events(s, (uint64_t*)s->events_buffer, s->limit_left);
+    s->visit = NULL;
+
+    s->offset = s->size;
+    cursor->num_events_left = 0;
+    s->batch_num_events = 0;
+    return s->visit_stopped ? TDB_ERR_SCAN_ABORTED: 0;
+}
+
+TDB_EXPORT int _tdb_cursor_next_batch(tdb_cursor *cursor)
+{
+    struct tdb_decode_state *s = cursor->state;
+    const uint64_t max_events = s->events_buffer_len < s->limit_left ?
+                                s->events_buffer_len: s->limit_left;
+    uint64_t num_events;
+
+    if (s->batch_filter)
+        num_events = next_batch_filtered(s, max_events);
+    else
+        num_events = decode_events(s, (uint64_t*)s->events_buffer, max_events);
+
+    /* the limit was reached, skip the rest of the trail */
+    if (num_events == s->limit_left)
+        s->offset = s->size;
+    s->limit_left -= num_events;
 
     cursor->next_event = s->events_buffer;
     cursor->num_events_left = num_events;
+    s->batch_num_events = num_events;
     return num_events > 0 ? 1: 0;
 }
 
@@ -28,6 +28,10 @@
 
 #define INITIAL_ENCODING_BUF_BITS 8 * 1024 * 1024
 
+/* trails.index has a checkpoint every TRAIL_INDEX_INTERVAL events */
+#define TRAIL_INDEX_INTERVAL 1024
+#define INDEX_DIRECTORY_INCREMENT 1024
+
 struct jm_fold_state{
     FILE *grouped_w;
 
@@ -215,6 +219,45 @@ done:
     return ret;
 }
 
+/*
+trails.lengths stores the number of events of each trail, so trail
+lengths can be queried without decoding trails. The file consists of
+a 64-bit header containing the number of bits per value, followed by
+the bit-packed values and 8 bytes of padding for read_bits64().
+*/
+static tdb_error store_lengths(const uint64_t *lengths,
+                               uint64_t num_trails,
+                               const char *path)
+{
+    FILE *out = NULL;
+    char *buf = NULL;
+    uint64_t i, max_length = 0, width = 1, size;
+    int ret = 0;
+
+    for (i = 0; i < num_trails; i++)
+        if (lengths[i] > max_length)
+            max_length = lengths[i];
+    while (max_length >> width)
+        ++width;
+
+    size = (num_trails * width + 7) / 8 + 8;
+    if (!(buf = calloc(1, size + 8))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+    for (i = 0; i < num_trails; i++)
+        write_bits64(buf, i * width, lengths[i]);
+
+    TDB_OPEN(out, path, "w");
+    TDB_WRITE(out, &width, 8);
+    TDB_WRITE(out, buf, size);
+
+done:
+    TDB_CLOSE_FINAL(out);
+    free(buf);
+    return ret;
+}
+
 static tdb_error encode_trails(const tdb_item *items,
                                FILE *grouped,
                                uint64_t num_events,
@@ -223,8 +266,13 @@ static tdb_error encode_trails(const tdb_item *items,
                                const struct judy_128_map *codemap,
                                const struct judy_128_map *gram_freqs,
                                const struct field_stats *fstats,
+                               uint64_t min_timestamp,
+                               uint64_t max_timestamp,
                                const char *path,
-                               const char *toc_path)
+                               const char *toc_path,
+                               const char *summary_path,
+                               const char *lengths_path,
+                               const char *index_path)
 {
     __uint128_t *grams = NULL;
     tdb_item *prev_items = NULL;
@@ -236,6 +284,14 @@ static tdb_error encode_trails(const tdb_item *items,
     FILE *out = NULL;
     uint64_t file_offs = 0;
     uint64_t *toc = NULL;
+    uint64_t *summary = NULL;
+    uint64_t *lengths = NULL;
+    FILE *index_out = NULL;
+    uint64_t *checkpoint = NULL;
+    uint64_t *directory = NULL;
+    uint64_t directory_size = 0;
+    uint64_t num_indexed = 0;
+    uint64_t num_checkpoints = 0;
     struct gram_bufs gbufs;
     struct tdb_grouped_event ev;
     int ret = 0;
@@ -268,6 +324,21 @@ static tdb_error encode_trails(const tdb_item *items,
         ret = TDB_ERR_NOMEM;
         goto done;
     }
+    /* make sure that malloc() succeeds with num_trails == 0 */
+    if (!(summary = malloc((num_trails + 1) * 16))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+    if (!(lengths = calloc(num_trails + 1, 8))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+    if (!(checkpoint = malloc((num_fields + 1) * 8))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+
+    TDB_OPEN(index_out, index_path, "w");
 
     rewind(grouped);
     if (num_events)
@@ -282,13 +353,47 @@ static tdb_error encode_trails(const tdb_item *items,
            should ignore. */
         uint64_t offs = 3;
         uint64_t trail_id = ev.trail_id;
+        uint64_t tstamp = min_timestamp;
         uint64_t n, m, trail_size;
 
         toc[trail_id] = file_offs;
+        summary[trail_id * 2] = tdb_item_val(ev.timestamp);
         memset(prev_items, 0, num_fields * sizeof(tdb_item));
 
         while (ev.trail_id == trail_id){
 
+            /* 0) add a checkpoint to trails.index, see tdb_cursor_seek_time() */
+            if (lengths[trail_id] &&
+                lengths[trail_id] % TRAIL_INDEX_INTERVAL == 0){
+
+                tdb_field j;
+                if (lengths[trail_id] == TRAIL_INDEX_INTERVAL){
+                    /* the first checkpoint of this trail */
+                    if (num_indexed * 2 + 4 > directory_size){
+                        directory_size += INDEX_DIRECTORY_INCREMENT;
+                        if (!(directory = realloc(directory,
+                                                  directory_size * 8))){
+                            ret = TDB_ERR_NOMEM;
+                            goto done;
+                        }
+                    }
+                    directory[num_indexed * 2] = trail_id;
+                    directory[num_indexed * 2 + 1] = num_checkpoints;
+                    ++num_indexed;
+                }
+                checkpoint[0] = offs;
+                checkpoint[1] = tstamp;
+                /* encoding starts with zeros but decoding with NULL items */
+                for (j = 1; j < num_fields; j++)
+                    checkpoint[j + 1] = prev_items[j] ? prev_items[j]:
+                                                        tdb_make_item(j, 0);
+                TDB_WRITE(index_out, checkpoint, (num_fields + 1) * 8);
+                ++num_checkpoints;
+            }
+
+            tstamp += tdb_item_val(ev.timestamp);
+            ++lengths[trail_id];
+
             /* 1) produce an edge-encoded set of items for this event */
             if ((ret = edge_encode_items(items,
                                          &encoded,
@@ -335,6 +440,9 @@ static tdb_error encode_trails(const tdb_item *items,
                 break;
         }
 
+        /* first and last timestamp, relative to min_timestamp */
+        summary[trail_id * 2 + 1] = tstamp - min_timestamp;
+
         /* write the length residual */
         if (offs & 7){
             trail_size = offs / 8 + 1;
@@ -364,9 +472,39 @@ static tdb_error encode_trails(const tdb_item *items,
     size_t offs_size = file_offs < UINT32_MAX ? 4 : 8;
     for (i = 0; i < num_trails + 1; i++)
         TDB_WRITE(out, &toc[i], offs_size);
+    TDB_CLOSE(out);
+
+    /*
+    trails.summary lets readers skip trails that don't overlap with
+    the time ranges of a query without decoding them
+    */
+    TDB_OPEN(out, summary_path, "w");
+    offs_size = max_timestamp - min_timestamp < UINT32_MAX ? 4 : 8;
+    for (i = 0; i < num_trails * 2; i++)
+        TDB_WRITE(out, &summary[i], offs_size);
+    TDB_CLOSE(out);
+
+    if ((ret = store_lengths(lengths, num_trails, lengths_path)))
+        goto done;
+
+    /*
+    trails.index consists of checkpoints, followed by a directory of
+    (trail_id, first checkpoint) pairs for trails that have checkpoints,
+    terminated by (num_trails, num_checkpoints), and the number of
+    trails in the directory
+    */
+    if (!(directory = realloc(directory, (num_indexed * 2 + 4) * 8))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+    directory[num_indexed * 2] = num_trails;
+    directory[num_indexed * 2 + 1] = num_checkpoints;
+    directory[num_indexed * 2 + 2] = num_indexed;
+    TDB_WRITE(index_out, directory, (num_indexed * 2 + 3) * 8);
 
 done:
     TDB_CLOSE_FINAL(out);
+    TDB_CLOSE_FINAL(index_out);
 
     free(write_buf);
     free_gram_bufs(&gbufs);
@@ -375,6 +513,10 @@ done:
     free(prev_items);
     free(buf);
     free(toc);
+    free(summary);
+    free(lengths);
+    free(checkpoint);
+    free(directory);
 
     return ret;
 }
@@ -396,11 +538,176 @@ done:
     return ret;
 }
 
-tdb_error tdb_encode(tdb_cons *cons, const tdb_item *items)
+struct value_freq{
+    uint64_t freq;
+    tdb_val val;
+};
+
+static int compare_freqs(const void *p1, const void *p2)
+{
+    const struct value_freq *x = (const struct value_freq*)p1;
+    const struct value_freq *y = (const struct value_freq*)p2;
+
+    /* descending by frequency, ties keep the first-seen order */
+    if (x->freq != y->freq)
+        return x->freq > y->freq ? -1: 1;
+    return x->val < y->val ? -1: x->val > y->val;
+}
+
+struct lexicon_values{
+    const char **values;
+    uint64_t *lengths;
+};
+
+static void *lexicon_values_fun(uint64_t id,
+                                const char *value,
+                                uint64_t len,
+                                void *state)
+{
+    struct lexicon_values *s = (struct lexicon_values*)state;
+    /* NOTE: vals start at 1 */
+    s->values[id - 1] = value;
+    s->lengths[id - 1] = len;
+    return state;
+}
+
+/*
+renumber values of each field in the descending order of their
+frequencies in unigram_freqs, so that the most common values get the
+smallest IDs and end up next to each other at the head of the lexicon.
+Lexicons of cons, items and unigram_freqs are all rewritten with the
+new IDs.
+*/
+static tdb_error renumber_values(tdb_cons *cons,
+                                 tdb_item *items,
+                                 uint64_t num_items,
+                                 Pvoid_t *unigram_freqs)
+{
+    struct value_freq *freqs = NULL;
+    struct lexicon_values lex = {.values = NULL, .lengths = NULL};
+    tdb_val **new_vals = NULL;
+    Pvoid_t new_freqs = NULL;
+    Word_t key, tmp;
+    Word_t *ptr;
+    uint64_t i, j;
+    int ret = 0;
+
+    if (!(new_vals = calloc(cons->num_ofields, sizeof(tdb_val*))))
+        goto out_of_memory;
+
+    for (i = 0; i < cons->num_ofields; i++){
+        const tdb_field field = (tdb_field)(i + 1);
+        const uint64_t num_values = jsm_num_keys(&cons->lexicons[i]);
+        struct judy_str_map lexicon;
+
+        if (!(new_vals[i] = malloc((num_values + 1) * sizeof(tdb_val))))
+            goto out_of_memory;
+        if (!(freqs = malloc(num_values * sizeof(struct value_freq))))
+            goto out_of_memory;
+        if (!(lex.values = malloc(num_values * sizeof(const char*))))
+            goto out_of_memory;
+        if (!(lex.lengths = malloc(num_values * sizeof(uint64_t))))
+            goto out_of_memory;
+
+        /*
+        unigram frequencies may be based on a sample of trails, values
+        that are not in the sample retain their relative order
+        */
+        for (j = 0; j < num_values; j++){
+            JLG(ptr, *unigram_freqs, tdb_make_item(field, j + 1));
+            freqs[j].freq = ptr ? *ptr: 0;
+            freqs[j].val = j + 1;
+        }
+        qsort(freqs, num_values, sizeof(struct value_freq), compare_freqs);
+
+        new_vals[i][0] = 0;
+        for (j = 0; j < num_values; j++)
+            new_vals[i][freqs[j].val] = j + 1;
+
+        /* jsm_insert() assigns IDs in the insertion order */
+        jsm_fold(&cons->lexicons[i], lexicon_values_fun, &lex);
+        if (jsm_init(&lexicon))
+            goto out_of_memory;
+        for (j = 0; j < num_values; j++){
+            const tdb_val val = freqs[j].val;
+            if (!jsm_insert(&lexicon,
+                            lex.values[val - 1],
+                            lex.lengths[val - 1])){
+                jsm_free(&lexicon);
+                goto out_of_memory;
+            }
+        }
+        jsm_free(&cons->lexicons[i]);
+        cons->lexicons[i] = lexicon;
+
+        free(freqs);
+        free(lex.values);
+        free(lex.lengths);
+        freqs = NULL;
+        lex.values = NULL;
+        lex.lengths = NULL;
+    }
+
+    for (j = 0; j < num_items; j++){
+        const tdb_field field = tdb_item_field(items[j]);
+        items[j] = tdb_make_item(field,
+                                 new_vals[field - 1][tdb_item_val(items[j])]);
+    }
+
+    /* timestamp deltas (field 0) are not renumbered */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-compare"
+    key = 0;
+    JLF(ptr, *unigram_freqs, key);
+    while (ptr){
+        const tdb_field field = tdb_item_field(key);
+        const uint64_t freq = *ptr;
+        Word_t *new_ptr;
+        const tdb_item item = field ?
+            tdb_make_item(field, new_vals[field - 1][tdb_item_val(key)]): key;
+        JLI(new_ptr, new_freqs, item);
+        *new_ptr = freq;
+        JLN(ptr, *unigram_freqs, key);
+    }
+    JLFA(tmp, *unigram_freqs);
+#pragma GCC diagnostic pop
+    *unigram_freqs = new_freqs;
+    new_freqs = NULL;
+
+done:
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-compare"
+    JLFA(tmp, new_freqs);
+#pragma GCC diagnostic pop
+    if (new_vals)
+        for (i = 0; i < cons->num_ofields; i++)
+            free(new_vals[i]);
+    free(new_vals);
+    free(freqs);
+    free(lex.values);
+    free(lex.lengths);
+    return ret;
+
+out_of_memory:
+    ret = TDB_ERR_NOMEM;
+    goto done;
+}
+
+/*
+encode items of cons. If renumbered_items is set, it points to the same
+items in writable memory, and values are renumbered by their frequency
+before encoding.
+*/
+static tdb_error encode(tdb_cons *cons,
+                        const tdb_item *items,
+                        tdb_item *renumbered_items)
 {
     char path[TDB_MAX_PATH_SIZE];
     char grouped_path[TDB_MAX_PATH_SIZE];
     char toc_path[TDB_MAX_PATH_SIZE];
+    char summary_path[TDB_MAX_PATH_SIZE];
+    char lengths_path[TDB_MAX_PATH_SIZE];
+    char index_path[TDB_MAX_PATH_SIZE];
     char *root = cons->root;
     char *read_buf = NULL;
     struct field_stats *fstats = NULL;
@@ -495,6 +802,17 @@ tdb_error tdb_encode(tdb_cons *cons, const tdb_item *items)
     }
     TDB_TIMER_END("trail/collect_unigrams");
 
+    /* 3b. optionally renumber values by their frequency */
+    if (renumbered_items){
+        TDB_TIMER_START
+        if ((ret = renumber_values(cons,
+                                   renumbered_items,
+                                   cons->items.next,
+                                   &unigram_freqs)))
+            goto done;
+        TDB_TIMER_END("trail/renumber_values");
+    }
+
     /* 4. construct uni/bi-grams */
     tdb_opt_value dont_build_bigrams;
     tdb_cons_get_opt(cons, TDB_OPT_CONS_NO_BIGRAMS, &dont_build_bigrams);
@@ -526,6 +844,9 @@ tdb_error tdb_encode(tdb_cons *cons, const tdb_item *items)
     TDB_TIMER_START
     TDB_PATH(path, "%s/trails.data", root);
     TDB_PATH(toc_path, "%s/trails.toc", root);
+    TDB_PATH(summary_path, "%s/trails.summary", root);
+    TDB_PATH(lengths_path, "%s/trails.lengths", root);
+    TDB_PATH(index_path, "%s/trails.index", root);
     if ((ret = encode_trails(items,
                              grouped_r,
                              num_events,
@@ -534,8 +855,13 @@ tdb_error tdb_encode(tdb_cons *cons, const tdb_item *items)
                              &codemap,
                              &gram_freqs,
                              fstats,
+                             cons->min_timestamp,
+                             max_timestamp,
                              path,
-                             toc_path)))
+                             toc_path,
+                             summary_path,
+                             lengths_path,
+                             index_path)))
         goto done;
     TDB_TIMER_END("trail/encode_trails");
 
@@ -568,3 +894,12 @@ out_of_memory:
     return TDB_ERR_NOMEM;
 }
 
+tdb_error tdb_encode(tdb_cons *cons, const tdb_item *items)
+{
+    return encode(cons, items, NULL);
+}
+
+tdb_error tdb_encode_renumbered(tdb_cons *cons, tdb_item *items)
+{
+    return encode(cons, items, items);
+}
@@ -56,7 +56,8 @@ typedef enum{
     TDB_ERR_ONLY_DIFF_FILTER = -513,
     TDB_ERR_NO_SUCH_ITEM = -514,
     TDB_ERR_INVALID_RANGE = -515,
-    TDB_ERR_INCORRECT_TERM_TYPE = -516
+    TDB_ERR_INCORRECT_TERM_TYPE = -516,
+    TDB_ERR_SCAN_ABORTED = -517
 
 } tdb_error;
 
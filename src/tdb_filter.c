@@ -0,0 +1,606 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb_filter.h"
+
+/*
+equality tests of filter_match_batch() use AVX2 or AVX-512 if the CPU
+supports them, selected at runtime
+*/
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FILTER_SIMD
+#include <immintrin.h>
+#endif
+
+#define BATCH_WORDS (FILTER_BATCH_SIZE / 64)
+
+static column_eq_fn select_column_eq(void);
+
+struct ranked_term{
+    double p;
+    struct filter_term term;
+};
+
+struct ranked_clause{
+    double rank;
+    double cost;
+    double p_fail;
+    uint64_t index;
+    struct filter_clause clause;
+};
+
+static int compare_terms(const void *p1, const void *p2)
+{
+    const struct filter_term *t1 = (const struct filter_term*)p1;
+    const struct filter_term *t2 = (const struct filter_term*)p2;
+
+    if (t1->field != t2->field)
+        return t1->field < t2->field ? -1: 1;
+    if (t1->op != t2->op)
+        return t1->op < t2->op ? -1: 1;
+    if (t1->item != t2->item)
+        return t1->item < t2->item ? -1: 1;
+    if (t1->end != t2->end)
+        return t1->end < t2->end ? -1: 1;
+    return 0;
+}
+
+/* the most likely term first, terms of the same field together */
+static int compare_ranked_terms(const void *p1, const void *p2)
+{
+    const struct ranked_term *t1 = (const struct ranked_term*)p1;
+    const struct ranked_term *t2 = (const struct ranked_term*)p2;
+
+    if (t1->p != t2->p)
+        return t1->p > t2->p ? -1: 1;
+    return compare_terms(&t1->term, &t2->term);
+}
+
+static int compare_clauses(const void *p1, const void *p2)
+{
+    const struct ranked_clause *c1 = (const struct ranked_clause*)p1;
+    const struct ranked_clause *c2 = (const struct ranked_clause*)p2;
+
+    if (c1->rank != c2->rank)
+        return c1->rank < c2->rank ? -1: 1;
+    return c1->index < c2->index ? -1: 1;
+}
+
+/*
+sort and deduplicate terms of a clause. Return the new number of terms
+or 0 if the clause matches every event.
+*/
+static uint64_t normalize_clause(struct filter_term *terms,
+                                 uint64_t num_terms)
+{
+    uint64_t i, j, n = 0;
+
+    qsort(terms, num_terms, sizeof(struct filter_term), compare_terms);
+
+    for (i = 0; i < num_terms; i++)
+        if (!n || compare_terms(&terms[n - 1], &terms[i]))
+            terms[n++] = terms[i];
+
+    for (i = 0; i < n; i++){
+        if (terms[i].op != FILTER_OP_NEQ)
+            continue;
+        /* field != x OR field != y is always true */
+        if (i + 1 < n &&
+            terms[i + 1].op == FILTER_OP_NEQ &&
+            terms[i + 1].field == terms[i].field)
+            return 0;
+        /* field == x OR field != x is always true (EQ sorts before NEQ) */
+        for (j = i; j > 0 && terms[j - 1].field == terms[i].field; j--)
+            if (terms[j - 1].item == terms[i].item)
+                return 0;
+    }
+    return n;
+}
+
+static tdb_error build_set(struct filter_set *set,
+                           const struct filter_term *terms,
+                           uint64_t num_terms,
+                           uint64_t num_values)
+{
+    uint64_t i;
+
+    memset(set, 0, sizeof(struct filter_set));
+    set->num_values = num_values;
+
+    if (num_values <= FILTER_BITMAP_MAX_BITS * num_terms){
+        if (!(set->bitmap = calloc((num_values + 63) / 64, 8)))
+            return TDB_ERR_NOMEM;
+        for (i = 0; i < num_terms; i++){
+            tdb_val val = tdb_item_val(terms[i].item);
+            set->bitmap[val >> 6] |= 1LLU << (val & 63);
+        }
+    }else{
+        /* keep the load factor below 0.5 */
+        uint64_t size = 1;
+        while (size < num_terms * 2)
+            size <<= 1;
+        if (!(set->table = malloc(size * sizeof(uint64_t))))
+            return TDB_ERR_NOMEM;
+        memset(set->table, 0xFF, size * sizeof(uint64_t));
+        set->mask = size - 1;
+
+        /* values are unique after normalize_clause() */
+        for (i = 0; i < num_terms; i++){
+            tdb_val val = tdb_item_val(terms[i].item);
+            uint64_t j = filter_set_hash(val) & set->mask;
+            while (set->table[j] != FILTER_SET_EMPTY)
+                j = (j + 1) & set->mask;
+            set->table[j] = val;
+        }
+    }
+    return 0;
+}
+
+/*
+replace runs of FILTER_OP_EQ terms of the same field in a normalized
+clause with a single FILTER_OP_IN term
+*/
+static tdb_error group_terms(struct compiled_filter *f,
+                             const uint64_t *lexicon_sizes,
+                             struct filter_term *terms,
+                             uint64_t *num_terms)
+{
+    uint64_t i = 0, n = 0;
+    tdb_error err;
+
+    while (i < *num_terms){
+        uint64_t j = i + 1;
+        if (terms[i].op == FILTER_OP_EQ)
+            while (j < *num_terms &&
+                   terms[j].op == FILTER_OP_EQ &&
+                   terms[j].field == terms[i].field)
+                ++j;
+
+        if (j - i >= FILTER_SET_MIN_TERMS){
+            struct filter_set *sets;
+            tdb_field field = terms[i].field;
+
+            if (!(sets = realloc(f->sets,
+                                 (f->num_sets + 1) *
+                                 sizeof(struct filter_set))))
+                return TDB_ERR_NOMEM;
+            f->sets = sets;
+            if ((err = build_set(&f->sets[f->num_sets],
+                                 &terms[i],
+                                 j - i,
+                                 lexicon_sizes[field]))){
+                /* free whatever build_set() allocated */
+                ++f->num_sets;
+                return err;
+            }
+            terms[n].op = FILTER_OP_IN;
+            terms[n].field = field;
+            terms[n].item = f->num_sets++;
+            /* number of values in the set */
+            terms[n].end = j - i;
+            ++n;
+        }else
+            for (; i < j; i++)
+                terms[n++] = terms[i];
+        i = j;
+    }
+    *num_terms = n;
+    return 0;
+}
+
+/*
+timestamps of a trail are non-decreasing, so a clause of time ranges
+can't match any event after the end of its last range, or before the
+start of its first range
+*/
+static void update_time_bounds(struct compiled_filter *f,
+                               const struct filter_term *terms,
+                               uint64_t num_terms)
+{
+    uint64_t i, start = UINT64_MAX, end = 0;
+
+    for (i = 0; i < num_terms; i++){
+        if (terms[i].op != FILTER_OP_TIME_RANGE)
+            return;
+        if (terms[i].item < start)
+            start = terms[i].item;
+        if (terms[i].end > end)
+            end = terms[i].end;
+    }
+    if (start > f->start_time)
+        f->start_time = start;
+    if (end < f->stop_time)
+        f->stop_time = end;
+}
+
+/*
+estimate the probability that an event satisfies a term, assuming
+that values and timestamps are distributed uniformly
+*/
+static double term_probability(const tdb *db,
+                               const uint64_t *lexicon_sizes,
+                               const struct filter_term *t)
+{
+    if (t->op == FILTER_OP_TIME_RANGE){
+        const double time_span = (double)(db->max_timestamp -
+                                          db->min_timestamp) + 1.;
+        uint64_t start = t->item > db->min_timestamp ?
+                         t->item: db->min_timestamp;
+        uint64_t end = t->end <= db->max_timestamp ?
+                       t->end: db->max_timestamp + 1;
+        return end > start ? (double)(end - start) / time_span: 0.;
+    }else if (t->op == FILTER_OP_IN){
+        double p = (double)t->end / (double)lexicon_sizes[t->field];
+        return p < 1. ? p: 1.;
+    }else{
+        double p = 1. / (double)lexicon_sizes[t->field];
+        return t->op == FILTER_OP_NEQ ? 1. - p: p;
+    }
+}
+
+/*
+order terms of a clause so that the terms most likely to match are
+evaluated first and rank the clause: the expected cost of evaluating it
+divided by the probability that it rejects an event. Evaluating clauses
+in the ascending order of rank minimizes the expected cost of evaluating
+the conjunction.
+*/
+static void order_terms(const tdb *db,
+                        const uint64_t *lexicon_sizes,
+                        struct filter_term *terms,
+                        uint64_t num_terms,
+                        struct ranked_term *tmp,
+                        struct ranked_clause *clause)
+{
+    double p_fail = 1.;
+    double cost = 0.;
+    uint64_t i;
+
+    for (i = 0; i < num_terms; i++){
+        tmp[i].p = term_probability(db, lexicon_sizes, &terms[i]);
+        tmp[i].term = terms[i];
+    }
+
+    qsort(tmp, num_terms, sizeof(struct ranked_term), compare_ranked_terms);
+
+    for (i = 0; i < num_terms; i++){
+        /* a term is evaluated only if the previous ones failed */
+        cost += p_fail;
+        p_fail *= 1. - tmp[i].p;
+        terms[i] = tmp[i].term;
+    }
+    clause->cost = cost;
+    clause->p_fail = p_fail;
+    clause->rank = p_fail > 0. ? cost / p_fail: cost * 1e18;
+}
+
+/* fields that terms of the filter refer to, for filter_match_batch() */
+static tdb_error collect_fields(const tdb *db, struct compiled_filter *dst)
+{
+    uint8_t *seen = NULL;
+    uint64_t i, j;
+
+    if (!(seen = calloc(db->num_fields, 1)) ||
+        !(dst->fields = malloc(db->num_fields * sizeof(tdb_field)))){
+        free(seen);
+        return TDB_ERR_NOMEM;
+    }
+    for (i = 0; i < dst->num_clauses; i++){
+        const struct filter_clause *c = &dst->clauses[i];
+        for (j = c->first_term; j < c->first_term + c->num_terms; j++){
+            const tdb_field field = dst->terms[j].field;
+            if (dst->terms[j].op != FILTER_OP_TIME_RANGE && !seen[field]){
+                seen[field] = 1;
+                dst->fields[dst->num_fields++] = field;
+            }
+        }
+    }
+    free(seen);
+    return 0;
+}
+
+tdb_error filter_compile(const tdb *db,
+                         const struct tdb_event_filter *filter,
+                         struct compiled_filter *dst)
+{
+    const tdb_item *items = filter->items;
+    uint64_t *lexicon_sizes = NULL;
+    struct ranked_term *ranked_terms = NULL;
+    struct ranked_clause *ranked_clauses = NULL;
+    uint64_t i = 0;
+    uint64_t num_terms = 0;
+    tdb_field field;
+    tdb_error err = 0;
+
+    filter_free(dst);
+    dst->stop_time = UINT64_MAX;
+
+    if (filter->options & TDB_FILTER_MATCH_ALL)
+        goto compiled;
+    if (filter->options & TDB_FILTER_MATCH_NONE){
+        dst->match_none = 1;
+        goto compiled;
+    }
+
+    /* each term takes at least two entries, each clause at least one */
+    if (!(dst->terms = malloc((filter->count / 2 + 1) *
+                              sizeof(struct filter_term))) ||
+        !(ranked_terms = malloc((filter->count / 2 + 1) *
+                                sizeof(struct ranked_term))) ||
+        !(ranked_clauses = malloc((filter->count + 1) *
+                                  sizeof(struct ranked_clause))) ||
+        !(lexicon_sizes = malloc(db->num_fields * sizeof(uint64_t)))){
+        err = TDB_ERR_NOMEM;
+        goto done;
+    }
+
+    for (field = 1; field < db->num_fields; field++)
+        lexicon_sizes[field] = tdb_lexicon_size(db, field);
+
+    while (i < filter->count){
+        uint64_t clause_len = items[i++];
+        uint64_t next_clause = i + clause_len;
+        uint64_t first_term = num_terms;
+        uint64_t n;
+        int always_true = 0;
+
+        if (next_clause > filter->count){
+            dst->match_none = 1;
+            goto compiled;
+        }
+
+        while (i < next_clause){
+            uint64_t op_flags = items[i++];
+            struct filter_term *t = &dst->terms[num_terms];
+
+            if (op_flags & TDB_EVENT_TIME_RANGE){
+                t->op = FILTER_OP_TIME_RANGE;
+                t->field = 0;
+                t->item = items[i++];
+                t->end = items[i++];
+                /* an empty range never matches */
+                if (t->item < t->end)
+                    ++num_terms;
+            }else{
+                tdb_item item = items[i++];
+                field = tdb_item_field(item);
+
+                if (field == 0 ||
+                    field >= db->num_fields ||
+                    tdb_item_val(item) >= lexicon_sizes[field]){
+                    /*
+                    an unknown field or value never matches a term,
+                    so a negated term always matches
+                    */
+                    if (op_flags & TDB_EVENT_NEGATED)
+                        always_true = 1;
+                }else{
+                    t->op = (op_flags & TDB_EVENT_NEGATED) ?
+                            FILTER_OP_NEQ: FILTER_OP_EQ;
+                    t->field = field;
+                    t->item = item;
+                    t->end = 0;
+                    ++num_terms;
+                }
+            }
+        }
+        if (always_true){
+            num_terms = first_term;
+            continue;
+        }
+        /* nothing can match an empty clause */
+        if (first_term == num_terms){
+            dst->match_none = 1;
+            goto compiled;
+        }
+        if (!(n = normalize_clause(&dst->terms[first_term],
+                                   num_terms - first_term))){
+            num_terms = first_term;
+            continue;
+        }
+        if ((err = group_terms(dst,
+                               lexicon_sizes,
+                               &dst->terms[first_term],
+                               &n)))
+            goto done;
+
+        update_time_bounds(dst, &dst->terms[first_term], n);
+
+        order_terms(db,
+                    lexicon_sizes,
+                    &dst->terms[first_term],
+                    n,
+                    ranked_terms,
+                    &ranked_clauses[dst->num_clauses]);
+        ranked_clauses[dst->num_clauses].index = dst->num_clauses;
+        ranked_clauses[dst->num_clauses].clause.first_term = first_term;
+        ranked_clauses[dst->num_clauses].clause.num_terms = n;
+        ++dst->num_clauses;
+        num_terms = first_term + n;
+    }
+
+    if (dst->num_clauses){
+        /* a clause is evaluated only if the previous ones matched */
+        double p_reach = 1.;
+
+        if (!(dst->clauses = malloc(dst->num_clauses *
+                                    sizeof(struct filter_clause)))){
+            err = TDB_ERR_NOMEM;
+            goto done;
+        }
+        qsort(ranked_clauses,
+              dst->num_clauses,
+              sizeof(struct ranked_clause),
+              compare_clauses);
+        for (i = 0; i < dst->num_clauses; i++){
+            dst->clauses[i] = ranked_clauses[i].clause;
+            dst->cost += p_reach * ranked_clauses[i].cost;
+            p_reach *= 1. - ranked_clauses[i].p_fail;
+        }
+        if ((err = collect_fields(db, dst)))
+            goto done;
+    }
+
+compiled:
+    if (dst->match_none)
+        dst->num_clauses = 0;
+    dst->column_eq = select_column_eq();
+    dst->source = filter;
+    dst->source_count = filter->count;
+    dst->generation = db->opt_filter_generation;
+done:
+    free(lexicon_sizes);
+    free(ranked_terms);
+    free(ranked_clauses);
+    if (err)
+        filter_free(dst);
+    return err;
+}
+
+void filter_free(struct compiled_filter *f)
+{
+    uint64_t i;
+    for (i = 0; i < f->num_sets; i++){
+        free(f->sets[i].bitmap);
+        free(f->sets[i].table);
+    }
+    free(f->sets);
+    free(f->fields);
+    free(f->terms);
+    free(f->clauses);
+    memset(f, 0, sizeof(struct compiled_filter));
+}
+
+static void column_eq(const tdb_item *column,
+                      tdb_item item,
+                      uint64_t num_words,
+                      uint64_t *dst)
+{
+    uint64_t w, k;
+    for (w = 0; w < num_words; w++){
+        uint64_t bits = 0;
+        for (k = 0; k < 64; k++)
+            bits |= (uint64_t)(column[w * 64 + k] == item) << k;
+        dst[w] = bits;
+    }
+}
+
+#ifdef FILTER_SIMD
+__attribute__((target("avx2")))
+static void column_eq_avx2(const tdb_item *column,
+                           tdb_item item,
+                           uint64_t num_words,
+                           uint64_t *dst)
+{
+    const __m256i key = _mm256_set1_epi64x((long long)item);
+    uint64_t w, k;
+    for (w = 0; w < num_words; w++){
+        uint64_t bits = 0;
+        for (k = 0; k < 64; k += 4){
+            const __m256i v =
+                _mm256_loadu_si256((const __m256i*)&column[w * 64 + k]);
+            const __m256d eq = _mm256_castsi256_pd(_mm256_cmpeq_epi64(v, key));
+            bits |= (uint64_t)_mm256_movemask_pd(eq) << k;
+        }
+        dst[w] = bits;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void column_eq_avx512(const tdb_item *column,
+                             tdb_item item,
+                             uint64_t num_words,
+                             uint64_t *dst)
+{
+    const __m512i key = _mm512_set1_epi64((long long)item);
+    uint64_t w, k;
+    for (w = 0; w < num_words; w++){
+        uint64_t bits = 0;
+        for (k = 0; k < 64; k += 8){
+            const __m512i v = _mm512_loadu_si512(&column[w * 64 + k]);
+            bits |= (uint64_t)_mm512_cmpeq_epi64_mask(v, key) << k;
+        }
+        dst[w] = bits;
+    }
+}
+#endif
+
+static column_eq_fn select_column_eq(void)
+{
+#ifdef FILTER_SIMD
+    if (__builtin_cpu_supports("avx512f"))
+        return column_eq_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return column_eq_avx2;
+#endif
+    return column_eq;
+}
+
+/*
+Clauses are evaluated one at a time over the whole block: terms of a
+clause are ORed to a clause mask, which is ANDed to the result. Unlike
+filter_match(), equality terms don't branch per event. Columns are
+padded to FILTER_BATCH_SIZE, so whole words of events are compared.
+Bits of events past num_events are never set in mask.
+*/
+void filter_match_batch(const struct compiled_filter *f,
+                        const tdb_item *columns,
+                        uint64_t num_events,
+                        uint64_t *mask)
+{
+    const column_eq_fn eq = f->column_eq;
+    const uint64_t num_words = (num_events + 63) / 64;
+    uint64_t clause_mask[BATCH_WORDS];
+    uint64_t term_mask[BATCH_WORDS];
+    uint64_t i, w, e;
+
+    for (w = 0; w < num_words; w++)
+        mask[w] = UINT64_MAX;
+    if (num_events & 63)
+        mask[num_words - 1] = (1LLU << (num_events & 63)) - 1;
+
+    for (i = 0; i < f->num_clauses; i++){
+        const struct filter_term *t = &f->terms[f->clauses[i].first_term];
+        const struct filter_term *end = t + f->clauses[i].num_terms;
+        uint64_t any = 0;
+
+        memset(clause_mask, 0, num_words * sizeof(uint64_t));
+        for (; t < end; t++){
+            const tdb_item *column = &columns[t->field * FILTER_BATCH_SIZE];
+            switch (t->op){
+                case FILTER_OP_EQ:
+                    eq(column, t->item, num_words, term_mask);
+                    for (w = 0; w < num_words; w++)
+                        clause_mask[w] |= term_mask[w];
+                    break;
+                case FILTER_OP_NEQ:
+                    eq(column, t->item, num_words, term_mask);
+                    for (w = 0; w < num_words; w++)
+                        clause_mask[w] |= ~term_mask[w];
+                    break;
+                case FILTER_OP_IN:
+                    /* only events that are still candidates */
+                    for (e = 0; e < num_events; e++){
+                        const uint64_t bit = 1LLU << (e & 63);
+                        if ((mask[e >> 6] & ~clause_mask[e >> 6] & bit) &&
+                            filter_set_contains(&f->sets[t->item],
+                                                tdb_item_val(column[e])))
+                            clause_mask[e >> 6] |= bit;
+                    }
+                    break;
+                default:
+                    /* time ranges, column 0 holds timestamps */
+                    for (e = 0; e < num_events; e++)
+                        if (t->item <= columns[e] && columns[e] < t->end)
+                            clause_mask[e >> 6] |= 1LLU << (e & 63);
+            }
+        }
+        for (w = 0; w < num_words; w++){
+            mask[w] &= clause_mask[w];
+            any |= mask[w];
+        }
+        /* no event matches */
+        if (!any)
+            break;
+    }
+}
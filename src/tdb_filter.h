@@ -0,0 +1,194 @@
+#ifndef __TDB_FILTER_H__
+#define __TDB_FILTER_H__
+
+#include <stdint.h>
+
+#include "tdb_types.h"
+#include "tdb_internal.h"
+
+/*
+Event filters compiled for evaluation in a cursor.
+
+struct tdb_event_filter stores a CNF expression as a flat array of
+variable-length terms, which is convenient to build but slow to
+evaluate. A compiled filter resolves the fields of terms upfront, drops
+terms and clauses whose result is known at compile time, and orders
+clauses so that clauses that are cheap and likely to fail are evaluated
+first.
+*/
+
+/*
+clauses with at least this many terms matching values of the same field
+are evaluated with a set lookup (FILTER_OP_IN) instead of term by term
+*/
+#define FILTER_SET_MIN_TERMS 16
+
+/* use a bitmap instead of a hash set if it takes at most this many bits per value */
+#define FILTER_BITMAP_MAX_BITS 512
+
+#define FILTER_SET_EMPTY UINT64_MAX
+
+/*
+number of events evaluated at once by filter_match_batch(), a multiple
+of 64
+*/
+#define FILTER_BATCH_SIZE 256
+
+/*
+use filter_match_batch() if filter_match() is expected to evaluate at
+least this many terms per event. Cheaper filters are faster to evaluate
+event by event, as most events are rejected or accepted by the first
+term.
+*/
+#define FILTER_BATCH_MIN_COST 8.
+
+enum filter_op{
+    FILTER_OP_EQ = 0,
+    FILTER_OP_NEQ = 1,
+    FILTER_OP_TIME_RANGE = 2,
+    FILTER_OP_IN = 3
+};
+
+struct filter_term{
+    uint32_t op;
+    tdb_field field;
+    /*
+    item for FILTER_OP_EQ/NEQ, start time for FILTER_OP_TIME_RANGE,
+    index to sets for FILTER_OP_IN
+    */
+    uint64_t item;
+    uint64_t end;
+};
+
+/* a set of values of a field */
+struct filter_set{
+    /* bitmap over all values of the field, NULL if a hash set is used */
+    uint64_t *bitmap;
+    uint64_t num_values;
+    /* open addressing with linear probing, FILTER_SET_EMPTY if empty */
+    uint64_t *table;
+    uint64_t mask;
+};
+
+struct filter_clause{
+    uint64_t first_term;
+    uint64_t num_terms;
+};
+
+/* set bit i of dst if column[i] == item */
+typedef void (*column_eq_fn)(const tdb_item *column,
+                             tdb_item item,
+                             uint64_t num_words,
+                             uint64_t *dst);
+
+struct compiled_filter{
+    /* the filter this was compiled from */
+    const struct tdb_event_filter *source;
+    uint64_t source_count;
+    uint64_t generation;
+
+    /* the filter can't match any event */
+    int match_none;
+
+    /*
+    only events in [start_time, stop_time) can match the filter, since
+    a clause consists of time ranges that don't extend beyond them
+    */
+    uint64_t start_time;
+    uint64_t stop_time;
+
+    uint64_t num_clauses;
+    struct filter_clause *clauses;
+    struct filter_term *terms;
+    uint64_t num_sets;
+    struct filter_set *sets;
+
+    /* fields that terms refer to, excluding time ranges */
+    tdb_field *fields;
+    uint64_t num_fields;
+
+    /* the expected number of terms evaluated per event by filter_match() */
+    double cost;
+
+    /* equality test of filter_match_batch(), selected for the CPU */
+    column_eq_fn column_eq;
+};
+
+tdb_error filter_compile(const tdb *db,
+                         const struct tdb_event_filter *filter,
+                         struct compiled_filter *dst);
+
+void filter_free(struct compiled_filter *f);
+
+/*
+evaluate the filter against a block of events. Column f of the block,
+columns[f * FILTER_BATCH_SIZE..], holds the items of field f, column 0
+holds timestamps. Only the columns of fields in f->fields are read.
+Bit i of mask is set if event i matches.
+*/
+void filter_match_batch(const struct compiled_filter *f,
+                        const tdb_item *columns,
+                        uint64_t num_events,
+                        uint64_t *mask);
+
+static inline uint64_t filter_set_hash(tdb_val val)
+{
+    return (val * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+static inline int filter_set_contains(const struct filter_set *set,
+                                      tdb_val val)
+{
+    if (set->bitmap)
+        return val < set->num_values &&
+               ((set->bitmap[val >> 6] >> (val & 63)) & 1);
+    else{
+        uint64_t i = filter_set_hash(val) & set->mask;
+        while (set->table[i] != FILTER_SET_EMPTY){
+            if (set->table[i] == val)
+                return 1;
+            i = (i + 1) & set->mask;
+        }
+        return 0;
+    }
+}
+
+/* evaluate the filter against the current state of a trail */
+static inline int filter_match(const struct compiled_filter *f,
+                               const tdb_item *event,
+                               uint64_t timestamp)
+{
+    uint64_t i;
+    for (i = 0; i < f->num_clauses; i++){
+        const struct filter_term *t = &f->terms[f->clauses[i].first_term];
+        const struct filter_term *end = t + f->clauses[i].num_terms;
+
+        for (; t < end; t++){
+            switch (t->op){
+                case FILTER_OP_EQ:
+                    if (event[t->field] == t->item)
+                        goto next_clause;
+                    break;
+                case FILTER_OP_NEQ:
+                    if (event[t->field] != t->item)
+                        goto next_clause;
+                    break;
+                case FILTER_OP_IN:
+                    if (filter_set_contains(&f->sets[t->item],
+                                            tdb_item_val(event[t->field])))
+                        goto next_clause;
+                    break;
+                default:
+                    if (t->item <= timestamp && timestamp < t->end)
+                        goto next_clause;
+            }
+        }
+        /* no term in the clause matched */
+        return 0;
+next_clause:
+        ;
+    }
+    return 1;
+}
+
+#endif /* __TDB_FILTER_H__ */
@@ -0,0 +1,207 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb_front_coding.h"
+
+struct cached_block{
+    /* ID of the tdb, 0 if the slot is empty */
+    uint64_t cache_id;
+    uint64_t index;
+    uint64_t last_used;
+    uint64_t size;
+    struct lexicon_block *block;
+};
+
+struct block_cache{
+    uint64_t clock;
+    uint64_t num_fields;
+    /* LEXICON_CACHE_WAYS slots for each field */
+    struct cached_block *slots;
+};
+
+static uint64_t next_cache_id = 1;
+
+static pthread_key_t block_cache_key;
+static pthread_once_t block_cache_once = PTHREAD_ONCE_INIT;
+static int block_cache_key_created;
+
+static inline uint64_t block_offset(const struct tdb_lexicon *lex,
+                                    uint64_t block)
+{
+    if (lex->width == 4)
+        return lex->toc.toc32[block];
+    else
+        return lex->toc.toc64[block];
+}
+
+/*
+decode a block into *dst, which is reallocated if it's smaller than
+*dst_size bytes. Returns -1 if there's not enough memory.
+*/
+static int decode_block(const struct tdb_lexicon *lex,
+                        uint64_t block,
+                        struct lexicon_block **dst,
+                        uint64_t *dst_size)
+{
+    const uint64_t first = block * LEXICON_BLOCK_SIZE;
+    const uint64_t n = lex->size - first < LEXICON_BLOCK_SIZE ?
+                       lex->size - first: LEXICON_BLOCK_SIZE;
+    const char *start = &lex->data[block_offset(lex, block)];
+    const char *p = start;
+    uint64_t j, size = 0;
+    struct lexicon_block *b;
+
+    /* the first pass finds the decoded size */
+    for (j = 0; j < n; j++){
+        uint64_t shared = j ? read_varint(&p): 0;
+        uint64_t suffix = read_varint(&p);
+        p += suffix;
+        size += shared + suffix;
+    }
+    size += sizeof(struct lexicon_block);
+
+    if (size > *dst_size){
+        if (!(b = realloc(*dst, size)))
+            return -1;
+        *dst = b;
+        *dst_size = size;
+    }
+    b = *dst;
+
+    p = start;
+    b->offsets[0] = 0;
+    for (j = 0; j < n; j++){
+        uint64_t shared = j ? read_varint(&p): 0;
+        uint64_t suffix = read_varint(&p);
+        char *value = &b->values[b->offsets[j]];
+        if (shared)
+            memcpy(value, &b->values[b->offsets[j - 1]], shared);
+        memcpy(&value[shared], p, suffix);
+        p += suffix;
+        b->offsets[j + 1] = b->offsets[j] + shared + suffix;
+    }
+    return 0;
+}
+
+uint64_t lexicon_cache_new_id(void)
+{
+    return __atomic_fetch_add(&next_cache_id, 1, __ATOMIC_RELAXED);
+}
+
+/* called at thread exit */
+static void block_cache_free(void *ptr)
+{
+    struct block_cache *cache = (struct block_cache*)ptr;
+    uint64_t i;
+    for (i = 0; i < cache->num_fields * LEXICON_CACHE_WAYS; i++)
+        free(cache->slots[i].block);
+    free(cache->slots);
+    free(cache);
+}
+
+static void block_cache_init(void)
+{
+    block_cache_key_created = !pthread_key_create(&block_cache_key,
+                                                  block_cache_free);
+}
+
+/* return the cache of this thread with slots for field */
+static struct block_cache *get_block_cache(tdb_field field)
+{
+    struct block_cache *cache;
+
+    pthread_once(&block_cache_once, block_cache_init);
+    if (!block_cache_key_created)
+        return NULL;
+
+    if (!(cache = (struct block_cache*)pthread_getspecific(block_cache_key))){
+        if (!(cache = calloc(1, sizeof(struct block_cache))))
+            return NULL;
+        if (pthread_setspecific(block_cache_key, cache)){
+            free(cache);
+            return NULL;
+        }
+    }
+
+    if (field >= cache->num_fields){
+        /* decoded blocks are separate, so values stay where they are */
+        const uint64_t num_slots = (field + 1) * LEXICON_CACHE_WAYS;
+        struct cached_block *slots;
+        if (!(slots = realloc(cache->slots,
+                              num_slots * sizeof(struct cached_block))))
+            return NULL;
+        memset(&slots[cache->num_fields * LEXICON_CACHE_WAYS],
+               0,
+               (field + 1 - cache->num_fields) * LEXICON_CACHE_WAYS *
+               sizeof(struct cached_block));
+        cache->slots = slots;
+        cache->num_fields = field + 1U;
+    }
+    return cache;
+}
+
+const char *lexicon_blocks_get(const struct tdb_lexicon *lex,
+                               tdb_val i,
+                               uint64_t *length)
+{
+    const uint64_t idx = i / LEXICON_BLOCK_SIZE;
+    const uint64_t j = i % LEXICON_BLOCK_SIZE;
+    struct block_cache *cache;
+    struct cached_block *slots, *slot;
+    uint64_t k;
+
+    if (!(cache = get_block_cache(lex->field)))
+        return NULL;
+    slots = &cache->slots[lex->field * LEXICON_CACHE_WAYS];
+
+    /* find the block or evict the least recently used one */
+    slot = slots;
+    for (k = 0; k < LEXICON_CACHE_WAYS; k++){
+        if (slots[k].cache_id == lex->cache_id && slots[k].index == idx){
+            slot = &slots[k];
+            goto found;
+        }
+        if (slots[k].last_used < slot->last_used)
+            slot = &slots[k];
+    }
+    slot->cache_id = 0;
+    if (decode_block(lex, idx, &slot->block, &slot->size))
+        return NULL;
+    slot->cache_id = lex->cache_id;
+    slot->index = idx;
+found:
+    slot->last_used = ++cache->clock;
+    *length = slot->block->offsets[j + 1] - slot->block->offsets[j];
+    return &slot->block->values[slot->block->offsets[j]];
+}
+
+const char *tdb_lexicon_peek(const struct tdb_lexicon *lex,
+                             tdb_val i,
+                             uint64_t *length,
+                             struct lexicon_scratch *scratch)
+{
+    const uint64_t idx = i / LEXICON_BLOCK_SIZE;
+    const uint64_t j = i % LEXICON_BLOCK_SIZE;
+    struct lexicon_block *block;
+
+    if (!lex->block_size)
+        return tdb_lexicon_get(lex, i, length);
+
+    if (scratch->index != idx + 1){
+        if (decode_block(lex, idx, &scratch->block, &scratch->size))
+            return NULL;
+        scratch->index = idx + 1;
+    }
+    block = scratch->block;
+    *length = block->offsets[j + 1] - block->offsets[j];
+    return &block->values[block->offsets[j]];
+}
+
+void lexicon_scratch_free(struct lexicon_scratch *scratch)
+{
+    free(scratch->block);
+    scratch->block = NULL;
+    scratch->index = scratch->size = 0;
+}
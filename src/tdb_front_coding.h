@@ -0,0 +1,105 @@
+#ifndef __TDB_FRONT_CODING_H__
+#define __TDB_FRONT_CODING_H__
+
+#include <stdint.h>
+
+#include "tdb_internal.h"
+
+/*
+Front-coded lexicons, written with TDB_OPT_CONS_FRONT_CODED_LEXICONS
+(TDB_VERSION_V0_2).
+
+Values are split into blocks of LEXICON_BLOCK_SIZE consecutive value
+IDs. The first value of a block is stored as is, the others as the
+length of the prefix they share with the previous value and the
+remaining suffix. Lengths are varints:
+
+[ number of values N                ] 4 or 8 bytes
+[ block size                        ] 4 or 8 bytes
+[ block offsets ...                 ] B * (4 or 8 bytes)
+[ end offset                        ] 4 or 8 bytes
+[ blocks ...                        ] X bytes
+
+block:
+[ length | value                    ] the first value
+[ shared | suffix length | suffix   ] * (block size - 1)
+
+where B is the number of blocks, and the width is 8 bytes if the file is
+larger than UINT32_MAX.
+
+tdb_lexicon_get() decodes blocks into a small per-thread cache, which
+keeps the LEXICON_CACHE_WAYS most recently used blocks of each field
+number, across all tdbs. A value stays valid until the same thread has
+accessed LEXICON_CACHE_WAYS other blocks of the same field, so values
+of different fields of an event can be used together. The memory used
+is bounded by the number of fields, not by the size of lexicons.
+Blocks of closed tdbs are evicted like any other blocks.
+
+Scans and searches of lexicons use tdb_lexicon_peek() instead, which
+decodes blocks into a reusable buffer without evicting cached blocks.
+*/
+
+#define LEXICON_BLOCK_SIZE 16
+
+#define LEXICON_CACHE_WAYS 4
+
+struct lexicon_block{
+    /* value j is values[offsets[j]:offsets[j + 1]] */
+    uint64_t offsets[LEXICON_BLOCK_SIZE + 1];
+    char values[0];
+};
+
+struct lexicon_scratch{
+    /* the index of the decoded block plus one, 0 if none */
+    uint64_t index;
+    uint64_t size;
+    struct lexicon_block *block;
+};
+
+#define LEXICON_SCRATCH_INIT {0, 0, NULL}
+
+static inline uint64_t write_varint(char *dst, uint64_t val)
+{
+    uint64_t n = 0;
+    while (val >= 128){
+        dst[n++] = (char)((val & 127) | 128);
+        val >>= 7;
+    }
+    dst[n++] = (char)val;
+    return n;
+}
+
+static inline uint64_t read_varint(const char **src)
+{
+    const unsigned char *p = (const unsigned char*)*src;
+    uint64_t val = 0;
+    uint32_t shift = 0;
+    while (*p & 128){
+        val |= (uint64_t)(*p++ & 127) << shift;
+        shift += 7;
+    }
+    val |= (uint64_t)*p++ << shift;
+    *src = (const char*)p;
+    return val;
+}
+
+/* a new nonzero ID that identifies lexicons of a tdb in the cache */
+uint64_t lexicon_cache_new_id(void);
+
+/* tdb_lexicon_get() for front-coded lexicons */
+const char *lexicon_blocks_get(const struct tdb_lexicon *lex,
+                               tdb_val i,
+                               uint64_t *length);
+
+/*
+like tdb_lexicon_get() but the value is valid only until the next call
+with the same scratch
+*/
+const char *tdb_lexicon_peek(const struct tdb_lexicon *lex,
+                             tdb_val i,
+                             uint64_t *length,
+                             struct lexicon_scratch *scratch);
+
+void lexicon_scratch_free(struct lexicon_scratch *scratch);
+
+#endif /* __TDB_FRONT_CODING_H__ */
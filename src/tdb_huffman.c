@@ -233,13 +233,20 @@ struct field_stats *huff_field_stats(const uint64_t *field_cardinalities,
                                      uint64_t num_fields,
                                      uint64_t max_timestamp_delta)
 {
+    const uint32_t field_id_bits = bits_needed(num_fields);
     uint64_t i;
     struct field_stats *fstats;
 
-    if (!(fstats = malloc(sizeof(struct field_stats) + num_fields * 4)))
+    /*
+    huff_decode_multi() may resolve a literal header past the end of a
+    trail, which can be any field ID that fits in field_id_bits. Unused
+    IDs get zero bits, so that they can be looked up safely.
+    */
+    if (!(fstats = calloc(1, sizeof(struct field_stats) +
+                             (1LLU << field_id_bits) * 4)))
         return NULL;
 
-    fstats->field_id_bits = bits_needed(num_fields);
+    fstats->field_id_bits = field_id_bits;
     fstats->field_bits[0] = bits_needed(max_timestamp_delta);
     for (i = 0; i < num_fields - 1; i++)
         fstats->field_bits[i + 1] = bits_needed(field_cardinalities[i]);
@@ -419,3 +426,170 @@ int huff_convert_v0_codebook(struct tdb_file *codebook)
     return 0;
 }
 
+/*
+the multi-symbol table pays off only if a lookup resolves many
+codewords on average. Codebooks of large databases tend to consist of
+long codewords (bigrams fill the codebook), in which case the table
+would only add an extra lookup per gram. Assuming that the bits of the
+encoded stream are uniformly distributed, the expected number of
+codewords per lookup is the average over all table entries.
+*/
+#define HUFF_MULTI_MIN_SYMBOLS_NUM 2
+#define HUFF_MULTI_MIN_SYMBOLS_DEN 5
+
+static int create_multi_table(struct huff_decoder *dec,
+                              const struct field_stats *fstats)
+{
+    struct huff_multi_entry *table;
+    uint64_t total_symbols = 0;
+    uint32_t i;
+
+    if (!(table = calloc(HUFF_MULTI_SIZE, sizeof(struct huff_multi_entry))))
+        return TDB_ERR_NOMEM;
+
+    for (i = 0; i < HUFF_MULTI_SIZE; i++){
+        struct huff_multi_entry *e = &table[i];
+        uint32_t offs = 0;
+
+        while (e->num_symbols < HUFF_MULTI_MAX_SYMBOLS &&
+               offs < HUFF_MULTI_BITS){
+            /* bits available after the flag bit */
+            const uint32_t avail = HUFF_MULTI_BITS - offs - 1;
+            const uint32_t rest = i >> (offs + 1);
+
+            if ((i >> offs) & 1){
+                /*
+                codeword: higher bits beyond the window are zero, which
+                is fine if the codeword fits in the window
+                */
+                const struct huff_lookup *code = huff_lookup_code(dec, rest);
+                if (!code->bits || code->bits > avail)
+                    break;
+                offs += code->bits + 1U;
+                e->codes[e->num_symbols] = code->index;
+                e->ends[e->num_symbols++] = (uint8_t)offs;
+            }else{
+                /* literal: resolve the field if the header fits */
+                if (fstats->field_id_bits <= avail){
+                    e->literal_bits = (uint8_t)(fstats->field_id_bits + 1);
+                    e->literal_field =
+                        (uint16_t)(rest & ((1U << fstats->field_id_bits) - 1));
+                }
+                break;
+            }
+        }
+        total_symbols += e->num_symbols;
+    }
+
+    if (total_symbols * HUFF_MULTI_MIN_SYMBOLS_DEN <
+        HUFF_MULTI_SIZE * HUFF_MULTI_MIN_SYMBOLS_NUM)
+        free(table);
+    else
+        dec->multi = table;
+    return 0;
+}
+
+int huff_create_decoder(const struct huff_codebook *codebook,
+                        const struct field_stats *fstats,
+                        struct huff_decoder **decoder)
+{
+    /* offsets of codewords of each length (1 - 16 bits) in symbols */
+    uint32_t len_offsets[18] = {0};
+    uint32_t max_len[HUFF_PRIMARY_SIZE] = {0};
+    uint32_t num_secondary = 0;
+    uint32_t i, j;
+    struct huff_decoder *dec;
+    int ret = 0;
+
+    if (!(dec = calloc(1, sizeof(struct huff_decoder))))
+        return TDB_ERR_NOMEM;
+
+    /*
+    each codeword of n bits is replicated in the codebook for all
+    suffixes: the entry with zero suffix, code < 2^n, is its canonical
+    slot. Count codewords by length to sort symbols by length.
+    */
+    for (i = 0; i < HUFF_CODEBOOK_SIZE; i++){
+        const uint32_t n = codebook[i].bits;
+        if (n > 16){
+            ret = TDB_ERR_INVALID_CODEBOOK_FILE;
+            goto done;
+        }
+        if (n && i < (1U << n)){
+            ++len_offsets[n + 1];
+            ++dec->num_symbols;
+            if (n > HUFF_PRIMARY_BITS){
+                const uint32_t prefix = i & (HUFF_PRIMARY_SIZE - 1);
+                if (n > max_len[prefix])
+                    max_len[prefix] = n;
+            }
+        }
+    }
+    for (i = 1; i < 18; i++)
+        len_offsets[i] += len_offsets[i - 1];
+
+    /* allocate secondary tables for prefixes of long codewords */
+    for (i = 0; i < HUFF_PRIMARY_SIZE; i++)
+        if (max_len[i]){
+            dec->primary[i].index = (uint16_t)num_secondary;
+            dec->primary[i].sub_bits = (uint8_t)(max_len[i] -
+                                                 HUFF_PRIMARY_BITS);
+            num_secondary += 1U << dec->primary[i].sub_bits;
+        }
+
+    /* make sure that symbols[0] is valid even if there are no symbols */
+    if (!(dec->symbols = calloc(dec->num_symbols + 1, sizeof(__uint128_t)))){
+        ret = TDB_ERR_NOMEM;
+        goto done;
+    }
+    if (num_secondary)
+        if (!(dec->secondary = calloc(num_secondary,
+                                      sizeof(struct huff_lookup)))){
+            ret = TDB_ERR_NOMEM;
+            goto done;
+        }
+
+    for (i = 0; i < HUFF_CODEBOOK_SIZE; i++){
+        const uint32_t n = codebook[i].bits;
+        if (n && i < (1U << n)){
+            struct huff_lookup code;
+
+            code.index = (uint16_t)len_offsets[n]++;
+            code.bits = (uint8_t)n;
+            code.sub_bits = 0;
+            dec->symbols[code.index] = codebook[i].symbol;
+            if (HUFF_IS_BIGRAM(codebook[i].symbol))
+                dec->has_bigrams = 1;
+
+            if (n <= HUFF_PRIMARY_BITS){
+                for (j = 0; j < 1U << (HUFF_PRIMARY_BITS - n); j++)
+                    dec->primary[i | (j << n)] = code;
+            }else{
+                const struct huff_lookup *sub =
+                    &dec->primary[i & (HUFF_PRIMARY_SIZE - 1)];
+                const uint32_t hi = i >> HUFF_PRIMARY_BITS;
+                const uint32_t hi_bits = n - HUFF_PRIMARY_BITS;
+                for (j = 0; j < 1U << (sub->sub_bits - hi_bits); j++)
+                    dec->secondary[sub->index + (hi | (j << hi_bits))] = code;
+            }
+        }
+    }
+
+    ret = create_multi_table(dec, fstats);
+done:
+    if (ret)
+        huff_free_decoder(dec);
+    else
+        *decoder = dec;
+    return ret;
+}
+
+void huff_free_decoder(struct huff_decoder *decoder)
+{
+    if (decoder){
+        free(decoder->secondary);
+        free(decoder->symbols);
+        free(decoder->multi);
+        free(decoder);
+    }
+}
@@ -27,6 +27,64 @@ struct field_stats{
     uint32_t field_bits[0];
 };
 
+/*
+decoding structures derived from the codebook in tdb_open():
+
+The on-disk codebook replicates each (up to 16-bit) codeword over all
+suffixes, which makes it large (HUFF_CODEBOOK_SIZE entries of 20 bytes)
+and accessed randomly. For decoding, codewords are resolved with a
+two-level table instead: a small primary table indexed by the first
+HUFF_PRIMARY_BITS bits of a codeword resolves short codewords directly,
+longer codewords are resolved by a secondary table sized by the longest
+codeword sharing the same prefix. Lookups return an index to an array of
+unique symbols which is sorted by codeword length, so that the frequent
+symbols are packed together at the beginning of the array.
+*/
+#define HUFF_PRIMARY_BITS 10
+#define HUFF_PRIMARY_SIZE (1U << HUFF_PRIMARY_BITS)
+
+struct huff_lookup{
+    /* index to symbols, or an offset to secondary if sub_bits > 0 */
+    uint16_t index;
+    /* length of the codeword */
+    uint8_t bits;
+    /* number of bits indexing the secondary table */
+    uint8_t sub_bits;
+};
+
+/*
+multi-symbol decoding table: an entry is indexed by the next
+HUFF_MULTI_BITS bits of the bitstream. It resolves all complete codewords
+(at most HUFF_MULTI_MAX_SYMBOLS) that fit in the window, followed by the
+header [0 | field-id] of a literal, if it fits in the window as well.
+*/
+#define HUFF_MULTI_BITS 11
+#define HUFF_MULTI_SIZE (1U << HUFF_MULTI_BITS)
+#define HUFF_MULTI_MAX_SYMBOLS 3
+#define HUFF_MULTI_MAX_GRAMS (HUFF_MULTI_MAX_SYMBOLS + 1)
+
+struct huff_multi_entry{
+    uint8_t num_symbols;
+    /* size of the literal header, 0 if no literal was resolved */
+    uint8_t literal_bits;
+    uint16_t literal_field;
+    /* bit offset of the end of each codeword */
+    uint8_t ends[HUFF_MULTI_MAX_SYMBOLS];
+    /* index to symbols of each codeword */
+    uint16_t codes[HUFF_MULTI_MAX_SYMBOLS];
+};
+
+struct huff_decoder{
+    struct huff_lookup primary[HUFF_PRIMARY_SIZE];
+    struct huff_lookup *secondary;
+    __uint128_t *symbols;
+    uint32_t num_symbols;
+    /* NULL if multi-symbol decoding doesn't pay off */
+    struct huff_multi_entry *multi;
+    /* 0 if all symbols are unigrams, e.g. with TDB_OPT_CONS_NO_BIGRAMS */
+    int has_bigrams;
+};
+
 /* ENCODE */
 
 int huff_create_codemap(const struct judy_128_map *gram_freqs,
@@ -62,29 +120,90 @@ static inline uint64_t huff_encoded_max_bits(uint64_t num_grams)
 
 int huff_convert_v0_codebook(struct tdb_file *codebook);
 
+int huff_create_decoder(const struct huff_codebook *codebook,
+                        const struct field_stats *fstats,
+                        struct huff_decoder **decoder);
+
+void huff_free_decoder(struct huff_decoder *decoder);
+
+static inline const struct huff_lookup *huff_lookup_code(
+    const struct huff_decoder *dec,
+    uint32_t code)
+{
+    const struct huff_lookup *e =
+        &dec->primary[code & (HUFF_PRIMARY_SIZE - 1)];
+    if (e->sub_bits)
+        e = &dec->secondary[e->index + ((code >> HUFF_PRIMARY_BITS) &
+                                        ((1U << e->sub_bits) - 1))];
+    return e;
+}
+
 /* this may return either an unigram or a bigram */
-static inline __uint128_t huff_decode_value(const struct huff_codebook *codebook,
+static inline __uint128_t huff_decode_value(const struct huff_decoder *dec,
                                             const char *data,
                                             uint64_t *offset,
                                             const struct field_stats *fstats)
 {
-    /* TODO - we could have a special read_bits for this case */
-    uint64_t enc = read_bits64(data, *offset, 64);
+    /*
+    a codeword takes at most 17 bits, so a single load is enough for
+    codewords and for most literals
+    */
+    uint64_t enc = read_window(data, *offset);
     if (enc & 1){
-        uint16_t idx = HUFF_CODE(enc >> 1);
-        *offset += codebook[idx].bits + 1;
-        return codebook[idx].symbol;
+        const struct huff_lookup *e = huff_lookup_code(dec,
+                                                       HUFF_CODE(enc >> 1));
+        *offset += e->bits + 1U;
+        return dec->symbols[e->index];
     }else{
         /* read literal:
            [0 (1 bit) | field-id (field_id_bits) | value (field_bits[field_id])]
         */
+        const uint32_t header_bits = fstats->field_id_bits + 1;
         tdb_field field = (tdb_field)((enc >> 1) &
                                       ((1LLU << fstats->field_id_bits) - 1));
-        tdb_val val = (enc >> (fstats->field_id_bits + 1)) &
-                      ((1LLU << fstats->field_bits[field]) - 1);
-        *offset += 1 + fstats->field_id_bits + fstats->field_bits[field];
+        uint32_t bits = fstats->field_bits[field];
+        tdb_val val;
+        if (header_bits + bits <= READ_WINDOW_BITS)
+            val = (enc >> header_bits) & ((1LLU << bits) - 1);
+        else
+            val = read_bits64(data, *offset + header_bits, bits);
+        *offset += header_bits + bits;
         return tdb_make_item(field, val);
     }
 }
 
+/*
+decode at least one and at most HUFF_MULTI_MAX_GRAMS grams (unigrams or
+bigrams) starting at offset with a single table lookup. The end offset
+of each gram is returned in ends, so the caller can stop at any gram.
+*/
+static inline uint32_t huff_decode_multi(const struct huff_decoder *dec,
+                                         const char *data,
+                                         uint64_t offset,
+                                         const struct field_stats *fstats,
+                                         __uint128_t *grams,
+                                         uint64_t *ends)
+{
+    const struct huff_multi_entry *e =
+        &dec->multi[read_bits(data, offset, HUFF_MULTI_BITS)];
+    uint32_t i;
+
+    for (i = 0; i < e->num_symbols; i++){
+        grams[i] = dec->symbols[e->codes[i]];
+        ends[i] = offset + e->ends[i];
+    }
+    if (e->literal_bits){
+        uint64_t start = (i ? ends[i - 1]: offset) + e->literal_bits;
+        uint32_t bits = fstats->field_bits[e->literal_field];
+        grams[i] = tdb_make_item(e->literal_field,
+                                 read_bits64(data, start, bits));
+        ends[i++] = start + bits;
+    }else if (!i){
+        /* the first codeword or literal header doesn't fit in the window */
+        ends[0] = offset;
+        grams[i++] = huff_decode_value(dec, data, &ends[0], fstats);
+    }
+    return i;
+}
+
 #endif /* __HUFFMAN_H__ */
@@ -15,6 +15,13 @@
 
 #define TDB_EXPORT __attribute__((visibility("default")))
 
+/*
+the newest version tdb_open() accepts. TDB_VERSION_LATEST stays at
+TDB_VERSION_V0_1, as TDB_VERSION_V0_2 is written only with
+TDB_OPT_CONS_FRONT_CODED_LEXICONS.
+*/
+#define TDB_VERSION_MAX_READABLE TDB_VERSION_V0_2
+
 /*
 These are defined by autoconf
 
@@ -80,8 +87,71 @@ struct tdb_decode_state{
     /* options */
     const struct tdb_event_filter *filter;
     int filter_type;
+    /* filter compiled for evaluation, see tdb_filter.h */
+    struct compiled_filter *compiled_filter;
+    /* stop decoding the trail at this timestamp */
+    uint64_t stop_time;
+
+    /*
+    tdb_cursor_set_event_filters(): filters that are evaluated at once,
+    the ones that may match events of the current trail, and bitmasks of
+    matching filters for events in the buffer
+    */
+    const struct tdb_event_filter **filters;
+    struct compiled_filter *compiled_filters;
+    uint64_t num_filters;
+    uint64_t *active_filters;
+    uint64_t num_active_filters;
+    uint64_t *match_masks;
+    uint64_t mask_words;
+    uint64_t batch_num_events;
+
+    /*
+    an expensive filter is evaluated over blocks of decoded events. The
+    fields it refers to are stored column by column in batch_items,
+    column 0 holds timestamps.
+    */
+    int batch_filter;
+    tdb_item *batch_items;
+
+    /* count events instead of materializing them, see tdb_aggregate.c */
+    struct tdb_aggregate *aggregate;
+
+    /* tdb_trail_foreach(): pass events to a callback instead */
+    tdb_event_callback visit;
+    void *visit_ctx;
+    int visit_stopped;
+
+    /*
+    the trail is replayed from the trail cache if set. Then offset and
+    size refer to grams of the entry instead of bits of data.
+    */
+    struct trail_cache_entry *cache_entry;
+    /* set if the current trail was opened by tdb_cursor_next_trail() */
+    int in_scan;
+
+    /* maximum number of events per trail, 0 if unlimited */
+    uint64_t limit;
+    /* number of events that can be still returned from this trail */
+    uint64_t limit_left;
+
+    /* tdb_cursor_scan_range(): trails left and the window of trails.data */
+    uint64_t scan_next_trail;
+    uint64_t scan_end_trail;
+    uint64_t scan_advised;
+    uint64_t scan_released;
 
     int edge_encoded;
+    /* decoding routines specialized for the tdb and the options */
+    const struct decoder_variant *decoders;
+
+    /* projection, NULL if all fields are materialized */
+    tdb_field *projection;
+    /* columns[field] is the column of field in projection */
+    tdb_field *columns;
+    uint64_t num_projected;
+    /* projected[field] is 1 if field is materialized */
+    uint8_t *projected;
 
     tdb_item previous_items[0];
 };
@@ -112,6 +182,9 @@ struct _tdb_cons {
 
     uint64_t output_format;
     uint64_t no_bigrams;
+    uint64_t sorted_lexicons;
+    uint64_t front_coded_lexicons;
+    uint64_t frequency_ordered_values;
 };
 
 struct tdb_file {
@@ -130,6 +203,11 @@ struct tdb_lexicon {
         const uint64_t *toc64;
     } toc;
     const char *data;
+    /* values per block of a front-coded lexicon, 0 if not front-coded */
+    uint64_t block_size;
+    /* identifies the lexicon in the block cache, see tdb_front_coding.h */
+    uint64_t cache_id;
+    tdb_field field;
 };
 
 struct _tdb {
@@ -144,11 +222,28 @@ struct _tdb {
     struct tdb_file codebook;
     struct tdb_file trails;
     struct tdb_file toc;
+    /* first and last timestamp of each trail, optional */
+    struct tdb_file summary;
+    /* number of events of each trail, optional */
+    struct tdb_file lengths;
+    /* checkpoints of long trails for seeking, optional */
+    struct tdb_file index;
     struct tdb_file *lexicons;
+    /* cache ID of front-coded lexicons, see tdb_front_coding.h */
+    uint64_t lexicon_cache_id;
+    /* hash indices of lexicons, built on the first lookup of a field */
+    struct lexicon_hash **lexicon_hashes;
+    /* lexicographic orders of lexicons, optional */
+    struct tdb_file *sorted_lexicons;
+    /* orders built in memory when sorted_lexicons are missing */
+    char **lexicon_orders;
 
     char **field_names;
     struct field_stats *field_stats;
 
+    /* decoding tables derived from the codebook */
+    struct huff_decoder *decoder;
+
     uint64_t version;
 
     /* tdb_package */
@@ -164,10 +259,18 @@ struct _tdb {
     int opt_edge_encoded;
     /* TDB_OPT_EVENT_FILTER */
     const struct tdb_event_filter *opt_event_filter;
+    /* TDB_OPT_TRAIL_CACHE_SIZE, NULL if the cache was never enabled */
+    struct trail_cache *trail_cache;
+    /* TDB_OPT_UUID_INDEX */
+    int opt_uuid_index;
+    struct uuid_index *uuid_index;
 
     /* trail-level event filters */
     Pvoid_t opt_trail_event_filters;
 
+    /* incremented when event filters are set, invalidates compiled filters */
+    uint64_t opt_filter_generation;
+
 };
 
 void tdb_lexicon_read(const tdb *db, tdb_field field, struct tdb_lexicon *lex);
@@ -178,6 +281,9 @@ const char *tdb_lexicon_get(const struct tdb_lexicon *lex,
 
 tdb_error tdb_encode(tdb_cons *cons, const tdb_item *items);
 
+/* tdb_encode() with TDB_OPT_CONS_FREQUENCY_ORDERED_VALUES */
+tdb_error tdb_encode_renumbered(tdb_cons *cons, tdb_item *items);
+
 tdb_error edge_encode_items(const tdb_item *items,
                             tdb_item **encoded,
                             uint64_t *num_encoded,
@@ -192,4 +298,56 @@ int file_mmap(const char *path,
 
 int is_fieldname_invalid(const char* field);
 
+/*
+counters updated by the decoder: events and trails per value of field,
+or events per time bucket if field is 0
+*/
+struct tdb_aggregate{
+    tdb_field field;
+    uint64_t *event_counts;
+    uint64_t *trail_counts;
+    /* the last trail counted for each value, plus one */
+    uint64_t *last_trail;
+
+    uint64_t start;
+    uint64_t bucket_width;
+    uint64_t num_buckets;
+    uint64_t *buckets;
+};
+
+void tdb_cursor_aggregate(tdb_cursor *cursor, struct tdb_aggregate *agg);
+
+static inline uint64_t tdb_get_trail_offs(const tdb *db, uint64_t trail_id)
+{
+    if (db->trails.size < UINT32_MAX)
+        return ((const uint32_t*)db->toc.data)[trail_id];
+    else
+        return ((const uint64_t*)db->toc.data)[trail_id];
+}
+
+/*
+trails.summary stores the first and the last timestamp of each trail
+relative to min_timestamp, using 4 bytes per value if they fit
+*/
+static inline uint64_t tdb_summary_width(const tdb *db)
+{
+    return db->max_timestamp - db->min_timestamp < UINT32_MAX ? 4 : 8;
+}
+
+static inline void tdb_get_trail_summary(const tdb *db,
+                                         uint64_t trail_id,
+                                         uint64_t *first,
+                                         uint64_t *last)
+{
+    if (tdb_summary_width(db) == 4){
+        const uint32_t *summary = (const uint32_t*)db->summary.data;
+        *first = db->min_timestamp + summary[trail_id * 2];
+        *last = db->min_timestamp + summary[trail_id * 2 + 1];
+    }else{
+        const uint64_t *summary = (const uint64_t*)db->summary.data;
+        *first = db->min_timestamp + summary[trail_id * 2];
+        *last = db->min_timestamp + summary[trail_id * 2 + 1];
+    }
+}
+
 #endif /* __TDB_INTERNAL_H__ */
@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xxhash/xxhash.h"
+
+#include "tdb_lexicon_hash.h"
+#include "tdb_front_coding.h"
+
+#define VAL_BITS 40
+#define VAL_MASK ((1LLU << VAL_BITS) - 1)
+#define FINGERPRINT(hash) ((hash) >> VAL_BITS)
+
+/* values of a batch in lexicon_hash_find_many() */
+#define FIND_BATCH 16
+
+struct lexicon_hash{
+    uint64_t mask;
+    uint64_t slots[0];
+};
+
+static inline uint64_t hash_value(const char *value, uint64_t length)
+{
+    return XXH64(value, (size_t)length, 0);
+}
+
+struct lexicon_hash *lexicon_hash_new(const struct tdb_lexicon *lex)
+{
+    struct lexicon_scratch scratch = LEXICON_SCRATCH_INIT;
+    struct lexicon_hash *hash;
+    uint64_t i, num_slots = 64;
+
+    /* keep the load factor between 1/3 and 2/3 */
+    while (num_slots < lex->size + lex->size / 2)
+        num_slots *= 2;
+
+    if (!(hash = calloc(1, sizeof(struct lexicon_hash) + num_slots * 8)))
+        return NULL;
+    hash->mask = num_slots - 1;
+
+    for (i = 0; i < lex->size; i++){
+        uint64_t length, h, idx;
+        const char *value = tdb_lexicon_peek(lex, i, &length, &scratch);
+
+        if (!value){
+            free(hash);
+            hash = NULL;
+            break;
+        }
+        h = hash_value(value, length);
+        idx = h & hash->mask;
+
+        /* values of a lexicon are unique, so there's no need to compare */
+        while (hash->slots[idx])
+            idx = (idx + 1) & hash->mask;
+        hash->slots[idx] = (FINGERPRINT(h) << VAL_BITS) | (i + 1);
+    }
+    lexicon_scratch_free(&scratch);
+    return hash;
+}
+
+void lexicon_hash_free(struct lexicon_hash *hash)
+{
+    free(hash);
+}
+
+static inline tdb_val probe(const struct lexicon_hash *hash,
+                            const struct tdb_lexicon *lex,
+                            const char *value,
+                            uint64_t value_length,
+                            uint64_t h,
+                            struct lexicon_scratch *scratch)
+{
+    uint64_t idx = h & hash->mask;
+    uint64_t slot;
+
+    while ((slot = hash->slots[idx])){
+        if ((slot >> VAL_BITS) == FINGERPRINT(h)){
+            const tdb_val val = slot & VAL_MASK;
+            uint64_t length;
+            const char *token = tdb_lexicon_peek(lex,
+                                                 val - 1,
+                                                 &length,
+                                                 scratch);
+            if (token &&
+                length == value_length &&
+                !memcmp(token, value, length))
+                return val;
+        }
+        idx = (idx + 1) & hash->mask;
+    }
+    return 0;
+}
+
+tdb_val lexicon_hash_find(const struct lexicon_hash *hash,
+                          const struct tdb_lexicon *lex,
+                          const char *value,
+                          uint64_t value_length)
+{
+    struct lexicon_scratch scratch = LEXICON_SCRATCH_INIT;
+    tdb_val val = probe(hash,
+                        lex,
+                        value,
+                        value_length,
+                        hash_value(value, value_length),
+                        &scratch);
+    lexicon_scratch_free(&scratch);
+    return val;
+}
+
+void lexicon_hash_find_many(const struct lexicon_hash *hash,
+                            const struct tdb_lexicon *lex,
+                            const char **values,
+                            const uint64_t *value_lengths,
+                            uint64_t num_values,
+                            tdb_val *vals)
+{
+    struct lexicon_scratch scratch = LEXICON_SCRATCH_INIT;
+    uint64_t hashes[FIND_BATCH];
+    uint64_t i, j;
+
+    /*
+    a large index doesn't fit in cache, so hash a batch of values and
+    prefetch their slots first, letting the cache misses overlap
+    */
+    for (i = 0; i < num_values; i += FIND_BATCH){
+        const uint64_t n = num_values - i < FIND_BATCH ?
+                           num_values - i: FIND_BATCH;
+        for (j = 0; j < n; j++){
+            hashes[j] = hash_value(values[i + j], value_lengths[i + j]);
+            __builtin_prefetch(&hash->slots[hashes[j] & hash->mask]);
+        }
+        for (j = 0; j < n; j++){
+            if (value_lengths[i + j])
+                vals[i + j] = probe(hash,
+                                    lex,
+                                    values[i + j],
+                                    value_lengths[i + j],
+                                    hashes[j],
+                                    &scratch);
+            else
+                vals[i + j] = 0;
+        }
+    }
+    lexicon_scratch_free(&scratch);
+}
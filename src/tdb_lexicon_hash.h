@@ -0,0 +1,44 @@
+#ifndef __TDB_LEXICON_HASH_H__
+#define __TDB_LEXICON_HASH_H__
+
+#include <stdint.h>
+
+#include "tdb_internal.h"
+
+/*
+A hash index over the values of a lexicon, which makes value-to-item
+lookups constant time instead of a linear scan over the lexicon.
+
+The index is built in memory on the first lookup of a field, so it
+works with existing tdbs. It is an open-addressing table of 64-bit
+slots: the low 40 bits hold the value ID (1-based, zero marks an empty
+slot) and the high 24 bits a fingerprint of the value's hash, so a
+probe compares a lexicon entry only when the fingerprints match.
+*/
+
+/* smaller lexicons are scanned linearly */
+#define LEXICON_HASH_MIN_SIZE 32
+
+struct lexicon_hash;
+
+struct lexicon_hash *lexicon_hash_new(const struct tdb_lexicon *lex);
+void lexicon_hash_free(struct lexicon_hash *hash);
+
+/* return the value ID (1-based) of the value, or 0 if not found */
+tdb_val lexicon_hash_find(const struct lexicon_hash *hash,
+                          const struct tdb_lexicon *lex,
+                          const char *value,
+                          uint64_t value_length);
+
+/*
+find many values at once, vals[i] is set as lexicon_hash_find() would.
+Slots of a batch of values are prefetched before probing.
+*/
+void lexicon_hash_find_many(const struct lexicon_hash *hash,
+                            const struct tdb_lexicon *lex,
+                            const char **values,
+                            const uint64_t *value_lengths,
+                            uint64_t num_values,
+                            tdb_val *vals);
+
+#endif /* __TDB_LEXICON_HASH_H__ */
@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb_internal.h"
+#include "tdb_lexicon_order.h"
+#include "tdb_front_coding.h"
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct lexicon_sort_entry *x = (const struct lexicon_sort_entry*)a;
+    const struct lexicon_sort_entry *y = (const struct lexicon_sort_entry*)b;
+    return lexicon_compare(x->value, x->length, y->value, y->length);
+}
+
+void lexicon_sort(struct lexicon_sort_entry *entries,
+                  uint64_t num_entries,
+                  char *dst)
+{
+    uint64_t i;
+
+    qsort(entries,
+          num_entries,
+          sizeof(struct lexicon_sort_entry),
+          compare_entries);
+
+    if (LEXICON_ORDER_WIDTH(num_entries) == 4)
+        for (i = 0; i < num_entries; i++)
+            ((uint32_t*)dst)[i] = (uint32_t)entries[i].val;
+    else
+        for (i = 0; i < num_entries; i++)
+            ((uint64_t*)dst)[i] = entries[i].val;
+}
+
+static char *build_order(const struct tdb_lexicon *lex)
+{
+    struct lexicon_scratch scratch = LEXICON_SCRATCH_INIT;
+    struct lexicon_sort_entry *entries;
+    char *values = NULL;
+    char *order = NULL;
+    uint64_t i, size = 0;
+
+    if (!(entries = malloc(lex->size * sizeof(struct lexicon_sort_entry))))
+        return NULL;
+
+    for (i = 0; i < lex->size; i++){
+        if (!(entries[i].value = tdb_lexicon_peek(lex,
+                                                  i,
+                                                  &entries[i].length,
+                                                  &scratch)))
+            goto done;
+        entries[i].val = i + 1;
+        size += entries[i].length;
+    }
+
+    /* values of front-coded lexicons have to be decoded for sorting */
+    if (lex->block_size){
+        if (!(values = malloc(size + 1)))
+            goto done;
+        for (size = 0, i = 0; i < lex->size; i++){
+            const char *value = tdb_lexicon_peek(lex,
+                                                 i,
+                                                 &entries[i].length,
+                                                 &scratch);
+            if (!value)
+                goto done;
+            memcpy(&values[size], value, entries[i].length);
+            entries[i].value = &values[size];
+            size += entries[i].length;
+        }
+    }
+
+    if ((order = malloc(lex->size * LEXICON_ORDER_WIDTH(lex->size))))
+        lexicon_sort(entries, lex->size, order);
+done:
+    lexicon_scratch_free(&scratch);
+    free(entries);
+    free(values);
+    return order;
+}
+
+/*
+return the sorted permutation of a field from lexicon.<field>.sorted,
+or build it on the first call. Like lexicon hashes, the permutation is
+published with a compare-and-swap. Returns NULL if there's not enough
+memory.
+*/
+static const char *get_order(const tdb *db,
+                             tdb_field field,
+                             const struct tdb_lexicon *lex)
+{
+    char **ptr = &db->lexicon_orders[field - 1];
+    char *order;
+
+    if (db->sorted_lexicons[field - 1].data)
+        return db->sorted_lexicons[field - 1].data;
+
+    if (!(order = __atomic_load_n(ptr, __ATOMIC_ACQUIRE))){
+        char *existing = NULL;
+        if ((order = build_order(lex))){
+            if (!__atomic_compare_exchange_n(ptr,
+                                             &existing,
+                                             order,
+                                             0,
+                                             __ATOMIC_ACQ_REL,
+                                             __ATOMIC_ACQUIRE)){
+                free(order);
+                order = existing;
+            }
+        }
+    }
+    return order;
+}
+
+static inline tdb_val order_val(const char *order,
+                                uint64_t num_values,
+                                uint64_t rank)
+{
+    if (LEXICON_ORDER_WIDTH(num_values) == 4)
+        return ((const uint32_t*)order)[rank];
+    else
+        return ((const uint64_t*)order)[rank];
+}
+
+/*
+find the first rank whose value compares greater than or equal to
+value, or greater than value if strict is set. If prefix is set, values
+are truncated to the length of value before comparing, so that the
+values starting with value compare equal.
+*/
+static tdb_error search(const struct tdb_lexicon *lex,
+                        const char *order,
+                        const char *value,
+                        uint64_t value_length,
+                        int prefix,
+                        int strict,
+                        uint64_t *rank)
+{
+    struct lexicon_scratch scratch = LEXICON_SCRATCH_INIT;
+    uint64_t left = 0;
+    uint64_t right = lex->size;
+    tdb_error err = 0;
+
+    while (left < right){
+        uint64_t mid = left + (right - left) / 2;
+        uint64_t length;
+        const char *token = tdb_lexicon_peek(lex,
+                                             order_val(order, lex->size, mid) - 1,
+                                             &length,
+                                             &scratch);
+        int cmp;
+
+        if (!token){
+            err = TDB_ERR_NOMEM;
+            break;
+        }
+        if (prefix && length > value_length)
+            length = value_length;
+        cmp = lexicon_compare(token, length, value, value_length);
+
+        if (strict ? cmp > 0: cmp >= 0)
+            right = mid;
+        else
+            left = mid + 1;
+    }
+    lexicon_scratch_free(&scratch);
+    *rank = left;
+    return err;
+}
+
+TDB_EXPORT tdb_error tdb_lexicon_range(const tdb *db,
+                                       tdb_field field,
+                                       const char *min_value,
+                                       uint64_t min_length,
+                                       const char *max_value,
+                                       uint64_t max_length,
+                                       uint64_t *first,
+                                       uint64_t *last)
+{
+    struct tdb_lexicon lex;
+    const char *order;
+    tdb_error err;
+
+    if (field == 0 || field >= db->num_fields)
+        return TDB_ERR_UNKNOWN_FIELD;
+
+    *first = *last = 0;
+    tdb_lexicon_read(db, field, &lex);
+    if (!lex.size)
+        return 0;
+    if (!(order = get_order(db, field, &lex)))
+        return TDB_ERR_NOMEM;
+
+    *last = lex.size;
+    if (min_value)
+        if ((err = search(&lex, order, min_value, min_length, 0, 0, first)))
+            return err;
+    if (max_value)
+        if ((err = search(&lex, order, max_value, max_length, 0, 0, last)))
+            return err;
+    if (*last < *first)
+        *last = *first;
+    return 0;
+}
+
+TDB_EXPORT tdb_error tdb_lexicon_prefix_range(const tdb *db,
+                                              tdb_field field,
+                                              const char *prefix,
+                                              uint64_t prefix_length,
+                                              uint64_t *first,
+                                              uint64_t *last)
+{
+    struct tdb_lexicon lex;
+    const char *order;
+    tdb_error err;
+
+    if (field == 0 || field >= db->num_fields)
+        return TDB_ERR_UNKNOWN_FIELD;
+
+    *first = *last = 0;
+    tdb_lexicon_read(db, field, &lex);
+    if (!lex.size)
+        return 0;
+    if (!(order = get_order(db, field, &lex)))
+        return TDB_ERR_NOMEM;
+
+    if ((err = search(&lex, order, prefix, prefix_length, 0, 0, first)))
+        return err;
+    return search(&lex, order, prefix, prefix_length, 1, 1, last);
+}
+
+TDB_EXPORT tdb_val tdb_lexicon_sorted_val(const tdb *db,
+                                          tdb_field field,
+                                          uint64_t rank)
+{
+    struct tdb_lexicon lex;
+    const char *order;
+
+    if (field == 0 || field >= db->num_fields)
+        return 0;
+
+    tdb_lexicon_read(db, field, &lex);
+    if (rank >= lex.size || !(order = get_order(db, field, &lex)))
+        return 0;
+    return order_val(order, lex.size, rank);
+}
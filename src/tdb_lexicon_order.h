@@ -0,0 +1,54 @@
+#ifndef __TDB_LEXICON_ORDER_H__
+#define __TDB_LEXICON_ORDER_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tdb_types.h"
+
+/*
+The lexicographic order of the values of a lexicon, which allows prefix
+and range queries with a binary search.
+
+Values are stored in the order they were first seen, so the order is a
+permutation of value IDs. It is stored optionally, with
+TDB_OPT_CONS_SORTED_LEXICONS, in lexicon.<field>.sorted:
+
+[ value IDs in lexicographic order ] N * (4 or 8 bytes)
+
+where the width is 4 bytes if N < UINT32_MAX. If the file is missing,
+the permutation is built in memory when a field is queried first.
+*/
+
+#define LEXICON_ORDER_WIDTH(num_values) ((num_values) < UINT32_MAX ? 4: 8)
+
+struct lexicon_sort_entry{
+    const char *value;
+    uint64_t length;
+    tdb_val val;
+};
+
+/* byte-wise order, a prefix of a value comes before the value */
+static inline int lexicon_compare(const char *a,
+                                  uint64_t a_length,
+                                  const char *b,
+                                  uint64_t b_length)
+{
+    int cmp = memcmp(a, b, a_length < b_length ? a_length: b_length);
+    if (cmp)
+        return cmp;
+    else if (a_length == b_length)
+        return 0;
+    else
+        return a_length < b_length ? -1: 1;
+}
+
+/*
+sort entries and write their value IDs in order to dst, which has
+room for num_entries IDs of LEXICON_ORDER_WIDTH(num_entries) bytes
+*/
+void lexicon_sort(struct lexicon_sort_entry *entries,
+                  uint64_t num_entries,
+                  char *dst);
+
+#endif /* __TDB_LEXICON_ORDER_H__ */
@@ -1,17 +1,21 @@
-
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "traildb.h"
 #include "tdb_internal.h"
 
-#include "pqueue/pqueue.h"
-
 /*
 Multi-cursor merges events from K cursors (trails) in a single
 stream of timestamp ordered events on the fly. Merging is done with
-a simple priority queue (heap), implemented by the pqueue library.
+a tournament tree of losers (a loser tree): Each internal node of a
+complete binary tree over the cursors stores the cursor that lost the
+match at that node, together with its timestamp, and the root stores
+the overall winner. When the winner advances, it only needs to replay
+the matches on the path from its leaf to the root, comparing against
+the timestamps stored inline in the nodes - one comparison per level,
+without touching the nodes of other cursors or their siblings.
 
 A key feature of multi-cursor is that it performs merging in a
 zero-copy fashion by relying on the event buffers of underlying
@@ -20,96 +24,129 @@ buffer/event lifetime needs to be managed carefully.
 
 If the buffer of an underlying cursor is exhausted temporarily, the
 cursor can't be refreshed right away since this would invalidate
-the past events. Instead, the cursor is marked as dirty in
-popped_node, so it can be reinstered when multi-cursor is called
-the next time.
+the past events. Instead, the cursor is left as the winner and marked
+as dirty in popped, so its matches can be replayed when multi-cursor is
+called the next time.
 */
 
-struct mcursor_node{
-    pqueue_pri_t timestamp;
-    size_t pos;
-    tdb_cursor *cursor;
+/*
+Entries are ordered by timestamp, ties are broken by cursor index so
+that the order of events is deterministic. Exhausted cursors and the
+padding leaves of the tree are represented by EMPTY_INDEX, which loses
+to every cursor.
+*/
+#define EMPTY_INDEX UINT64_MAX
+
+struct mcursor_entry{
+    uint64_t timestamp;
     uint64_t index;
 };
 
 struct tdb_multi_cursor{
-    /* priority queue */
-    pqueue_t *queue;
-    struct mcursor_node *nodes;
-    uint64_t num_nodes;
+    /*
+    loser tree: tree[0] is the winner, tree[1..num_leaves - 1] are the
+    losers of internal nodes. Leaf i is at position num_leaves + i.
+    */
+    struct mcursor_entry *tree;
+    uint64_t num_leaves;
+
+    /* winners of subtrees by position, used by tdb_multi_cursor_reset() */
+    struct mcursor_entry *winners;
 
-    /* node that needs to be reinserted on the next call */
-    struct mcursor_node *popped_node;
+    tdb_cursor **cursors;
+    uint64_t num_cursors;
+
+    /* the winner needs to be replayed on the next call */
+    int popped;
 
     /* returned event buffer */
     tdb_multi_event current_event;
 };
 
-/* pqueue callback functions */
-
-static int cmp_pri(pqueue_pri_t next, pqueue_pri_t cur)
+static inline int entry_wins(const struct mcursor_entry *a,
+                             const struct mcursor_entry *b)
 {
-	return next > cur;
+    return a->timestamp < b->timestamp ||
+           (a->timestamp == b->timestamp && a->index < b->index);
 }
 
-static pqueue_pri_t get_pri(void *a)
+static inline struct mcursor_entry cursor_entry(tdb_multi_cursor *mc,
+                                                uint64_t index)
 {
-	return ((struct mcursor_node*)a)->timestamp;
-}
-
-static void set_pri(void *a, pqueue_pri_t timestamp)
-{
-	((struct mcursor_node*)a)->timestamp = timestamp;
-}
-
-static size_t get_pos(void *a)
-{
-	return ((struct mcursor_node*)a)->pos;
+    struct mcursor_entry entry = {UINT64_MAX, EMPTY_INDEX};
+    const tdb_event *event = tdb_cursor_peek(mc->cursors[index]);
+    if (event){
+        entry.timestamp = event->timestamp;
+        entry.index = index;
+    }
+    return entry;
 }
 
-static void set_pos(void *a, size_t pos)
+/*
+The winner (tree[0]) has a new timestamp. Replay its matches from its
+leaf up to the root. The new winner ends up in tree[0].
+*/
+static inline void replay(tdb_multi_cursor *mc, struct mcursor_entry entry)
 {
-    ((struct mcursor_node*)a)->pos = pos;
+    const uint64_t leaf = mc->tree[0].index;
+    uint64_t pos;
+
+    for (pos = (mc->num_leaves + leaf) / 2; pos > 0; pos /= 2){
+        if (entry_wins(&mc->tree[pos], &entry)){
+            struct mcursor_entry tmp = mc->tree[pos];
+            mc->tree[pos] = entry;
+            entry = tmp;
+        }
+    }
+    mc->tree[0] = entry;
 }
 
-static void print_entry(FILE *out, void *a)
+/*
+The entry that would win if the current winner was removed: the best
+loser on the path of the winner. Runs of the winner can be consumed
+as long as they win against the runner-up.
+*/
+static inline const struct mcursor_entry *runner_up(const tdb_multi_cursor *mc)
 {
-    struct mcursor_node *node = (struct mcursor_node*)a;
-    fprintf(out,
-            "node[%"PRIu64"] timestamp %"PRIu64"\n",
-            node->index,
-            (uint64_t)node->timestamp);
+    static const struct mcursor_entry empty = {UINT64_MAX, EMPTY_INDEX};
+    const struct mcursor_entry *best = &empty;
+    uint64_t pos;
+
+    for (pos = (mc->num_leaves + mc->tree[0].index) / 2; pos > 0; pos /= 2)
+        if (entry_wins(&mc->tree[pos], best))
+            best = &mc->tree[pos];
+    return best;
 }
 
 TDB_EXPORT tdb_multi_cursor *tdb_multi_cursor_new(tdb_cursor **cursors,
                                                   uint64_t num_cursors)
 {
     tdb_multi_cursor *mc = NULL;
-    uint64_t i;
+    uint64_t num_leaves = 1;
 
-    if (num_cursors > SIZE_MAX - 1)
+    if (num_cursors > SIZE_MAX / (4 * sizeof(struct mcursor_entry)))
         return NULL;
 
+    while (num_leaves < num_cursors)
+        num_leaves *= 2;
+
     if (!(mc = calloc(1, sizeof(struct tdb_multi_cursor))))
         goto err;
 
-    if (!(mc->nodes = calloc(num_cursors, sizeof(struct mcursor_node))))
+    if (!(mc->tree = calloc(num_leaves, sizeof(struct mcursor_entry))))
+        goto err;
+
+    if (!(mc->winners = calloc(2 * num_leaves, sizeof(struct mcursor_entry))))
         goto err;
 
-    if (!(mc->queue = pqueue_init(num_cursors,
-                                  cmp_pri,
-                                  get_pri,
-                                  set_pri,
-                                  get_pos,
-                                  set_pos)))
+    if (!(mc->cursors = calloc(num_cursors, sizeof(tdb_cursor*))))
         goto err;
 
-    mc->num_nodes = num_cursors;
+    if (num_cursors)
+        memcpy(mc->cursors, cursors, num_cursors * sizeof(tdb_cursor*));
+    mc->num_cursors = num_cursors;
+    mc->num_leaves = num_leaves;
 
-    for (i = 0; i < num_cursors; i++){
-        mc->nodes[i].cursor = cursors[i];
-        mc->nodes[i].index = i;
-    }
     tdb_multi_cursor_reset(mc);
 
     return mc;
@@ -119,94 +156,105 @@ err:
 }
 
 /*
-Reinitialize the priority queue after the state of the underlying cursors
+Rebuild the tree after the state of the underlying cursors
 has changed, e.g. after tdb_get_trail().
 */
 TDB_EXPORT void tdb_multi_cursor_reset(tdb_multi_cursor *mc)
 {
-    uint64_t i;
-
-    pqueue_reset(mc->queue);
-    for (i = 0; i < mc->num_nodes; i++){
-        const tdb_event *event = tdb_cursor_peek(mc->nodes[i].cursor);
-        if (event){
-            mc->nodes[i].timestamp = event->timestamp;
-            /*
-            we can ignore the return value of pqueue_insert since it
-            won't need to call realloc()
-            */
-            pqueue_insert(mc->queue, &mc->nodes[i]);
+    struct mcursor_entry *winners = mc->winners;
+    uint64_t pos;
+
+    for (pos = 0; pos < mc->num_leaves; pos++){
+        if (pos < mc->num_cursors)
+            winners[mc->num_leaves + pos] = cursor_entry(mc, pos);
+        else{
+            winners[mc->num_leaves + pos].timestamp = UINT64_MAX;
+            winners[mc->num_leaves + pos].index = EMPTY_INDEX;
+        }
+    }
+
+    /* play the matches bottom up */
+    for (pos = mc->num_leaves - 1; pos > 0; pos--){
+        const struct mcursor_entry *left = &winners[2 * pos];
+        const struct mcursor_entry *right = &winners[2 * pos + 1];
+        if (entry_wins(left, right)){
+            winners[pos] = *left;
+            mc->tree[pos] = *right;
+        }else{
+            winners[pos] = *right;
+            mc->tree[pos] = *left;
         }
     }
-    mc->popped_node = NULL;
+    mc->tree[0] = winners[1];
+    mc->popped = 0;
 }
 
 /*
-Reinsert exhausted cursor in the heap
+Replay the matches of the exhausted winner after refreshing its cursor
 (see the top of this file for an explanation)
 */
 static inline void reinsert_popped(tdb_multi_cursor *mc)
 {
-    if (mc->popped_node){
-        const tdb_event *event = tdb_cursor_peek(mc->popped_node->cursor);
-        if (event){
-            mc->popped_node->timestamp = event->timestamp;
-            pqueue_insert(mc->queue, mc->popped_node);
-        }
-        mc->popped_node = NULL;
+    if (mc->popped){
+        replay(mc, cursor_entry(mc, mc->tree[0].index));
+        mc->popped = 0;
     }
 }
 
+static inline void set_current_event(tdb_multi_cursor *mc,
+                                     const tdb_event *event,
+                                     uint64_t index)
+{
+    mc->current_event.event = event;
+    mc->current_event.db = mc->cursors[index]->state->db;
+    mc->current_event.cursor_idx = index;
+}
+
 /* Peek the next event to be returned */
 TDB_EXPORT const tdb_multi_event *tdb_multi_cursor_peek(tdb_multi_cursor *mc)
 {
-    const tdb_event *next_event;
-    struct mcursor_node *node;
+    uint64_t index;
 
     reinsert_popped(mc);
-    node = (struct mcursor_node*)pqueue_peek(mc->queue);
+    index = mc->tree[0].index;
 
-    if (!node)
+    if (index == EMPTY_INDEX)
         return NULL;
 
-    mc->current_event.event = tdb_cursor_peek(node->cursor);
-    mc->current_event.db = node->cursor->state->db;
-    mc->current_event.cursor_idx = node->index;
-
+    set_current_event(mc, tdb_cursor_peek(mc->cursors[index]), index);
     return &mc->current_event;
 }
 
 /* Return the next event */
 TDB_EXPORT const tdb_multi_event *tdb_multi_cursor_next(tdb_multi_cursor *mc)
 {
-    struct mcursor_node *node;
+    tdb_cursor *cursor;
+    uint64_t index;
 
     reinsert_popped(mc);
-    node = (struct mcursor_node*)pqueue_peek(mc->queue);
+    index = mc->tree[0].index;
 
-    if (!node)
+    if (index == EMPTY_INDEX)
         return NULL;
 
-    mc->current_event.event = tdb_cursor_next(node->cursor);
-    mc->current_event.db = node->cursor->state->db;
-    mc->current_event.cursor_idx = node->index;
+    cursor = mc->cursors[index];
+    set_current_event(mc, tdb_cursor_next(cursor), index);
 
-    if (node->cursor->num_events_left){
+    if (cursor->num_events_left){
         /*
         the event buffer of the cursor has remaining events,
-        so we can just update the heap with the next timestamp
+        so we can just replay the winner with the next timestamp
         */
-        const tdb_event *next_event = (const tdb_event*)node->cursor->next_event;
-        pqueue_change_priority(mc->queue, next_event->timestamp, node);
-    }else{
+        const tdb_event *next_event = (const tdb_event*)cursor->next_event;
+        struct mcursor_entry entry = {next_event->timestamp, index};
+        replay(mc, entry);
+    }else
         /*
         the event buffer of the cursor is empty. We don't know
-        the next timestamp, so mark this cursor as dirty in popped_node
+        the next timestamp, so mark this cursor as dirty in popped
         (calling tdb_cursor_peek() would invalidate mc->current_event.event)
         */
-        pqueue_pop(mc->queue);
-        mc->popped_node = node;
-    }
+        mc->popped = 1;
 
     return &mc->current_event;
 }
@@ -229,60 +277,32 @@ TDB_EXPORT uint64_t tdb_multi_cursor_next_batch(tdb_multi_cursor *mc,
     timestamp is smaller than those of any other cursor, e.g. if there is
     a cursor for each daily traildb.
 
-    Updating the heap for every single event is expensive and unnecessary
-    in this case. It suffices to update the heap only when we switch cursors.
-    This logic is implemented by popping the current cursor and peeking the
-    next one: We can consume the current cursor as long as its timestamps are
-    smaller than that of the next cursor.
+    Replaying the tree for every single event is unnecessary in this case.
+    It suffices to replay only when we switch cursors: We can consume the
+    winner as long as its events win against the runner-up, the best
+    loser on the path of the winner.
     */
-    while (n < max_events){
-        struct mcursor_node *current =
-            (struct mcursor_node*)pqueue_pop(mc->queue);
-        struct mcursor_node *next =
-            (struct mcursor_node*)pqueue_peek(mc->queue);
-        tdb_cursor *cur;
-        uint64_t next_timestamp = 0;
-        int is_last = 0;
-
-        if (current)
-            cur = current->cursor;
-        else
-            /* heap is empty - all cursors exhausted */
-            break;
-
-        if (next)
-            /*
-            consume the current cursor while timestamps are smaller than
-            next_timestamp
-            */
-            next_timestamp = next->timestamp;
-        else
-            /*
-            no next timestamp - current is the last one. We can consume
-            current until its end
-            */
-            is_last = 1;
+    while (n < max_events && mc->tree[0].index != EMPTY_INDEX){
+        const uint64_t index = mc->tree[0].index;
+        const struct mcursor_entry next = *runner_up(mc);
+        tdb_cursor *cur = mc->cursors[index];
+        struct mcursor_entry entry = {0, index};
 
         while (1){
             if (cur->num_events_left){
                 /* there are events left in the buffer */
                 const tdb_event *event = (const tdb_event*)cur->next_event;
+                entry.timestamp = event->timestamp;
 
-                if (n < max_events &&
-                    (is_last || event->timestamp <= next_timestamp)){
-
+                if (n < max_events && entry_wins(&entry, &next)){
                     events[n].event = event;
                     events[n].db = cur->state->db;
-                    events[n].cursor_idx = current->index;
+                    events[n].cursor_idx = index;
                     ++n;
                     tdb_cursor_next(cur);
                 }else{
-                    /*
-                    update the timestamp of the current cursor and
-                    return it to the heap
-                    */
-                    current->timestamp = event->timestamp;
-                    pqueue_insert(mc->queue, current);
+                    /* the runner-up takes over, replay the current cursor */
+                    replay(mc, entry);
                     break;
                 }
             }else{
@@ -290,7 +310,7 @@ TDB_EXPORT uint64_t tdb_multi_cursor_next_batch(tdb_multi_cursor *mc,
                 no events left in the buffer, we must stop iterating
                 to avoid the previous events from becoming invalid
                 */
-                mc->popped_node = current;
+                mc->popped = 1;
                 goto done;
             }
         }
@@ -302,9 +322,9 @@ done:
 TDB_EXPORT void tdb_multi_cursor_free(tdb_multi_cursor *mc)
 {
     if (mc){
-        if (mc->queue)
-            pqueue_free(mc->queue);
-        free(mc->nodes);
+        free(mc->tree);
+        free(mc->winners);
+        free(mc->cursors);
         free(mc);
     }
 }
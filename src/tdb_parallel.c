@@ -0,0 +1,252 @@
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "tdb_internal.h"
+
+/*
+Parallel scan over all trails of a tdb.
+
+Trails are split into chunks of roughly equal size in bytes of
+trails.data, since decoding time is proportional to the size of a trail
+rather than the number of trails. Initially each worker owns a
+contiguous range of chunks, which it processes from the front. A worker
+that runs out of chunks steals the latter half of the largest remaining
+range of other workers, so workers stay busy even if the sizes of
+trails are skewed.
+*/
+
+/* aim for this many chunks per worker, so that there's enough to steal */
+#define CHUNKS_PER_WORKER 64
+
+struct scan_worker{
+    /* chunks [next_chunk, end_chunk) are left to be processed */
+    uint64_t next_chunk;
+    uint64_t end_chunk;
+
+    pthread_t thread;
+    int started;
+    void *state;
+    tdb_error err;
+
+    struct parallel_scan *scan;
+};
+
+struct parallel_scan{
+    const tdb *db;
+    const struct tdb_event_filter *filter;
+    const tdb_field *fields;
+    uint64_t num_fields;
+    tdb_trail_callback callback;
+
+    /* chunk i consists of trails [chunks[i], chunks[i + 1]) */
+    uint64_t *chunks;
+    uint64_t num_chunks;
+
+    /* protects the ranges of chunks of workers */
+    pthread_mutex_t lock;
+    struct scan_worker *workers;
+    uint64_t num_workers;
+
+    /* set when a worker fails, so that other workers stop early */
+    int stopped;
+};
+
+/*
+split trails into at most max_chunks chunks of roughly equal size. Chunk
+boundaries are found by binary search over the toc, which is cheap
+compared to decoding.
+*/
+static uint64_t make_chunks(const tdb *db,
+                            uint64_t *chunks,
+                            uint64_t max_chunks)
+{
+    const uint64_t total = tdb_get_trail_offs(db, db->num_trails);
+    uint64_t num_chunks = 0;
+    uint64_t trail_id = 0;
+    uint64_t i;
+
+    chunks[0] = 0;
+    for (i = 1; i < max_chunks && trail_id < db->num_trails; i++){
+        /* the first trail whose offset is at least i / max_chunks of total */
+        const uint64_t target = (uint64_t)(((__uint128_t)total * i) /
+                                           max_chunks);
+        uint64_t left = trail_id + 1;
+        uint64_t right = db->num_trails;
+        while (left < right){
+            uint64_t mid = left + (right - left) / 2;
+            if (tdb_get_trail_offs(db, mid) < target)
+                left = mid + 1;
+            else
+                right = mid;
+        }
+        if (left < db->num_trails){
+            trail_id = left;
+            chunks[++num_chunks] = trail_id;
+        }else
+            break;
+    }
+    chunks[++num_chunks] = db->num_trails;
+    return num_chunks;
+}
+
+/*
+take a chunk from the front of the worker's own range, or steal the
+latter half of the largest range of other workers if it's empty.
+Chunks are large enough that a single lock doesn't become a bottleneck.
+*/
+static int next_chunk(struct scan_worker *w, uint64_t *chunk)
+{
+    struct parallel_scan *scan = w->scan;
+    int found = 1;
+
+    pthread_mutex_lock(&scan->lock);
+    if (w->next_chunk == w->end_chunk){
+        struct scan_worker *victim = NULL;
+        uint64_t i, max_left = 0;
+
+        for (i = 0; i < scan->num_workers; i++){
+            struct scan_worker *v = &scan->workers[i];
+            if (v->end_chunk - v->next_chunk > max_left){
+                max_left = v->end_chunk - v->next_chunk;
+                victim = v;
+            }
+        }
+        if (victim){
+            w->end_chunk = victim->end_chunk;
+            victim->end_chunk -= (max_left + 1) / 2;
+            w->next_chunk = victim->end_chunk;
+        }else
+            found = 0;
+    }
+    if (found)
+        *chunk = w->next_chunk++;
+    pthread_mutex_unlock(&scan->lock);
+    return found;
+}
+
+static void *scan_worker(void *arg)
+{
+    struct scan_worker *w = (struct scan_worker*)arg;
+    struct parallel_scan *scan = w->scan;
+    tdb_cursor *cursor = NULL;
+    uint64_t chunk, trail_id;
+    tdb_error err = 0;
+
+    if (!(cursor = tdb_cursor_new(scan->db))){
+        err = TDB_ERR_NOMEM;
+        goto done;
+    }
+    if (scan->filter)
+        if ((err = tdb_cursor_set_event_filter(cursor, scan->filter)))
+            goto done;
+    if (scan->fields)
+        if ((err = tdb_cursor_set_fields(cursor,
+                                         scan->fields,
+                                         scan->num_fields)))
+            goto done;
+
+    while (next_chunk(w, &chunk)){
+        if ((err = tdb_cursor_scan_range(cursor,
+                                         scan->chunks[chunk],
+                                         scan->chunks[chunk + 1])))
+            goto done;
+
+        while (!(err = tdb_cursor_next_trail(cursor, &trail_id))){
+            if (__atomic_load_n(&scan->stopped, __ATOMIC_RELAXED))
+                goto done;
+
+            if (scan->callback(cursor, trail_id, w->state)){
+                err = TDB_ERR_SCAN_ABORTED;
+                goto done;
+            }
+        }
+        /* the end of the chunk */
+        if (err != TDB_ERR_INVALID_TRAIL_ID)
+            goto done;
+        err = 0;
+    }
+done:
+    if (err)
+        __atomic_store_n(&scan->stopped, 1, __ATOMIC_RELAXED);
+    tdb_cursor_free(cursor);
+    w->err = err;
+    return NULL;
+}
+
+TDB_EXPORT tdb_error tdb_parallel_scan(const tdb *db,
+                                       const struct tdb_event_filter *filter,
+                                       const tdb_field *fields,
+                                       uint64_t num_fields,
+                                       tdb_trail_callback callback,
+                                       void **thread_states,
+                                       uint64_t num_threads)
+{
+    struct parallel_scan scan = {
+        .db = db,
+        .filter = filter,
+        .fields = fields,
+        .num_fields = num_fields,
+        .callback = callback
+    };
+    uint64_t i, max_chunks;
+    tdb_error err = 0;
+
+    if (!num_threads)
+        return TDB_ERR_INVALID_OPTION_VALUE;
+    if (!db->num_trails)
+        return 0;
+
+    max_chunks = num_threads * CHUNKS_PER_WORKER;
+    if (!(scan.chunks = malloc((max_chunks + 1) * sizeof(uint64_t))))
+        return TDB_ERR_NOMEM;
+    scan.num_chunks = make_chunks(db, scan.chunks, max_chunks);
+
+    if (!(scan.workers = calloc(num_threads, sizeof(struct scan_worker)))){
+        err = TDB_ERR_NOMEM;
+        goto done;
+    }
+    scan.num_workers = num_threads;
+
+    pthread_mutex_init(&scan.lock, NULL);
+    for (i = 0; i < num_threads; i++){
+        struct scan_worker *w = &scan.workers[i];
+        w->next_chunk = (scan.num_chunks * i) / num_threads;
+        w->end_chunk = (scan.num_chunks * (i + 1)) / num_threads;
+        w->state = thread_states ? thread_states[i]: NULL;
+        w->scan = &scan;
+    }
+
+    /* the calling thread acts as the first worker */
+    for (i = 1; i < num_threads; i++){
+        if (pthread_create(&scan.workers[i].thread,
+                           NULL,
+                           scan_worker,
+                           &scan.workers[i])){
+            /* the remaining workers will steal the chunks of this one */
+            break;
+        }
+        scan.workers[i].started = 1;
+    }
+    scan_worker(&scan.workers[0]);
+
+    for (i = 1; i < num_threads; i++)
+        if (scan.workers[i].started)
+            pthread_join(scan.workers[i].thread, NULL);
+
+    /* report TDB_ERR_SCAN_ABORTED rather than its side effects */
+    for (i = 0; i < num_threads; i++){
+        if (scan.workers[i].err == TDB_ERR_SCAN_ABORTED)
+            err = TDB_ERR_SCAN_ABORTED;
+        else if (scan.workers[i].err && !err)
+            err = scan.workers[i].err;
+    }
+
+    pthread_mutex_destroy(&scan.lock);
+done:
+    free(scan.workers);
+    free(scan.chunks);
+    return err;
+}
@@ -0,0 +1,204 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#undef JUDYERROR
+#define JUDYERROR(CallerFile, CallerLine, JudyFunc, JudyErrno, JudyErrID) \
+{                                                                         \
+   if ((JudyErrno) == JU_ERRNO_NOMEM)                                     \
+       goto out_of_memory;                                                \
+}
+#include <Judy.h>
+
+#include "tdb_trail_cache.h"
+
+struct trail_cache{
+    /* protects everything below */
+    pthread_mutex_t lock;
+
+    /* trail_id -> struct trail_cache_entry* */
+    Pvoid_t entries;
+    struct trail_cache_entry *head;
+    struct trail_cache_entry *tail;
+
+    uint64_t max_size;
+    uint64_t size;
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct trail_cache *trail_cache_new(void)
+{
+    struct trail_cache *cache;
+
+    if (!(cache = calloc(1, sizeof(struct trail_cache))))
+        return NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+static void unlink_entry(struct trail_cache *cache,
+                         struct trail_cache_entry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_front(struct trail_cache *cache,
+                       struct trail_cache_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+}
+
+/* drop a reference, the caller must hold the lock */
+static void unref(struct trail_cache_entry *entry)
+{
+    if (!--entry->refcount)
+        free(entry);
+}
+
+/* remove the least recently used entries until the cache fits the budget */
+static void evict(struct trail_cache *cache)
+{
+    while (cache->size > cache->max_size){
+        struct trail_cache_entry *entry = cache->tail;
+        int tmp;
+
+        JLD(tmp, cache->entries, entry->trail_id);
+        unlink_entry(cache, entry);
+        cache->size -= entry->size;
+        unref(entry);
+    }
+out_of_memory:
+    return;
+}
+
+void trail_cache_free(struct trail_cache *cache)
+{
+    if (cache){
+        Word_t tmp;
+
+        cache->max_size = 0;
+        evict(cache);
+        JLFA(tmp, cache->entries);
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+    }
+out_of_memory:
+    return;
+}
+
+void trail_cache_set_size(struct trail_cache *cache, uint64_t size)
+{
+    pthread_mutex_lock(&cache->lock);
+    cache->max_size = size;
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+uint64_t trail_cache_get_size(struct trail_cache *cache)
+{
+    uint64_t size;
+
+    pthread_mutex_lock(&cache->lock);
+    size = cache->max_size;
+    pthread_mutex_unlock(&cache->lock);
+    return size;
+}
+
+struct trail_cache_entry *trail_cache_get(
+    struct trail_cache *cache,
+    uint64_t trail_id,
+    int *miss)
+{
+    struct trail_cache_entry *entry = NULL;
+    Word_t *ptr;
+
+    *miss = 0;
+    pthread_mutex_lock(&cache->lock);
+    if (cache->max_size){
+        JLG(ptr, cache->entries, trail_id);
+        if (ptr){
+            entry = (struct trail_cache_entry*)*ptr;
+            ++entry->refcount;
+            unlink_entry(cache, entry);
+            push_front(cache, entry);
+            ++cache->hits;
+        }else{
+            ++cache->misses;
+            *miss = 1;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+struct trail_cache_entry *trail_cache_put(
+    struct trail_cache *cache,
+    struct trail_cache_entry *entry)
+{
+    Word_t *ptr;
+
+    entry->refcount = 1;
+    entry->prev = entry->next = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    if (entry->size <= cache->max_size){
+        JLI(ptr, cache->entries, entry->trail_id);
+        if (*ptr){
+            /* another cursor decoded the trail first */
+            struct trail_cache_entry *existing =
+                (struct trail_cache_entry*)*ptr;
+            free(entry);
+            entry = existing;
+            ++entry->refcount;
+            unlink_entry(cache, entry);
+        }else{
+            *ptr = (Word_t)entry;
+            ++entry->refcount;
+            cache->size += entry->size;
+        }
+        push_front(cache, entry);
+        evict(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+out_of_memory:
+    /* use the entry without caching it */
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+void trail_cache_release(struct trail_cache *cache,
+                         struct trail_cache_entry *entry)
+{
+    pthread_mutex_lock(&cache->lock);
+    unref(entry);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void trail_cache_stats(struct trail_cache *cache,
+                       uint64_t *hits,
+                       uint64_t *misses,
+                       uint64_t *size)
+{
+    pthread_mutex_lock(&cache->lock);
+    *hits = cache->hits;
+    *misses = cache->misses;
+    *size = cache->size;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,67 @@
+#ifndef __TDB_TRAIL_CACHE_H__
+#define __TDB_TRAIL_CACHE_H__
+
+#include <stdint.h>
+
+/*
+A cache of decoded trails shared by all cursors of a tdb, enabled with
+TDB_OPT_TRAIL_CACHE_SIZE.
+
+A trail is cached as the stream of grams produced by Huffman decoding,
+before events are assembled. Cursors replay the grams through the same
+code path as a freshly decoded trail, so filters, edge encoding and
+projections apply as usual. Entries are evicted in LRU order once the
+total size exceeds the budget. An entry is reference-counted, so that an
+evicted entry stays valid until the cursors replaying it are done.
+*/
+
+struct trail_cache_entry{
+    uint64_t trail_id;
+    uint64_t num_grams;
+    /* bytes charged to the budget */
+    uint64_t size;
+    /* number of cursors using the entry, plus one if it is in the cache */
+    uint64_t refcount;
+    /* the LRU list, the most recently used entry first */
+    struct trail_cache_entry *prev;
+    struct trail_cache_entry *next;
+    __uint128_t grams[0];
+};
+
+struct trail_cache;
+
+struct trail_cache *trail_cache_new(void);
+void trail_cache_free(struct trail_cache *cache);
+
+void trail_cache_set_size(struct trail_cache *cache, uint64_t size);
+uint64_t trail_cache_get_size(struct trail_cache *cache);
+
+/*
+find a cached trail and take a reference to it, or return NULL. Lookups
+are counted as hits or misses. miss is set if the trail should be
+decoded and added with trail_cache_put(), i.e. the cache is enabled.
+*/
+struct trail_cache_entry *trail_cache_get(
+    struct trail_cache *cache,
+    uint64_t trail_id,
+    int *miss);
+
+/*
+add a newly decoded trail with a reference taken for the caller. Returns
+the entry to use, which is an existing entry if another cursor added the
+trail meanwhile. An entry larger than the budget is not cached, but it
+is still valid until it is released.
+*/
+struct trail_cache_entry *trail_cache_put(
+    struct trail_cache *cache,
+    struct trail_cache_entry *entry);
+
+void trail_cache_release(struct trail_cache *cache,
+                         struct trail_cache_entry *entry);
+
+void trail_cache_stats(struct trail_cache *cache,
+                       uint64_t *hits,
+                       uint64_t *misses,
+                       uint64_t *size);
+
+#endif /* __TDB_TRAIL_CACHE_H__ */
@@ -104,10 +104,15 @@ typedef enum{
     TDB_OPT_ONLY_DIFF_ITEMS = 100,
     TDB_OPT_EVENT_FILTER = 101,
     TDB_OPT_CURSOR_EVENT_BUFFER_SIZE = 102,
+    TDB_OPT_TRAIL_CACHE_SIZE = 103,
+    TDB_OPT_UUID_INDEX = 104,
 
     /* writing */
     TDB_OPT_CONS_OUTPUT_FORMAT = 1001,
     TDB_OPT_CONS_NO_BIGRAMS = 1002,
+    TDB_OPT_CONS_SORTED_LEXICONS = 1003,
+    TDB_OPT_CONS_FRONT_CODED_LEXICONS = 1004,
+    TDB_OPT_CONS_FREQUENCY_ORDERED_VALUES = 1005,
 
 } tdb_opt_key;
 
@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdb_uuid_index.h"
+
+/* UUIDs per bucket if they are uniformly distributed */
+#define BUCKET_SIZE 4
+
+/* larger buckets are binary searched */
+#define LINEAR_SEARCH_MAX 16
+
+struct uuid_index{
+    __uint128_t first;
+    __uint128_t last;
+    /* length of the common prefix of all UUIDs in bits */
+    uint32_t shift;
+    /* bucket of a UUID is given by this many bits after the prefix */
+    uint32_t bits;
+    const char *uuids;
+    /* sorted copy of uuids and their trail IDs, NULL if sorted */
+    char *sorted_uuids;
+    uint64_t *trail_ids;
+    /* uuids in bucket i are [buckets[i], buckets[i + 1]) */
+    uint64_t buckets[0];
+};
+
+struct uuid_entry{
+    __uint128_t uuid;
+    uint64_t trail_id;
+};
+
+static inline __uint128_t uuid_at(const char *uuids, uint64_t i)
+{
+    __uint128_t uuid;
+    memcpy(&uuid, &uuids[i * 16], 16);
+    return uuid;
+}
+
+static inline uint64_t bucket(const struct uuid_index *index,
+                              __uint128_t uuid)
+{
+    return (uint64_t)((uuid << index->shift) >> (128 - index->bits));
+}
+
+static int compare_entries(const void *p1, const void *p2)
+{
+    const struct uuid_entry *x = (const struct uuid_entry*)p1;
+    const struct uuid_entry *y = (const struct uuid_entry*)p2;
+    if (x->uuid != y->uuid)
+        return x->uuid < y->uuid ? -1: 1;
+    /* find the first one of duplicates, like a linear scan would */
+    return x->trail_id < y->trail_id ? -1: 1;
+}
+
+/* sort a copy of unsorted uuids, remembering their trail IDs */
+static int sort_uuids(struct uuid_index *index,
+                      const char *uuids,
+                      uint64_t num_trails)
+{
+    struct uuid_entry *entries;
+    uint64_t i;
+
+    if (!(entries = malloc(num_trails * sizeof(struct uuid_entry))))
+        return -1;
+    for (i = 0; i < num_trails; i++){
+        entries[i].uuid = uuid_at(uuids, i);
+        entries[i].trail_id = i;
+    }
+    qsort(entries, num_trails, sizeof(struct uuid_entry), compare_entries);
+
+    if (!(index->sorted_uuids = malloc(num_trails * 16)) ||
+        !(index->trail_ids = malloc(num_trails * 8))){
+        free(entries);
+        return -1;
+    }
+    for (i = 0; i < num_trails; i++){
+        memcpy(&index->sorted_uuids[i * 16], &entries[i].uuid, 16);
+        index->trail_ids[i] = entries[i].trail_id;
+    }
+    free(entries);
+    return 0;
+}
+
+struct uuid_index *uuid_index_new(const char *uuids,
+                                  uint64_t num_trails,
+                                  int sorted)
+{
+    struct uuid_index *index;
+    __uint128_t first, last, diff;
+    uint64_t i, b, num_buckets;
+    uint32_t shift, bits = 1;
+
+    if (!num_trails)
+        return NULL;
+
+    while ((2LLU << bits) * BUCKET_SIZE <= num_trails)
+        ++bits;
+    num_buckets = 1LLU << bits;
+
+    if (!(index = calloc(1, sizeof(struct uuid_index) +
+                            (num_buckets + 1) * 8)))
+        return NULL;
+
+    if (!sorted){
+        if (sort_uuids(index, uuids, num_trails)){
+            uuid_index_free(index);
+            return NULL;
+        }
+        uuids = index->sorted_uuids;
+    }
+
+    first = uuid_at(uuids, 0);
+    last = uuid_at(uuids, num_trails - 1);
+    for (diff = first ^ last, shift = 0;
+         shift < 127 && !(diff >> (127 - shift));
+         shift++);
+
+    index->first = first;
+    index->last = last;
+    index->shift = shift;
+    index->bits = bits;
+    index->uuids = uuids;
+
+    for (b = 0, i = 0; i < num_trails; i++){
+        const uint64_t uuid_bucket = bucket(index, uuid_at(uuids, i));
+        while (b <= uuid_bucket)
+            index->buckets[b++] = i;
+    }
+    while (b <= num_buckets)
+        index->buckets[b++] = num_trails;
+
+    return index;
+}
+
+void uuid_index_free(struct uuid_index *index)
+{
+    if (index){
+        free(index->sorted_uuids);
+        free(index->trail_ids);
+        free(index);
+    }
+}
+
+int uuid_index_find(const struct uuid_index *index,
+                    const uint8_t *uuid,
+                    uint64_t *trail_id)
+{
+    __uint128_t key;
+    uint64_t b, left, right;
+
+    memcpy(&key, uuid, 16);
+    if (key < index->first || key > index->last)
+        return -1;
+
+    b = bucket(index, key);
+    left = index->buckets[b];
+    right = index->buckets[b + 1];
+
+    /* find the first UUID that is not smaller than key */
+    if (right - left > LINEAR_SEARCH_MAX){
+        while (left < right){
+            uint64_t mid = left + (right - left) / 2;
+            if (uuid_at(index->uuids, mid) < key)
+                left = mid + 1;
+            else
+                right = mid;
+        }
+    }else{
+        while (left < right && uuid_at(index->uuids, left) < key)
+            ++left;
+    }
+
+    if (left < index->buckets[b + 1] && uuid_at(index->uuids, left) == key){
+        *trail_id = index->trail_ids ? index->trail_ids[left]: left;
+        return 0;
+    }
+    return -1;
+}
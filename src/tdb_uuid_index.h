@@ -0,0 +1,35 @@
+#ifndef __TDB_UUID_INDEX_H__
+#define __TDB_UUID_INDEX_H__
+
+#include <stdint.h>
+
+/*
+An index over the UUIDs of a tdb, enabled with TDB_OPT_UUID_INDEX, which
+lets tdb_get_trail_id() touch a couple of cache lines instead of
+binary searching the whole uuids file.
+
+UUIDs are compared as 128-bit integers, so all UUIDs of the tdb share
+the leading bits that the smallest and the largest UUID share. A UUID
+is mapped to a bucket by the next bits after this common prefix, and a
+table of buckets stores the index of the first UUID of each bucket.
+There are about four UUIDs per bucket if UUIDs are uniformly
+distributed. Otherwise buckets may be larger and they are binary
+searched.
+
+UUIDs of TDB_VERSION_V0 are not sorted, so the index keeps a sorted
+copy of them together with their trail IDs.
+*/
+
+struct uuid_index;
+
+struct uuid_index *uuid_index_new(const char *uuids,
+                                  uint64_t num_trails,
+                                  int sorted);
+void uuid_index_free(struct uuid_index *index);
+
+/* return 0 and set trail_id if the UUID is found, -1 otherwise */
+int uuid_index_find(const struct uuid_index *index,
+                    const uint8_t *uuid,
+                    uint64_t *trail_id);
+
+#endif /* __TDB_UUID_INDEX_H__ */
@@ -11,6 +11,8 @@
 
 #define TDB_VERSION_V0 0LLU
 #define TDB_VERSION_V0_1 1LLU
+/* front-coded lexicons, see TDB_OPT_CONS_FRONT_CODED_LEXICONS */
+#define TDB_VERSION_V0_2 2LLU
 #define TDB_VERSION_LATEST TDB_VERSION_V0_1
 
 /*
@@ -114,6 +116,15 @@ tdb_error tdb_get_trail_opt(tdb *db,
                             tdb_opt_key key,
                             tdb_opt_value *value);
 
+/*
+Get the number of hits and misses of the trail cache and its current
+size in bytes (see TDB_OPT_TRAIL_CACHE_SIZE)
+*/
+void tdb_get_trail_cache_stats(const tdb *db,
+                               uint64_t *hits,
+                               uint64_t *misses,
+                               uint64_t *size);
+
 /*
 ----------------------------------
 Translate items to values and back
@@ -123,6 +134,32 @@ Translate items to values and back
 /* Get the number of distinct values in the given field */
 uint64_t tdb_lexicon_size(const tdb *db, tdb_field field);
 
+/*
+Find the values of a field in lexicographic order. Values are identified
+by their rank in the order, ranks [first, last) match.
+*/
+
+/* Find the values in [min_value, max_value), NULL means unbounded */
+tdb_error tdb_lexicon_range(const tdb *db,
+                            tdb_field field,
+                            const char *min_value,
+                            uint64_t min_length,
+                            const char *max_value,
+                            uint64_t max_length,
+                            uint64_t *first,
+                            uint64_t *last);
+
+/* Find the values starting with a prefix */
+tdb_error tdb_lexicon_prefix_range(const tdb *db,
+                                   tdb_field field,
+                                   const char *prefix,
+                                   uint64_t prefix_length,
+                                   uint64_t *first,
+                                   uint64_t *last);
+
+/* Get the value ID of the value of the given rank */
+tdb_val tdb_lexicon_sorted_val(const tdb *db, tdb_field field, uint64_t rank);
+
 /* Get the field ID given a field name */
 tdb_error tdb_get_field(const tdb *db,
                         const char *field_name,
@@ -137,6 +174,14 @@ tdb_item tdb_get_item(const tdb *db,
                       const char *value,
                       uint64_t value_length);
 
+/* Get items corresponding to many values of a field */
+tdb_error tdb_get_items(const tdb *db,
+                        tdb_field field,
+                        const char **values,
+                        const uint64_t *value_lengths,
+                        uint64_t num_values,
+                        tdb_item *items);
+
 /* Get value corresponding to a field, value ID pair */
 const char *tdb_get_value(const tdb *db,
                           tdb_field field,
@@ -246,6 +291,42 @@ tdb_error tdb_get_trail(tdb_cursor *cursor, uint64_t trail_id);
 /* Get the number of events remaining in this cursor */
 uint64_t tdb_get_trail_length(tdb_cursor *cursor);
 
+/* Get the number of events in a trail, regardless of event filters */
+tdb_error tdb_trail_num_events(const tdb *db,
+                               uint64_t trail_id,
+                               uint64_t *num_events);
+
+/*
+Get the timestamps of the first and the last event of a trail,
+regardless of event filters
+*/
+tdb_error tdb_trail_time_bounds(const tdb *db,
+                                uint64_t trail_id,
+                                uint64_t *first,
+                                uint64_t *last);
+
+/*
+Restart the current trail of this cursor from the first event at or
+after the given timestamp
+*/
+tdb_error tdb_cursor_seek_time(tdb_cursor *cursor, uint64_t timestamp);
+
+/*
+Scan trails [start_trail, end_trail) sequentially with
+tdb_cursor_next_trail(). Pages of trails.data are prefetched ahead of
+the cursor and released behind it.
+*/
+tdb_error tdb_cursor_scan_range(tdb_cursor *cursor,
+                                uint64_t start_trail,
+                                uint64_t end_trail);
+
+/*
+Reset the cursor to the next trail of the range set with
+tdb_cursor_scan_range(). Returns TDB_ERR_INVALID_TRAIL_ID at the end of
+the range.
+*/
+tdb_error tdb_cursor_next_trail(tdb_cursor *cursor, uint64_t *trail_id);
+
 /* Set an event filter for this cursor */
 tdb_error tdb_cursor_set_event_filter(tdb_cursor *cursor,
                                       const struct tdb_event_filter *filter);
@@ -253,9 +334,133 @@ tdb_error tdb_cursor_set_event_filter(tdb_cursor *cursor,
 /* Unset an event filter */
 void tdb_cursor_unset_event_filter(tdb_cursor *cursor);
 
+/*
+Evaluate several event filters in one pass over trails. The cursor
+returns events that match any of the filters
+*/
+tdb_error tdb_cursor_set_event_filters(tdb_cursor *cursor,
+                                       const struct tdb_event_filter **filters,
+                                       uint64_t num_filters);
+
+/*
+Bitmask of the filters that match the event last returned by
+tdb_cursor_next(), or NULL if tdb_cursor_set_event_filters() is not used
+*/
+const uint64_t *tdb_cursor_event_matches(const tdb_cursor *cursor);
+
+/*
+Return at most limit events per trail from this cursor, starting from
+the next tdb_get_trail(). Limit 0 means no limit (default).
+*/
+void tdb_cursor_set_limit(tdb_cursor *cursor, uint64_t limit);
+
+/* Materialize only the given fields in events of this cursor */
+tdb_error tdb_cursor_set_fields(tdb_cursor *cursor,
+                                const tdb_field *fields,
+                                uint64_t num_fields);
+
+/* Materialize all fields in events of this cursor (default) */
+tdb_error tdb_cursor_unset_fields(tdb_cursor *cursor);
+
+/*
+Return a batch of maximum max_events events as columns: timestamps[i]
+is the timestamp of the i-th event and columns[k][i] its item of the
+k-th field of the cursor (see tdb_cursor_set_fields())
+*/
+uint64_t tdb_cursor_next_columns(tdb_cursor *cursor,
+                                 uint64_t *timestamps,
+                                 tdb_item **columns,
+                                 uint64_t max_events);
+
+/* Like tdb_cursor_next_columns() but return values instead of items */
+uint64_t tdb_cursor_next_value_columns(tdb_cursor *cursor,
+                                       uint64_t *timestamps,
+                                       tdb_val **columns,
+                                       uint64_t max_events);
+
+/*
+Called for every event by tdb_trail_foreach(). items is an array of
+num_items items, which is valid only during the call. Return non-zero
+to stop decoding the trail.
+*/
+typedef int (*tdb_event_callback)(uint64_t timestamp,
+                                  const tdb_item *items,
+                                  uint64_t num_items,
+                                  void *ctx);
+
+/*
+Reset the cursor to the given trail and call callback for each of its
+events, without buffering events in the cursor. Event filters, the
+limit and the fields of the cursor apply as with tdb_cursor_next().
+*/
+tdb_error tdb_trail_foreach(tdb_cursor *cursor,
+                            uint64_t trail_id,
+                            tdb_event_callback callback,
+                            void *ctx);
+
 /* Internal function used by tdb_cursor_next() */
 int _tdb_cursor_next_batch(tdb_cursor *cursor);
 
+/*
+-------------
+Parallel scan
+-------------
+*/
+
+/*
+Called for every trail in tdb_parallel_scan(), with the cursor reset to
+the trail. Return non-zero to stop the scan.
+*/
+typedef int (*tdb_trail_callback)(tdb_cursor *cursor,
+                                  uint64_t trail_id,
+                                  void *thread_state);
+
+/*
+Call callback for every trail using num_threads threads. The i-th
+thread passes thread_states[i] to the callback, thread_states may be
+NULL. If filter is not NULL, it is set in every cursor. If fields is
+not NULL, only the given fields are materialized.
+*/
+tdb_error tdb_parallel_scan(const tdb *db,
+                            const struct tdb_event_filter *filter,
+                            const tdb_field *fields,
+                            uint64_t num_fields,
+                            tdb_trail_callback callback,
+                            void **thread_states,
+                            uint64_t num_threads);
+
+/*
+----------
+Aggregates
+----------
+*/
+
+/*
+Count events per value of field and the number of trails in which each
+value occurs, over events that match filter (may be NULL). Counts are
+indexed by tdb_val and have tdb_lexicon_size(db, field) entries. Either
+array may be NULL.
+*/
+tdb_error tdb_count_items(const tdb *db,
+                          const struct tdb_event_filter *filter,
+                          tdb_field field,
+                          uint64_t *event_counts,
+                          uint64_t *trail_counts,
+                          uint64_t num_threads);
+
+/*
+Count events that match filter (may be NULL) in num_buckets time buckets:
+bucket i counts events in [start + i * bucket_width,
+start + (i + 1) * bucket_width).
+*/
+tdb_error tdb_histogram_time(const tdb *db,
+                             const struct tdb_event_filter *filter,
+                             uint64_t start,
+                             uint64_t bucket_width,
+                             uint64_t *buckets,
+                             uint64_t num_buckets,
+                             uint64_t num_threads);
+
 /*
 ------------
 Multi cursor
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+tdb_count_items() and tdb_histogram_time() must agree with counts
+computed by iterating over events with a cursor
+*/
+
+#define NUM_TRAILS 1000
+#define CARDINALITY 50
+#define NUM_BUCKETS 37
+#define BUCKET_WIDTH 13
+#define BUCKETS_START 100
+
+static void check(tdb *t,
+                  const struct tdb_event_filter *filter,
+                  uint64_t num_threads)
+{
+    const uint64_t size = tdb_lexicon_size(t, 2);
+    uint64_t *events = calloc(size, sizeof(uint64_t));
+    uint64_t *trails = calloc(size, sizeof(uint64_t));
+    uint64_t *seen = calloc(size, sizeof(uint64_t));
+    uint64_t *expected_events = calloc(size, sizeof(uint64_t));
+    uint64_t *expected_trails = calloc(size, sizeof(uint64_t));
+    uint64_t buckets[NUM_BUCKETS];
+    uint64_t expected_buckets[NUM_BUCKETS];
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    uint64_t i;
+
+    memset(expected_buckets, 0, sizeof(expected_buckets));
+    if (filter)
+        assert(tdb_cursor_set_event_filter(cursor, filter) == 0);
+    for (i = 0; i < tdb_num_trails(t); i++){
+        const tdb_event *event;
+        assert(tdb_get_trail(cursor, i) == 0);
+        while ((event = tdb_cursor_next(cursor))){
+            tdb_val val = tdb_item_val(event->items[1]);
+            ++expected_events[val];
+            if (seen[val] != i + 1){
+                seen[val] = i + 1;
+                ++expected_trails[val];
+            }
+            if (event->timestamp >= BUCKETS_START &&
+                event->timestamp < BUCKETS_START + NUM_BUCKETS * BUCKET_WIDTH)
+                ++expected_buckets[(event->timestamp - BUCKETS_START) /
+                                   BUCKET_WIDTH];
+        }
+    }
+
+    /* results overwrite previous contents */
+    memset(events, 0xff, size * sizeof(uint64_t));
+    assert(tdb_count_items(t, filter, 2, events, trails, num_threads) == 0);
+    assert(!memcmp(events, expected_events, size * sizeof(uint64_t)));
+    assert(!memcmp(trails, expected_trails, size * sizeof(uint64_t)));
+
+    memset(events, 0, size * sizeof(uint64_t));
+    assert(tdb_count_items(t, filter, 2, events, NULL, num_threads) == 0);
+    assert(!memcmp(events, expected_events, size * sizeof(uint64_t)));
+
+    assert(tdb_histogram_time(t,
+                              filter,
+                              BUCKETS_START,
+                              BUCKET_WIDTH,
+                              buckets,
+                              NUM_BUCKETS,
+                              num_threads) == 0);
+    assert(!memcmp(buckets, expected_buckets, sizeof(buckets)));
+
+    tdb_cursor_free(cursor);
+    free(events);
+    free(trails);
+    free(seen);
+    free(expected_events);
+    free(expected_trails);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b"};
+    char buf[2][32];
+    const char *vals[2] = {buf[0], buf[1]};
+    uint64_t lengths[2];
+    uint64_t i, j, threads;
+    uint64_t counts[CARDINALITY + 1];
+    struct tdb_event_filter *f = tdb_event_filter_new();
+
+    test_srand(59);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 2) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t n = i % 100 == 0 ? 5000: 1 + test_rand() % 30;
+        uint64_t tstamp = test_rand() % 200;
+        memcpy(uuid, &i, sizeof(i));
+        for (j = 0; j < n; j++){
+            tstamp += test_rand() % 3;
+            lengths[0] = (uint64_t)sprintf(buf[0], "%u", test_rand() % 3);
+            /* value 0 (empty) is counted too */
+            if (test_rand() % 10)
+                lengths[1] = (uint64_t)sprintf(buf[1], "%u",
+                                               test_rand() % CARDINALITY);
+            else
+                lengths[1] = 0;
+            assert(tdb_cons_add(c, uuid, tstamp, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    assert(tdb_event_filter_add_term(f, tdb_get_item(t, 1, "1", 1), 0) == 0);
+    assert(tdb_event_filter_new_clause(f) == 0);
+    assert(tdb_event_filter_add_time_range(f, 150, 400) == 0);
+
+    for (threads = 1; threads <= 4; threads *= 4){
+        check(t, NULL, threads);
+        check(t, f, threads);
+    }
+
+    /* a filter set as an option applies too */
+    {
+        tdb_opt_value value = {.ptr = f};
+        assert(tdb_set_opt(t, TDB_OPT_EVENT_FILTER, value) == 0);
+        check(t, NULL, 4);
+        value.ptr = NULL;
+        assert(tdb_set_opt(t, TDB_OPT_EVENT_FILTER, value) == 0);
+    }
+
+    assert(tdb_count_items(t, NULL, 0, counts, NULL, 1) ==
+           TDB_ERR_UNKNOWN_FIELD);
+    assert(tdb_count_items(t, NULL, 3, counts, NULL, 1) ==
+           TDB_ERR_UNKNOWN_FIELD);
+    assert(tdb_count_items(t, NULL, 1, counts, NULL, 0) ==
+           TDB_ERR_INVALID_OPTION_VALUE);
+    assert(tdb_histogram_time(t, NULL, 0, 0, counts, 1, 1) ==
+           TDB_ERR_INVALID_OPTION_VALUE);
+
+    tdb_event_filter_free(f);
+    tdb_close(t);
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+decode the same trails with different event buffer sizes, so that
+batches end at every possible position in a trail. The low-cardinality
+database exercises the multi-symbol decoder, the high-cardinality one
+the single-symbol decoder.
+*/
+
+#define NUM_TRAILS 50
+#define MAX_EVENTS 200
+#define NUM_FIELDS 3
+
+static uint64_t timestamps[NUM_TRAILS][MAX_EVENTS];
+static uint64_t values[NUM_TRAILS][MAX_EVENTS][NUM_FIELDS];
+static uint64_t num_events[NUM_TRAILS];
+
+static const uint64_t BUFFER_SIZES[] = {1, 2, 3, 7, 1000};
+
+static void create(const char *root, uint32_t cardinality)
+{
+    const char *fields[] = {"a", "b", "c"};
+    char buf[NUM_FIELDS][32];
+    const char *vals[NUM_FIELDS] = {buf[0], buf[1], buf[2]};
+    uint64_t lengths[NUM_FIELDS];
+    uint8_t uuid[16];
+    uint64_t i, j, k;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, root, fields, NUM_FIELDS) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t tstamp = 1000;
+        memset(uuid, 0, sizeof(uuid));
+        memcpy(uuid, &i, sizeof(i));
+        num_events[i] = 1 + test_rand() % MAX_EVENTS;
+        for (j = 0; j < num_events[i]; j++){
+            tstamp += 1 + test_rand() % 3;
+            timestamps[i][j] = tstamp;
+            for (k = 0; k < NUM_FIELDS; k++){
+                /* the first field changes rarely, the others often */
+                if (k && test_rand() % 4)
+                    values[i][j][k] = 1 + test_rand() % cardinality;
+                else
+                    values[i][j][k] = j ? values[i][j - 1][k]: 1;
+                lengths[k] = (uint64_t)sprintf(buf[k], "%"PRIu64,
+                                               values[i][j][k]);
+            }
+            assert(tdb_cons_add(c, uuid, tstamp, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+static void check(const char *root)
+{
+    uint64_t b, i, j, k;
+
+    for (b = 0; b < sizeof(BUFFER_SIZES) / sizeof(BUFFER_SIZES[0]); b++){
+        tdb* t = tdb_init();
+        assert(tdb_open(t, root) == 0);
+        assert(tdb_set_opt(t,
+                           TDB_OPT_CURSOR_EVENT_BUFFER_SIZE,
+                           opt_val(BUFFER_SIZES[b])) == 0);
+        tdb_cursor *cursor = tdb_cursor_new(t);
+
+        for (i = 0; i < NUM_TRAILS; i++){
+            const tdb_event *event;
+            assert(tdb_get_trail(cursor, i) == 0);
+
+            for (j = 0; (event = tdb_cursor_next(cursor)); j++){
+                assert(j < num_events[i]);
+                assert(event->timestamp == timestamps[i][j]);
+                assert(event->num_items == NUM_FIELDS);
+                for (k = 0; k < NUM_FIELDS; k++){
+                    char buf[32];
+                    uint64_t len;
+                    const char *p = tdb_get_item_value(t,
+                                                       event->items[k],
+                                                       &len);
+                    assert(len < sizeof(buf));
+                    memcpy(buf, p, len);
+                    buf[len] = 0;
+                    assert(strtoull(buf, NULL, 10) == values[i][j][k]);
+                }
+            }
+            assert(j == num_events[i]);
+            assert(tdb_get_trail(cursor, i) == 0);
+            assert(tdb_get_trail_length(cursor) == num_events[i]);
+        }
+        tdb_cursor_free(cursor);
+        tdb_close(t);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    char root[1024];
+
+    test_srand(13);
+    snprintf(root, sizeof(root), "%s/low", getenv("TDB_TMP_DIR"));
+    create(root, 3);
+    check(root);
+
+    snprintf(root, sizeof(root), "%s/high", getenv("TDB_TMP_DIR"));
+    create(root, 1000000);
+    check(root);
+
+    return 0;
+}
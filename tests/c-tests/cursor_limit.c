@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+tdb_cursor_set_limit() and time-range filters stop decoding a trail
+early. Check that the right events are returned with different buffer
+sizes, with both the multi-symbol (low cardinality) and single-symbol
+(high cardinality) decoders.
+*/
+
+#define NUM_TRAILS 20
+#define MAX_EVENTS 200
+
+static uint64_t timestamps[NUM_TRAILS][MAX_EVENTS];
+static uint64_t num_events[NUM_TRAILS];
+
+static const uint64_t BUFFER_SIZES[] = {1, 1000};
+static const uint64_t LIMITS[] = {0, 1, 3, 50};
+
+static void create(const char *root, uint32_t cardinality)
+{
+    const char *fields[] = {"a", "b"};
+    char buf[2][32];
+    const char *vals[2] = {buf[0], buf[1]};
+    uint64_t lengths[2];
+    uint8_t uuid[16];
+    uint64_t i, j, k;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, root, fields, 2) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t tstamp = 1000;
+        memset(uuid, 0, sizeof(uuid));
+        memcpy(uuid, &i, sizeof(i));
+        num_events[i] = 1 + test_rand() % MAX_EVENTS;
+        for (j = 0; j < num_events[i]; j++){
+            tstamp += test_rand() % 3;
+            timestamps[i][j] = tstamp;
+            for (k = 0; k < 2; k++)
+                lengths[k] = (uint64_t)sprintf(buf[k], "%u",
+                                               test_rand() % cardinality);
+            assert(tdb_cons_add(c, uuid, tstamp, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+/* events must be in one of the time ranges [ranges[2k], ranges[2k + 1]) */
+static void check_trails(tdb_cursor *cursor,
+                         uint64_t limit,
+                         const uint64_t *ranges,
+                         uint64_t num_ranges)
+{
+    uint64_t i, j, k;
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        const tdb_event *event;
+        uint64_t n = 0;
+
+        assert(tdb_get_trail(cursor, i) == 0);
+        for (j = 0; j < num_events[i]; j++){
+            if (limit && n == limit)
+                break;
+            for (k = 0; k < num_ranges; k++)
+                if (timestamps[i][j] >= ranges[k * 2] &&
+                    timestamps[i][j] < ranges[k * 2 + 1])
+                    break;
+            if (k < num_ranges){
+                event = tdb_cursor_next(cursor);
+                assert(event);
+                assert(event->timestamp == timestamps[i][j]);
+                ++n;
+            }
+        }
+        assert(tdb_cursor_next(cursor) == NULL);
+        assert(tdb_get_trail(cursor, i) == 0);
+        assert(tdb_get_trail_length(cursor) == n);
+    }
+}
+
+static void check(const char *root)
+{
+    const uint64_t ranges[] = {0, UINT64_MAX,
+                               1050, 1100,
+                               1010, 1020,
+                               1150, 1200};
+    uint64_t b, l;
+
+    for (b = 0; b < sizeof(BUFFER_SIZES) / sizeof(BUFFER_SIZES[0]); b++){
+        tdb* t = tdb_init();
+        assert(tdb_open(t, root) == 0);
+        assert(tdb_set_opt(t,
+                           TDB_OPT_CURSOR_EVENT_BUFFER_SIZE,
+                           opt_val(BUFFER_SIZES[b])) == 0);
+
+        for (l = 0; l < sizeof(LIMITS) / sizeof(LIMITS[0]); l++){
+            tdb_cursor *cursor = tdb_cursor_new(t);
+            struct tdb_event_filter *f = tdb_event_filter_new();
+
+            tdb_cursor_set_limit(cursor, LIMITS[l]);
+            check_trails(cursor, LIMITS[l], ranges, 1);
+
+            /* a time range stops decoding at its end */
+            assert(tdb_event_filter_add_time_range(f, 1050, 1100) == 0);
+            assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+            check_trails(cursor, LIMITS[l], &ranges[2], 1);
+
+            /* the latest range counts */
+            assert(tdb_event_filter_add_time_range(f, 1010, 1020) == 0);
+            assert(tdb_event_filter_add_time_range(f, 1150, 1200) == 0);
+            assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+            check_trails(cursor, LIMITS[l], &ranges[2], 3);
+
+            tdb_cursor_free(cursor);
+            tdb_event_filter_free(f);
+        }
+        tdb_close(t);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    char root[1024];
+
+    test_srand(11);
+    snprintf(root, sizeof(root), "%s/low", getenv("TDB_TMP_DIR"));
+    create(root, 3);
+    check(root);
+
+    snprintf(root, sizeof(root), "%s/high", getenv("TDB_TMP_DIR"));
+    create(root, 1000000);
+    check(root);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+a cursor with several event filters returns the union of events matched
+by each filter, and tdb_cursor_event_matches() tells which filters
+matched, as if the filters were evaluated with separate cursors
+*/
+
+#define NUM_TRAILS 300
+#define NUM_FILTERS 70
+
+static int is_match(const uint64_t *mask, uint64_t i)
+{
+    return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+/*
+compare the events of the multi-filter cursor to the events of cursors
+with one filter each
+*/
+static void check_trail(tdb_cursor *cursor,
+                        tdb_cursor **single,
+                        uint64_t num_filters,
+                        uint64_t trail_id)
+{
+    const tdb_event *single_events[NUM_FILTERS];
+    const tdb_event *event;
+    const uint64_t *mask;
+    uint64_t i;
+
+    assert(tdb_get_trail(cursor, trail_id) == 0);
+    assert(tdb_cursor_event_matches(cursor) == NULL);
+    for (i = 0; i < num_filters; i++){
+        assert(tdb_get_trail(single[i], trail_id) == 0);
+        single_events[i] = tdb_cursor_next(single[i]);
+    }
+
+    while ((event = tdb_cursor_next(cursor))){
+        int any = 0;
+        mask = tdb_cursor_event_matches(cursor);
+        assert(mask);
+        for (i = 0; i < num_filters; i++){
+            /* timestamps are unique within a trail */
+            const tdb_event *e = single_events[i];
+            int expected = e && e->timestamp == event->timestamp;
+            assert(is_match(mask, i) == expected);
+            if (expected){
+                assert(e->items[0] == event->items[0]);
+                single_events[i] = tdb_cursor_next(single[i]);
+                any = 1;
+            }
+        }
+        assert(any);
+    }
+    for (i = 0; i < num_filters; i++)
+        assert(single_events[i] == NULL);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b"};
+    char buf[2][32];
+    const char *vals[2] = {buf[0], buf[1]};
+    uint64_t lengths[2];
+    uint64_t i, j, num_events;
+    struct tdb_event_filter *filters[NUM_FILTERS];
+    tdb_cursor *single[NUM_FILTERS];
+    tdb_cursor *cursor;
+
+    test_srand(43);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 2) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t n = 1 + test_rand() % 200;
+        uint64_t tstamp = i * 10;
+        memcpy(uuid, &i, sizeof(i));
+        for (j = 0; j < n; j++){
+            tstamp += 1 + test_rand() % 5;
+            lengths[0] = (uint64_t)sprintf(buf[0], "%u", test_rand() % 50);
+            lengths[1] = (uint64_t)sprintf(buf[1], "%u", test_rand() % 3);
+            assert(tdb_cons_add(c, uuid, tstamp, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+
+    /*
+    a mix of term filters, conjunctions with time ranges that cover only
+    some trails, and filters that match nothing
+    */
+    for (i = 0; i < NUM_FILTERS; i++){
+        char val[32];
+        uint64_t len = (uint64_t)sprintf(val, "%u", (unsigned int)(i % 50));
+        filters[i] = i % 10 == 9 ? tdb_event_filter_new_match_none():
+                                   tdb_event_filter_new();
+        if (i % 10 == 9)
+            continue;
+        assert(tdb_event_filter_add_term(filters[i],
+                                         tdb_get_item(t, 1, val, len),
+                                         0) == 0);
+        if (i % 3 == 0){
+            uint64_t start = test_rand() % (NUM_TRAILS * 10);
+            assert(tdb_event_filter_new_clause(filters[i]) == 0);
+            assert(tdb_event_filter_add_time_range(filters[i],
+                                                   start,
+                                                   start + 100) == 0);
+        }else if (i % 3 == 1)
+            assert(tdb_event_filter_add_term(filters[i],
+                                             tdb_get_item(t, 2, "1", 1),
+                                             0) == 0);
+    }
+    for (i = 0; i < NUM_FILTERS; i++){
+        single[i] = tdb_cursor_new(t);
+        assert(tdb_cursor_set_event_filter(single[i], filters[i]) == 0);
+    }
+
+    cursor = tdb_cursor_new(t);
+    assert(tdb_cursor_set_event_filters(
+        cursor,
+        (const struct tdb_event_filter**)filters,
+        NUM_FILTERS) == 0);
+    for (i = 0; i < NUM_TRAILS; i++)
+        check_trail(cursor, single, NUM_FILTERS, i);
+
+    /* fewer filters than bits in one word */
+    assert(tdb_cursor_set_event_filters(
+        cursor,
+        (const struct tdb_event_filter**)filters,
+        5) == 0);
+    for (i = 0; i < NUM_TRAILS; i++)
+        check_trail(cursor, single, 5, i);
+
+    /* a single filter replaces the filters */
+    assert(tdb_cursor_set_event_filter(cursor, filters[0]) == 0);
+    assert(tdb_get_trail(cursor, 0) == 0);
+    tdb_cursor_next(cursor);
+    assert(tdb_cursor_event_matches(cursor) == NULL);
+
+    /* no filters returns all events */
+    assert(tdb_cursor_set_event_filters(cursor, NULL, 0) == 0);
+    assert(tdb_get_trail(cursor, 0) == 0);
+    assert(tdb_trail_num_events(t, 0, &num_events) == 0);
+    assert(tdb_get_trail_length(cursor) == num_events);
+
+    tdb_cursor_free(cursor);
+
+    assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, opt_val(1)) == 0);
+    cursor = tdb_cursor_new(t);
+    assert(tdb_cursor_set_event_filters(
+        cursor,
+        (const struct tdb_event_filter**)filters,
+        NUM_FILTERS) == TDB_ERR_ONLY_DIFF_FILTER);
+    tdb_cursor_free(cursor);
+
+    for (i = 0; i < NUM_FILTERS; i++){
+        tdb_cursor_free(single[i]);
+        tdb_event_filter_free(filters[i]);
+    }
+    tdb_close(t);
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+compare columns returned by tdb_cursor_next_columns() against events
+returned by tdb_cursor_next(), with a small event buffer so that
+batches of columns span multiple decoded batches
+*/
+
+#define NUM_TRAILS 10
+#define NUM_EVENTS 100
+#define NUM_FIELDS 4
+#define MAX_BATCH 7
+
+static tdb_item *columns[NUM_FIELDS];
+static tdb_val *val_columns[NUM_FIELDS];
+static uint64_t timestamps[MAX_BATCH];
+
+static void check(tdb *t, const tdb_field *fields, uint64_t num_fields)
+{
+    tdb_cursor *rows = tdb_cursor_new(t);
+    tdb_cursor *cols = tdb_cursor_new(t);
+    tdb_cursor *vals = tdb_cursor_new(t);
+    tdb_opt_value edge_encoded;
+    uint64_t i, j, k, n, num_columns = NUM_FIELDS;
+
+    assert(tdb_get_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, &edge_encoded) == 0);
+
+    if (fields){
+        assert(tdb_cursor_set_fields(rows, fields, num_fields) == 0);
+        assert(tdb_cursor_set_fields(cols, fields, num_fields) == 0);
+        assert(tdb_cursor_set_fields(vals, fields, num_fields) == 0);
+        num_columns = num_fields;
+    }
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t total = 0;
+        assert(tdb_get_trail(rows, i) == 0);
+        assert(tdb_get_trail(cols, i) == 0);
+        assert(tdb_get_trail(vals, i) == 0);
+
+        /* vary the batch size */
+        while ((n = tdb_cursor_next_columns(cols,
+                                            timestamps,
+                                            columns,
+                                            1 + total % MAX_BATCH))){
+            assert(tdb_cursor_next_value_columns(vals,
+                                                 NULL,
+                                                 val_columns,
+                                                 n) == n);
+            for (j = 0; j < n; j++){
+                const tdb_event *event = tdb_cursor_next(rows);
+                assert(event);
+                assert(event->timestamp == timestamps[j]);
+                if (edge_encoded.value){
+                    /* unchanged fields are 0 */
+                    uint64_t num_items = 0;
+                    for (k = 0; k < num_columns; k++){
+                        tdb_field field = fields ? fields[k]: k + 1;
+                        uint64_t m;
+                        assert(val_columns[k][j] ==
+                               tdb_item_val(columns[k][j]));
+                        for (m = 0; m < event->num_items; m++)
+                            if (tdb_item_field(event->items[m]) == field)
+                                break;
+                        if (m < event->num_items){
+                            assert(event->items[m] == columns[k][j]);
+                            ++num_items;
+                        }else
+                            assert(columns[k][j] == 0);
+                    }
+                    assert(event->num_items == num_items);
+                }else{
+                    assert(event->num_items == num_columns);
+                    for (k = 0; k < num_columns; k++){
+                        assert(event->items[k] == columns[k][j]);
+                        assert(val_columns[k][j] ==
+                               tdb_item_val(event->items[k]));
+                    }
+                }
+            }
+            total += n;
+        }
+        assert(tdb_cursor_next(rows) == NULL);
+        assert(total == NUM_EVENTS);
+    }
+    tdb_cursor_free(rows);
+    tdb_cursor_free(cols);
+    tdb_cursor_free(vals);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b", "c", "d"};
+    const tdb_field projection[] = {3, 1};
+    char buf[NUM_FIELDS];
+    const char *ptrs[NUM_FIELDS];
+    uint64_t lengths[] = {1, 1, 1, 1};
+    uint64_t i, j, k;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, NUM_FIELDS) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uuid[0] = (uint8_t)i;
+        for (j = 0; j < NUM_EVENTS; j++){
+            for (k = 0; k < NUM_FIELDS; k++){
+                buf[k] = 'a' + (i + j / (k + 1)) % 5;
+                ptrs[k] = &buf[k];
+            }
+            assert(tdb_cons_add(c, uuid, j, ptrs, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    assert(tdb_set_opt(t,
+                       TDB_OPT_CURSOR_EVENT_BUFFER_SIZE,
+                       opt_val(3)) == 0);
+
+    for (k = 0; k < NUM_FIELDS; k++){
+        columns[k] = calloc(MAX_BATCH, sizeof(tdb_item));
+        val_columns[k] = calloc(MAX_BATCH, sizeof(tdb_val));
+        assert(columns[k] && val_columns[k]);
+    }
+
+    check(t, NULL, 0);
+    check(t, projection, 2);
+
+    assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, TDB_TRUE) == 0);
+    check(t, NULL, 0);
+    check(t, projection, 2);
+
+    tdb_close(t);
+    return 0;
+}
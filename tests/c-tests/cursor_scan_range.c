@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+a range scan returns the same events as tdb_get_trail() for every trail
+of the range
+*/
+
+#define NUM_TRAILS 500
+
+static void compare(tdb_cursor *a, tdb_cursor *b)
+{
+    const tdb_event *e1, *e2;
+    uint64_t k;
+
+    while ((e1 = tdb_cursor_next(a))){
+        e2 = tdb_cursor_next(b);
+        assert(e2);
+        assert(e1->timestamp == e2->timestamp);
+        assert(e1->num_items == e2->num_items);
+        for (k = 0; k < e1->num_items; k++)
+            assert(e1->items[k] == e2->items[k]);
+    }
+    assert(tdb_cursor_next(b) == NULL);
+}
+
+static void check_range(tdb *t,
+                        const struct tdb_event_filter *f,
+                        uint64_t start,
+                        uint64_t end)
+{
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    tdb_cursor *reference = tdb_cursor_new(t);
+    uint64_t trail_id, expected = start;
+    tdb_error err;
+
+    if (f){
+        assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+        assert(tdb_cursor_set_event_filter(reference, f) == 0);
+    }
+
+    assert(tdb_cursor_scan_range(cursor, start, end) == 0);
+    while (!(err = tdb_cursor_next_trail(cursor, &trail_id))){
+        assert(trail_id == expected++);
+        assert(tdb_get_trail(reference, trail_id) == 0);
+        compare(cursor, reference);
+    }
+    assert(err == TDB_ERR_INVALID_TRAIL_ID);
+    assert(expected == end);
+    assert(tdb_cursor_next_trail(cursor, &trail_id) ==
+           TDB_ERR_INVALID_TRAIL_ID);
+
+    tdb_cursor_free(cursor);
+    tdb_cursor_free(reference);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a"};
+    char buf[32];
+    const char *vals[] = {buf};
+    uint64_t lengths[1];
+    uint64_t i, j;
+    struct tdb_event_filter *f = tdb_event_filter_new();
+    tdb_cursor *cursor;
+
+    test_srand(41);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 1) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t n = 1 + test_rand() % 100;
+        memcpy(uuid, &i, sizeof(i));
+        for (j = 0; j < n; j++){
+            lengths[0] = (uint64_t)sprintf(buf, "%u", test_rand() % 10);
+            assert(tdb_cons_add(c, uuid, j, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    assert(tdb_event_filter_add_term(f, tdb_get_item(t, 1, "3", 1), 0) == 0);
+
+    check_range(t, NULL, 0, NUM_TRAILS);
+    check_range(t, NULL, 10, 20);
+    check_range(t, NULL, 100, 100);
+    check_range(t, NULL, NUM_TRAILS - 1, NUM_TRAILS);
+    check_range(t, f, 0, NUM_TRAILS);
+
+    cursor = tdb_cursor_new(t);
+    assert(tdb_cursor_scan_range(cursor, 1, 0) == TDB_ERR_INVALID_TRAIL_ID);
+    assert(tdb_cursor_scan_range(cursor, 0, NUM_TRAILS + 1) ==
+           TDB_ERR_INVALID_TRAIL_ID);
+    tdb_cursor_free(cursor);
+
+    tdb_event_filter_free(f);
+    tdb_close(t);
+    return 0;
+}
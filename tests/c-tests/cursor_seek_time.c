@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+tdb_cursor_seek_time() starts decoding long trails from a checkpoint in
+trails.index. Check that the decoder state is restored correctly, with
+and without the index, with both the multi-symbol (low cardinality) and
+single-symbol (high cardinality) decoders.
+*/
+
+#define NUM_TRAILS 5
+#define NUM_FIELDS 3
+#define MAX_EVENTS 20000
+#define NUM_SEEKS 20
+
+static uint64_t timestamps[NUM_TRAILS][MAX_EVENTS];
+static tdb_item items[NUM_TRAILS][MAX_EVENTS][NUM_FIELDS];
+static uint64_t num_events[NUM_TRAILS];
+
+static void create(const char *root, uint32_t cardinality)
+{
+    const char *fields[] = {"a", "b", "c"};
+    char buf[NUM_FIELDS][32];
+    const char *vals[NUM_FIELDS] = {buf[0], buf[1], buf[2]};
+    uint64_t lengths[NUM_FIELDS];
+    uint8_t uuid[16];
+    uint64_t i, j, k;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, root, fields, NUM_FIELDS) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t tstamp = 1000;
+        memset(uuid, 0, sizeof(uuid));
+        memcpy(uuid, &i, sizeof(i));
+        num_events[i] = i % 2 ? MAX_EVENTS - test_rand() % 5000:
+                                1 + test_rand() % 2000;
+        for (j = 0; j < num_events[i]; j++){
+            tstamp += test_rand() % 3;
+            for (k = 0; k < NUM_FIELDS; k++){
+                /* the last field changes rarely */
+                if (k < NUM_FIELDS - 1 || j == 0 || test_rand() % 100 == 0)
+                    lengths[k] = (uint64_t)sprintf(buf[k], "%u",
+                                                   test_rand() % cardinality);
+            }
+            assert(tdb_cons_add(c, uuid, tstamp, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+static void read_reference(tdb *t)
+{
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    uint64_t i, j, k;
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        const tdb_event *event;
+        assert(tdb_get_trail(cursor, i) == 0);
+        for (j = 0; (event = tdb_cursor_next(cursor)); j++){
+            timestamps[i][j] = event->timestamp;
+            for (k = 0; k < NUM_FIELDS; k++)
+                items[i][j][k] = event->items[k];
+        }
+        assert(j == num_events[i]);
+    }
+    tdb_cursor_free(cursor);
+}
+
+static void check_seek(tdb_cursor *cursor,
+                       uint64_t trail_id,
+                       uint64_t timestamp,
+                       uint64_t limit,
+                       int edge_encoded)
+{
+    const tdb_event *event;
+    uint64_t j, k, n = 0;
+
+    tdb_cursor_set_limit(cursor, limit);
+    assert(tdb_get_trail(cursor, trail_id) == 0);
+    /* consume some events first, seeking restarts the trail */
+    assert(tdb_cursor_next(cursor));
+    assert(tdb_cursor_seek_time(cursor, timestamp) == 0);
+
+    for (j = 0; j < num_events[trail_id]; j++){
+        if (timestamps[trail_id][j] < timestamp)
+            continue;
+        if (limit && n == limit)
+            break;
+        event = tdb_cursor_next(cursor);
+        assert(event);
+        assert(event->timestamp == timestamps[trail_id][j]);
+        if (!edge_encoded){
+            assert(event->num_items == NUM_FIELDS);
+            for (k = 0; k < NUM_FIELDS; k++)
+                assert(event->items[k] == items[trail_id][j][k]);
+        }
+        ++n;
+    }
+    assert(tdb_cursor_next(cursor) == NULL);
+}
+
+static void check(const char *root)
+{
+    uint64_t i, j, edge;
+    tdb* t = tdb_init();
+
+    assert(tdb_open(t, root) == 0);
+    read_reference(t);
+
+    for (edge = 0; edge < 2; edge++){
+        tdb_cursor *cursor;
+        assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, opt_val(edge)) == 0);
+        cursor = tdb_cursor_new(t);
+        /* no trail has been selected */
+        assert(tdb_cursor_seek_time(cursor, 0) == TDB_ERR_INVALID_TRAIL_ID);
+
+        for (i = 0; i < NUM_TRAILS; i++){
+            uint64_t last = timestamps[i][num_events[i] - 1];
+
+            check_seek(cursor, i, 0, 0, edge);
+            check_seek(cursor, i, last, 0, edge);
+            check_seek(cursor, i, last + 1, 0, edge);
+            for (j = 0; j < NUM_SEEKS; j++){
+                uint64_t ts = 1000 + test_rand() % (last - 999);
+                check_seek(cursor, i, ts, 0, edge);
+                check_seek(cursor, i, ts, 1 + test_rand() % 2000, edge);
+            }
+        }
+        tdb_cursor_free(cursor);
+    }
+    tdb_close(t);
+}
+
+int main(int argc, char** argv)
+{
+    char root[1024];
+    char path[1100];
+
+    test_srand(31);
+    snprintf(root, sizeof(root), "%s/low", getenv("TDB_TMP_DIR"));
+    create(root, 3);
+    check(root);
+
+    snprintf(root, sizeof(root), "%s/high", getenv("TDB_TMP_DIR"));
+    create(root, 1000000);
+    check(root);
+
+    /* older tdbs don't have trails.index (not removable in packages) */
+    snprintf(path, sizeof(path), "%s/trails.index", root);
+    unlink(path);
+    check(root);
+
+    return 0;
+}
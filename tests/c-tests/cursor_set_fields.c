@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+#define NUM_EVENTS 1000
+#define NUM_FIELDS 5
+
+static char values[NUM_EVENTS][NUM_FIELDS];
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b", "c", "d", "e"};
+    const char *ptrs[NUM_FIELDS];
+    uint64_t lengths[] = {1, 1, 1, 1, 1};
+    const tdb_field projection[] = {4, 2};
+    const tdb_field invalid[] = {1, 6};
+    const tdb_event *event;
+    uint64_t i, j;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, NUM_FIELDS) == 0);
+    for (i = 0; i < NUM_EVENTS; i++){
+        for (j = 0; j < NUM_FIELDS; j++){
+            /* field j changes every j + 1 events */
+            values[i][j] = 'a' + (i / (j + 1)) % 20;
+            ptrs[j] = &values[i][j];
+        }
+        assert(tdb_cons_add(c, uuid, i, ptrs, lengths) == 0);
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    tdb_cursor *cursor = tdb_cursor_new(t);
+
+    assert(tdb_cursor_set_fields(cursor, invalid, 2) == TDB_ERR_UNKNOWN_FIELD);
+    assert(tdb_cursor_set_fields(cursor, projection, 2) == 0);
+    /* changing fields resets the cursor */
+    assert(tdb_cursor_next(cursor) == NULL);
+
+    assert(tdb_get_trail(cursor, 0) == 0);
+    for (i = 0; (event = tdb_cursor_next(cursor)); i++){
+        assert(event->timestamp == i);
+        assert(event->num_items == 2);
+        for (j = 0; j < 2; j++){
+            tdb_field field = projection[j];
+            assert(event->items[j] ==
+                   tdb_get_item(t, field, &values[i][field - 1], 1));
+        }
+    }
+    assert(i == NUM_EVENTS);
+
+    /* only the timestamps */
+    assert(tdb_cursor_set_fields(cursor, NULL, 0) == 0);
+    assert(tdb_get_trail(cursor, 0) == 0);
+    for (i = 0; (event = tdb_cursor_next(cursor)); i++){
+        assert(event->timestamp == i);
+        assert(event->num_items == 0);
+    }
+    assert(i == NUM_EVENTS);
+
+    /* back to all fields */
+    assert(tdb_cursor_unset_fields(cursor) == 0);
+    assert(tdb_get_trail(cursor, 0) == 0);
+    for (i = 0; (event = tdb_cursor_next(cursor)); i++)
+        assert(event->num_items == NUM_FIELDS);
+    assert(i == NUM_EVENTS);
+    tdb_cursor_free(cursor);
+
+    /* edge encoding returns only the changed items of the given fields */
+    assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, TDB_TRUE) == 0);
+    cursor = tdb_cursor_new(t);
+    assert(tdb_cursor_set_fields(cursor, projection, 2) == 0);
+    assert(tdb_get_trail(cursor, 0) == 0);
+    for (i = 0; (event = tdb_cursor_next(cursor)); i++){
+        uint64_t n = 0;
+        for (j = 0; j < 2; j++){
+            tdb_field field = projection[j];
+            if (i == 0 || values[i][field - 1] != values[i - 1][field - 1])
+                ++n;
+        }
+        assert(event->num_items == n);
+        for (j = 0; j < event->num_items; j++){
+            tdb_field field = tdb_item_field(event->items[j]);
+            assert(field == 2 || field == 4);
+            assert(event->items[j] ==
+                   tdb_get_item(t, field, &values[i][field - 1], 1));
+        }
+    }
+    assert(i == NUM_EVENTS);
+
+    tdb_cursor_free(cursor);
+    tdb_close(t);
+    return 0;
+}
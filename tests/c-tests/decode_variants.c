@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+the decoder is specialized for tdbs with and without bigrams, with
+narrow and wide field ids, and for edge encoding. Every variant must
+return the events that were added.
+*/
+
+#define NUM_TRAILS 20
+#define MAX_EVENTS 500
+#define MAX_FIELDS 200
+
+static uint32_t values[NUM_TRAILS][MAX_EVENTS][MAX_FIELDS];
+static uint64_t num_events[NUM_TRAILS];
+
+static void check(const char *root, uint64_t num_fields, int no_bigrams)
+{
+    static char names[MAX_FIELDS][16];
+    static char buf[MAX_FIELDS][16];
+    const char *fields[MAX_FIELDS];
+    const char *vals[MAX_FIELDS];
+    uint64_t lengths[MAX_FIELDS];
+    uint8_t uuid[16];
+    uint64_t i, j, k, edge;
+    tdb_cons *c = tdb_cons_init();
+    tdb *t;
+
+    for (k = 0; k < num_fields; k++){
+        sprintf(names[k], "f%u", (unsigned int)k);
+        fields[k] = names[k];
+        vals[k] = buf[k];
+    }
+    test_cons_settings(c);
+    assert(tdb_cons_set_opt(c,
+                            TDB_OPT_CONS_NO_BIGRAMS,
+                            opt_val(no_bigrams)) == 0);
+    assert(tdb_cons_open(c, root, fields, num_fields) == 0);
+    memset(uuid, 0, sizeof(uuid));
+    for (i = 0; i < NUM_TRAILS; i++){
+        memcpy(uuid, &i, sizeof(i));
+        num_events[i] = 1 + test_rand() % MAX_EVENTS;
+        for (j = 0; j < num_events[i]; j++){
+            for (k = 0; k < num_fields; k++){
+                /* mostly repeating values, so that edge encoding pays off */
+                if (j == 0 || test_rand() % 4 == 0)
+                    values[i][j][k] = test_rand() % (k % 2 ? 5: 2000);
+                else
+                    values[i][j][k] = values[i][j - 1][k];
+                lengths[k] = (uint64_t)sprintf(buf[k], "%u", values[i][j][k]);
+            }
+            assert(tdb_cons_add(c, uuid, j * 3, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    t = tdb_init();
+    assert(tdb_open(t, root) == 0);
+    for (edge = 0; edge < 2; edge++){
+        tdb_cursor *cursor;
+        assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, opt_val(edge)) == 0);
+        cursor = tdb_cursor_new(t);
+
+        for (i = 0; i < NUM_TRAILS; i++){
+            uint32_t current[MAX_FIELDS];
+            const tdb_event *event;
+
+            assert(tdb_get_trail(cursor, i) == 0);
+            for (j = 0; (event = tdb_cursor_next(cursor)); j++){
+                assert(event->timestamp == j * 3);
+                if (!edge)
+                    assert(event->num_items == num_fields);
+                for (k = 0; k < event->num_items; k++){
+                    uint64_t len, n;
+                    tdb_field field = tdb_item_field(event->items[k]);
+                    const char *val = tdb_get_item_value(t,
+                                                         event->items[k],
+                                                         &len);
+                    assert(field > 0 && field <= num_fields);
+                    /* values are not zero-terminated */
+                    current[field - 1] = 0;
+                    for (n = 0; n < len; n++)
+                        current[field - 1] = current[field - 1] * 10 +
+                                             (uint32_t)(val[n] - '0');
+                }
+                for (k = 0; k < num_fields; k++)
+                    assert(current[k] == values[i][j][k]);
+            }
+            assert(j == num_events[i]);
+        }
+        tdb_cursor_free(cursor);
+    }
+    tdb_close(t);
+}
+
+int main(int argc, char** argv)
+{
+    char root[1024];
+    uint64_t no_bigrams;
+
+    test_srand(71);
+    for (no_bigrams = 0; no_bigrams < 2; no_bigrams++){
+        snprintf(root, sizeof(root), "%s/narrow%u", getenv("TDB_TMP_DIR"),
+                 (unsigned int)no_bigrams);
+        check(root, 5, (int)no_bigrams);
+
+        snprintf(root, sizeof(root), "%s/wide%u", getenv("TDB_TMP_DIR"),
+                 (unsigned int)no_bigrams);
+        check(root, MAX_FIELDS, (int)no_bigrams);
+    }
+    return 0;
+}
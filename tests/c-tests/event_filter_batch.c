@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+wide filters are evaluated over blocks of events at once. Compare them
+against a straightforward evaluation with long trails, projections,
+limits and small event buffers.
+*/
+
+#define NUM_TRAILS 6
+#define NUM_EVENTS 3000
+#define NUM_FIELDS 4
+#define CARDINALITY 40
+#define NUM_FILTERS 30
+
+struct term{
+    int is_time_range;
+    int is_negative;
+    tdb_item item;
+    uint64_t start;
+    uint64_t end;
+};
+
+static struct term terms[200];
+static uint64_t clause_len[10];
+static uint64_t num_clauses;
+
+/* unfiltered events */
+static tdb_item events[NUM_TRAILS][NUM_EVENTS][NUM_FIELDS + 2];
+
+static int reference_match(const tdb_event *event)
+{
+    uint64_t i, j, k = 0;
+    for (i = 0; i < num_clauses; i++){
+        int match = 0;
+        for (j = 0; j < clause_len[i]; j++){
+            const struct term *t = &terms[k + j];
+            if (t->is_time_range)
+                match |= t->start <= event->timestamp &&
+                         event->timestamp < t->end;
+            else
+                match |= (event->items[tdb_item_field(t->item) - 1] ==
+                          t->item) != t->is_negative;
+        }
+        if (!match)
+            return 0;
+        k += clause_len[i];
+    }
+    return 1;
+}
+
+/*
+clauses of many terms that are unlikely to match, so that the filter
+is expensive to evaluate event by event. Clauses with many terms of the
+same field become set lookups.
+*/
+static struct tdb_event_filter *wide_filter(const tdb *db)
+{
+    struct tdb_event_filter *f = tdb_event_filter_new();
+    uint64_t i, j, k = 0;
+
+    num_clauses = 1 + test_rand() % 3;
+    for (i = 0; i < num_clauses; i++){
+        const tdb_field same_field = 1 + test_rand() % NUM_FIELDS;
+        if (i)
+            assert(tdb_event_filter_new_clause(f) == 0);
+        clause_len[i] = 10 + test_rand() % 30;
+        for (j = 0; j < clause_len[i]; j++, k++){
+            struct term *t = &terms[k];
+            memset(t, 0, sizeof(struct term));
+            if (test_rand() % 20 == 0){
+                t->is_time_range = 1;
+                t->start = test_rand() % NUM_EVENTS;
+                t->end = t->start + 1 + test_rand() % 200;
+                assert(tdb_event_filter_add_time_range(f,
+                                                       t->start,
+                                                       t->end) == 0);
+            }else{
+                char val[16];
+                tdb_field field = test_rand() % 2 ?
+                                  same_field: 1 + test_rand() % NUM_FIELDS;
+                uint64_t len = (uint64_t)sprintf(val, "%u",
+                                                 test_rand() % CARDINALITY);
+                t->item = tdb_get_item(db, field, val, len);
+                t->is_negative = test_rand() % 30 == 0;
+                assert(t->item);
+                assert(tdb_event_filter_add_term(f,
+                                                 t->item,
+                                                 t->is_negative) == 0);
+            }
+        }
+    }
+    return f;
+}
+
+static void check(tdb_cursor *filtered,
+                  const tdb_field *fields,
+                  uint64_t num_fields,
+                  uint64_t limit)
+{
+    uint64_t i, j, k;
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t n = 0;
+        assert(tdb_get_trail(filtered, i) == 0);
+        for (j = 0; j < NUM_EVENTS && (!limit || n < limit); j++){
+            const tdb_event *event = (const tdb_event*)events[i][j];
+            if (reference_match(event)){
+                const tdb_event *match = tdb_cursor_next(filtered);
+                assert(match);
+                assert(match->timestamp == event->timestamp);
+                assert(match->num_items == num_fields);
+                for (k = 0; k < num_fields; k++)
+                    assert(match->items[k] ==
+                           event->items[fields[k] - 1]);
+                ++n;
+            }
+        }
+        assert(tdb_cursor_next(filtered) == NULL);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b", "c", "d"};
+    const tdb_field all_fields[] = {1, 2, 3, 4};
+    const tdb_field some_fields[] = {3, 1};
+    const uint64_t buffer_sizes[] = {1, 100, 1000};
+    char vals[NUM_FIELDS][16];
+    const char *ptrs[NUM_FIELDS];
+    uint64_t lengths[NUM_FIELDS];
+    tdb_cursor *cursor;
+    uint64_t i, j, k, limit;
+
+    test_srand(53);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, NUM_FIELDS) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uuid[0] = (uint8_t)i;
+        for (j = 0; j < NUM_EVENTS; j++){
+            for (k = 0; k < NUM_FIELDS; k++){
+                lengths[k] = (uint64_t)sprintf(vals[k], "%u",
+                                               test_rand() % CARDINALITY);
+                ptrs[k] = vals[k];
+            }
+            assert(tdb_cons_add(c, uuid, j, ptrs, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    cursor = tdb_cursor_new(t);
+    for (i = 0; i < NUM_TRAILS; i++){
+        const tdb_event *event;
+        assert(tdb_get_trail(cursor, i) == 0);
+        for (j = 0; (event = tdb_cursor_next(cursor)); j++)
+            memcpy(events[i][j], event, sizeof(events[i][j]));
+        assert(j == NUM_EVENTS);
+    }
+    tdb_cursor_free(cursor);
+
+    for (k = 0; k < sizeof(buffer_sizes) / sizeof(buffer_sizes[0]); k++){
+        assert(tdb_set_opt(t,
+                           TDB_OPT_CURSOR_EVENT_BUFFER_SIZE,
+                           opt_val(buffer_sizes[k])) == 0);
+        cursor = tdb_cursor_new(t);
+
+        for (i = 0; i < NUM_FILTERS; i++){
+            struct tdb_event_filter *f = wide_filter(t);
+            assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+
+            check(cursor, all_fields, NUM_FIELDS, 0);
+
+            limit = 1 + test_rand() % 300;
+            tdb_cursor_set_limit(cursor, limit);
+            check(cursor, all_fields, NUM_FIELDS, limit);
+            tdb_cursor_set_limit(cursor, 0);
+
+            assert(tdb_cursor_set_fields(cursor, some_fields, 2) == 0);
+            check(cursor, some_fields, 2, 0);
+            assert(tdb_cursor_unset_fields(cursor) == 0);
+
+            tdb_cursor_unset_event_filter(cursor);
+            tdb_event_filter_free(f);
+        }
+        tdb_cursor_free(cursor);
+    }
+
+    tdb_close(t);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+large clauses are evaluated as bitmaps or hash sets of values,
+depending on the size of the clause relative to the field's lexicon
+*/
+
+#define NUM_EVENTS 100000
+#define NUM_VALUES 20000
+
+static uint8_t selected[NUM_VALUES];
+static uint32_t event_values[NUM_EVENTS];
+
+static void check(tdb *t,
+                  uint64_t num_terms,
+                  int with_negation,
+                  int with_time_range)
+{
+    struct tdb_event_filter *f = tdb_event_filter_new();
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    const tdb_event *event;
+    tdb_field field;
+    uint64_t i, num_matches = 0, expected = 0;
+    uint32_t negated = 0;
+
+    assert(tdb_get_field(t, "value", &field) == 0);
+    memset(selected, 0, sizeof(selected));
+
+    for (i = 0; i < num_terms; i++){
+        uint32_t val = test_rand() % NUM_VALUES;
+        tdb_item item = tdb_get_item(t, field, (const char*)&val, 4);
+        selected[val] = 1;
+        assert(item);
+        assert(tdb_event_filter_add_term(f, item, 0) == 0);
+        /* duplicates and unknown values */
+        if (i % 10 == 0){
+            assert(tdb_event_filter_add_term(f, item, 0) == 0);
+            assert(tdb_event_filter_add_term(f,
+                                             tdb_make_item(field, 1 << 30),
+                                             0) == 0);
+        }
+    }
+    if (with_negation){
+        /* a negated term in the same clause matches everything else */
+        while (selected[negated])
+            ++negated;
+        assert(tdb_event_filter_add_term(f,
+                                         tdb_get_item(t,
+                                                      field,
+                                                      (const char*)&negated,
+                                                      4),
+                                         1) == 0);
+    }
+    if (with_time_range)
+        assert(tdb_event_filter_add_time_range(f, 0, 1000) == 0);
+
+    for (i = 0; i < NUM_EVENTS; i++){
+        if (selected[event_values[i]] ||
+            (with_negation && event_values[i] != negated) ||
+            (with_time_range && i < 1000))
+            ++expected;
+    }
+
+    assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+    assert(tdb_get_trail(cursor, 0) == 0);
+    while ((event = tdb_cursor_next(cursor))){
+        uint32_t val;
+        uint64_t len;
+        memcpy(&val, tdb_get_item_value(t, event->items[0], &len), 4);
+        assert(len == 4);
+        assert(event_values[event->timestamp] == val);
+        assert(selected[val] ||
+               (with_negation && val != negated) ||
+               (with_time_range && event->timestamp < 1000));
+        ++num_matches;
+    }
+    assert(num_matches == expected);
+
+    tdb_cursor_free(cursor);
+    tdb_event_filter_free(f);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"value"};
+    uint64_t lengths[] = {4};
+    uint64_t i;
+
+    test_srand(17);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 1) == 0);
+    for (i = 0; i < NUM_VALUES; i++){
+        /* make sure that every value exists */
+        const char *ptr = (const char*)&i;
+        event_values[i] = (uint32_t)i;
+        assert(tdb_cons_add(c, uuid, i, &ptr, lengths) == 0);
+    }
+    for (; i < NUM_EVENTS; i++){
+        const char *ptr = (const char*)&event_values[i];
+        event_values[i] = test_rand() % NUM_VALUES;
+        assert(tdb_cons_add(c, uuid, i, &ptr, lengths) == 0);
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+
+    /* linear */
+    check(t, 10, 0, 0);
+    /* hash set */
+    check(t, 20, 0, 0);
+    check(t, 20, 0, 1);
+    /* bitmap */
+    check(t, 500, 0, 0);
+    check(t, 5000, 0, 0);
+    check(t, 5000, 0, 1);
+    check(t, 5000, 1, 0);
+
+    tdb_close(t);
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+compare filtered cursors against a straightforward evaluation of
+random CNF filters, including negated terms, time ranges, duplicate
+terms, unknown values and items of field 0
+*/
+
+#define NUM_TRAILS 20
+#define NUM_EVENTS 50
+#define NUM_FIELDS 3
+#define CARDINALITY 4
+#define NUM_FILTERS 500
+
+/* terms of the filter being tested */
+struct term{
+    int is_time_range;
+    int is_negative;
+    tdb_item item;
+    uint64_t start;
+    uint64_t end;
+};
+
+static struct term terms[100];
+static uint64_t clause_len[20];
+static uint64_t num_clauses;
+
+/* unfiltered events */
+static tdb_item events[NUM_TRAILS][NUM_EVENTS][NUM_FIELDS + 2];
+
+static int reference_match(const tdb_event *event)
+{
+    uint64_t i, j, k = 0;
+    for (i = 0; i < num_clauses; i++){
+        int match = 0;
+        for (j = 0; j < clause_len[i]; j++){
+            const struct term *t = &terms[k + j];
+            if (t->is_time_range)
+                match |= t->start <= event->timestamp &&
+                         event->timestamp < t->end;
+            else{
+                tdb_field field = tdb_item_field(t->item);
+                if (field)
+                    match |= (event->items[field - 1] == t->item) !=
+                             t->is_negative;
+                else
+                    match |= t->is_negative;
+            }
+        }
+        if (!match)
+            return 0;
+        k += clause_len[i];
+    }
+    return 1;
+}
+
+static struct tdb_event_filter *random_filter(void)
+{
+    struct tdb_event_filter *f = tdb_event_filter_new();
+    uint64_t i, j, k = 0;
+
+    num_clauses = 1 + test_rand() % 5;
+    for (i = 0; i < num_clauses; i++){
+        if (i)
+            assert(tdb_event_filter_new_clause(f) == 0);
+        clause_len[i] = 1 + test_rand() % 5;
+        for (j = 0; j < clause_len[i]; j++, k++){
+            struct term *t = &terms[k];
+            memset(t, 0, sizeof(struct term));
+            if (j && test_rand() % 8 == 0){
+                /* duplicate term */
+                *t = terms[k - 1];
+            }else if (test_rand() % 6 == 0){
+                t->is_time_range = 1;
+                t->start = test_rand() % (NUM_EVENTS + 10);
+                t->end = t->start + 1 + test_rand() % 20;
+            }else{
+                /* include field 0 and values not in the lexicon */
+                tdb_field field = test_rand() % (NUM_FIELDS + 1);
+                tdb_val val = test_rand() % (CARDINALITY + 2);
+                t->is_negative = test_rand() % 4 == 0;
+                t->item = tdb_make_item(field, val);
+            }
+            if (t->is_time_range)
+                assert(tdb_event_filter_add_time_range(f,
+                                                       t->start,
+                                                       t->end) == 0);
+            else
+                assert(tdb_event_filter_add_term(f,
+                                                 t->item,
+                                                 t->is_negative) == 0);
+        }
+    }
+    return f;
+}
+
+static void check(tdb_cursor *filtered)
+{
+    uint64_t i, j;
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        assert(tdb_get_trail(filtered, i) == 0);
+        for (j = 0; j < NUM_EVENTS; j++){
+            const tdb_event *event = (const tdb_event*)events[i][j];
+            if (reference_match(event)){
+                const tdb_event *match = tdb_cursor_next(filtered);
+                assert(match);
+                assert(match->timestamp == event->timestamp);
+                assert(!memcmp(match->items,
+                               event->items,
+                               NUM_FIELDS * sizeof(tdb_item)));
+            }
+        }
+        assert(tdb_cursor_next(filtered) == NULL);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b", "c"};
+    const char *values[] = {"", "1", "2", "3"};
+    const char *ptrs[NUM_FIELDS];
+    uint64_t lengths[NUM_FIELDS];
+    uint64_t i, j, k;
+
+    test_srand(5);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, NUM_FIELDS) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uuid[0] = (uint8_t)i;
+        for (j = 0; j < NUM_EVENTS; j++){
+            for (k = 0; k < NUM_FIELDS; k++){
+                uint32_t v = test_rand() % CARDINALITY;
+                ptrs[k] = values[v];
+                lengths[k] = strlen(values[v]);
+            }
+            assert(tdb_cons_add(c, uuid, j, ptrs, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    tdb_cursor *cursor = tdb_cursor_new(t);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        const tdb_event *event;
+        assert(tdb_get_trail(cursor, i) == 0);
+        for (j = 0; (event = tdb_cursor_next(cursor)); j++)
+            memcpy(events[i][j], event, sizeof(events[i][j]));
+        assert(j == NUM_EVENTS);
+    }
+
+    for (i = 0; i < NUM_FILTERS; i++){
+        struct tdb_event_filter *f = random_filter();
+
+        if (i & 1){
+            assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+            check(cursor);
+            tdb_cursor_unset_event_filter(cursor);
+        }else{
+            /* db-level filters are replaced without touching the cursor */
+            tdb_opt_value value = {.ptr = f};
+            assert(tdb_set_opt(t, TDB_OPT_EVENT_FILTER, value) == 0);
+            check(cursor);
+            value.ptr = NULL;
+            assert(tdb_set_opt(t, TDB_OPT_EVENT_FILTER, value) == 0);
+        }
+        tdb_event_filter_free(f);
+    }
+
+    /* filters may be extended after they have been set */
+    struct tdb_event_filter *f = random_filter();
+    assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+    check(cursor);
+    assert(tdb_event_filter_new_clause(f) == 0);
+    assert(tdb_event_filter_add_time_range(f, 10, 20) == 0);
+    for (i = 0, j = 0; i < num_clauses; i++)
+        j += clause_len[i];
+    memset(&terms[j], 0, sizeof(struct term));
+    terms[j].is_time_range = 1;
+    terms[j].start = 10;
+    terms[j].end = 20;
+    clause_len[num_clauses++] = 1;
+    check(cursor);
+
+    tdb_event_filter_free(f);
+    tdb_cursor_free(cursor);
+    tdb_close(t);
+    return 0;
+}
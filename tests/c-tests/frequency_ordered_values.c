@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+TDB_OPT_CONS_FREQUENCY_ORDERED_VALUES gives the smallest IDs to the most
+common values without changing the contents of the tdb
+*/
+
+#define NUM_EVENTS 3000
+#define NUM_FIELDS 3
+
+static void create(const char *root,
+                   int frequency_ordered,
+                   int sorted,
+                   uint64_t events_per_trail)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"skewed", "uniform", "empty"};
+    char skewed[16], uniform[16];
+    const char *vals[] = {skewed, uniform, ""};
+    uint64_t lengths[] = {0, 0, 0};
+    uint64_t i;
+
+    test_srand(5);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_set_opt(c,
+                            TDB_OPT_CONS_FREQUENCY_ORDERED_VALUES,
+                            opt_val((uint64_t)frequency_ordered)) == 0);
+    assert(tdb_cons_set_opt(c,
+                            TDB_OPT_CONS_SORTED_LEXICONS,
+                            opt_val((uint64_t)sorted)) == 0);
+    assert(tdb_cons_open(c, root, fields, NUM_FIELDS) == 0);
+    for (i = 0; i < NUM_EVENTS; i++){
+        /* the number of trailing zeros makes small numbers common */
+        uint32_t r = test_rand() | (1U << 15);
+        memcpy(uuid, &(uint64_t){i / events_per_trail}, 8);
+        lengths[0] = (uint64_t)sprintf(skewed, "s%d", __builtin_ctz(r));
+        lengths[1] = (uint64_t)sprintf(uniform, "u%u", test_rand() % 50);
+        assert(tdb_cons_add(c, uuid, i, vals, lengths) == 0);
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+static tdb *open_tdb(const char *root)
+{
+    tdb *t = tdb_init();
+    assert(tdb_open(t, root) == 0);
+    return t;
+}
+
+/* t and expected have the same trails with the same values */
+static void check_contents(const tdb *t, const tdb *expected)
+{
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    tdb_cursor *expected_cursor = tdb_cursor_new(expected);
+    uint64_t trail_id, i;
+
+    assert(tdb_num_trails(t) == tdb_num_trails(expected));
+    for (i = 1; i < NUM_FIELDS + 1; i++)
+        assert(tdb_lexicon_size(t, i) == tdb_lexicon_size(expected, i));
+
+    for (trail_id = 0; trail_id < tdb_num_trails(t); trail_id++){
+        const tdb_event *event;
+        assert(!memcmp(tdb_get_uuid(t, trail_id),
+                       tdb_get_uuid(expected, trail_id),
+                       16));
+        assert(tdb_get_trail(cursor, trail_id) == 0);
+        assert(tdb_get_trail(expected_cursor, trail_id) == 0);
+        while ((event = tdb_cursor_next(cursor))){
+            const tdb_event *e = tdb_cursor_next(expected_cursor);
+            assert(e && e->timestamp == event->timestamp);
+            assert(e->num_items == event->num_items);
+            for (i = 0; i < event->num_items; i++){
+                uint64_t len, expected_len;
+                const char *v = tdb_get_item_value(t, event->items[i], &len);
+                const char *ev = tdb_get_item_value(expected,
+                                                    e->items[i],
+                                                    &expected_len);
+                assert(len == expected_len && !memcmp(v, ev, len));
+            }
+        }
+        assert(!tdb_cursor_next(expected_cursor));
+    }
+    tdb_cursor_free(cursor);
+    tdb_cursor_free(expected_cursor);
+}
+
+/* with one event per trail, IDs are in the descending order of counts */
+static void check_order(const tdb *t)
+{
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    uint64_t *counts[NUM_FIELDS + 1];
+    uint64_t trail_id, i, val;
+
+    for (i = 1; i < NUM_FIELDS + 1; i++)
+        assert((counts[i] = calloc(tdb_lexicon_size(t, i), 8)));
+
+    for (trail_id = 0; trail_id < tdb_num_trails(t); trail_id++){
+        const tdb_event *event;
+        assert(tdb_get_trail(cursor, trail_id) == 0);
+        while ((event = tdb_cursor_next(cursor)))
+            for (i = 0; i < event->num_items; i++)
+                ++counts[tdb_item_field(event->items[i])]
+                        [tdb_item_val(event->items[i])];
+    }
+
+    for (i = 1; i < NUM_FIELDS + 1; i++){
+        for (val = 2; val < tdb_lexicon_size(t, i); val++)
+            assert(counts[i][val - 1] >= counts[i][val]);
+        free(counts[i]);
+    }
+    tdb_cursor_free(cursor);
+}
+
+int main(int argc, char** argv)
+{
+    char plain_path[4096], path[4096];
+    tdb_opt_value value;
+    tdb *plain, *t;
+    uint64_t len, rank;
+    const char *prev, *v;
+    tdb_cons *c = tdb_cons_init();
+
+    assert(tdb_cons_get_opt(c,
+                            TDB_OPT_CONS_FREQUENCY_ORDERED_VALUES,
+                            &value) == 0);
+    assert(value.value == 0);
+    tdb_cons_close(c);
+
+    snprintf(plain_path, sizeof(plain_path), "%s/plain", getenv("TDB_TMP_DIR"));
+    snprintf(path, sizeof(path), "%s/ordered", getenv("TDB_TMP_DIR"));
+
+    /* one event per trail */
+    create(plain_path, 0, 0, 1);
+    create(path, 1, 0, 1);
+    plain = open_tdb(plain_path);
+    t = open_tdb(path);
+    check_contents(t, plain);
+    check_order(t);
+    assert(tdb_get_item(t, 1, "s0", 2) == tdb_make_item(1, 1));
+    tdb_close(t);
+    tdb_close(plain);
+
+    /* edge-encoded trails, with a sorted permutation of the new IDs */
+    create(plain_path, 0, 0, 40);
+    create(path, 1, 1, 40);
+    plain = open_tdb(plain_path);
+    t = open_tdb(path);
+    check_contents(t, plain);
+
+    prev = tdb_get_value(t, 2, tdb_lexicon_sorted_val(t, 2, 0), &len);
+    for (rank = 1; rank < tdb_lexicon_size(t, 2) - 1; rank++){
+        uint64_t prev_len = len;
+        v = tdb_get_value(t, 2, tdb_lexicon_sorted_val(t, 2, rank), &len);
+        assert(memcmp(prev, v, prev_len < len ? prev_len: len) <= 0);
+        prev = v;
+    }
+    tdb_close(t);
+    tdb_close(plain);
+    return 0;
+}
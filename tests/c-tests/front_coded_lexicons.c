@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+values of front-coded lexicons are read back as written, through every
+API that reads lexicons
+*/
+
+#define NUM_EVENTS 5000
+#define NUM_PATHS 700
+
+/* URL-like values with shared prefixes, some longer than 127 bytes */
+static uint64_t make_url(char *buf, uint32_t id)
+{
+    int n = sprintf(buf, "https://example.com/%s/%u",
+                    id & 1 ? "checkout": "product", id);
+    if (id % 7 == 0){
+        memset(&buf[n], 'x', 200);
+        n += 200;
+    }
+    return (uint64_t)n;
+}
+
+static void create(const char *root, int front_coded, int package)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"url", "small", "empty"};
+    char url[512], small[8];
+    const char *vals[] = {url, small, ""};
+    uint64_t lengths[] = {0, 0, 0};
+    uint64_t i;
+
+    test_srand(11);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_set_opt(c,
+                            TDB_OPT_CONS_FRONT_CODED_LEXICONS,
+                            opt_val((uint64_t)front_coded)) == 0);
+    if (package)
+        assert(tdb_cons_set_opt(c,
+                                TDB_OPT_CONS_OUTPUT_FORMAT,
+                                opt_val(TDB_OPT_CONS_OUTPUT_FORMAT_PACKAGE)) == 0);
+    assert(tdb_cons_open(c, root, fields, 3) == 0);
+    for (i = 0; i < NUM_EVENTS; i++){
+        uuid[0] = (uint8_t)(i % 50);
+        lengths[0] = make_url(url, test_rand() % NUM_PATHS);
+        lengths[1] = (uint64_t)sprintf(small, "%u", test_rand() % 5);
+        assert(tdb_cons_add(c, uuid, i, vals, lengths) == 0);
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+static uint64_t file_size(const char *root, const char *name)
+{
+    char path[4096];
+    struct stat stats;
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    assert(stat(path, &stats) == 0);
+    return (uint64_t)stats.st_size;
+}
+
+/* expected is a tdb with plain lexicons and the same contents */
+static void check(const char *root, const tdb *expected)
+{
+    tdb_field field;
+    tdb *t = tdb_init();
+    assert(tdb_open(t, root) == 0);
+    assert(tdb_version(t) == TDB_VERSION_V0_2);
+    assert(tdb_num_fields(t) == tdb_num_fields(expected));
+
+    for (field = 1; field < tdb_num_fields(t); field++){
+        static const char PREFIX[] = "https://example.com/checkout/";
+        uint64_t val, first, last, num_prefixed = 0;
+        assert(tdb_lexicon_size(t, field) == tdb_lexicon_size(expected, field));
+
+        for (val = 1; val < tdb_lexicon_size(t, field); val++){
+            uint64_t len, expected_len, len2, k;
+            const char *v = tdb_get_value(t, field, val, &len);
+            const char *e = tdb_get_value(expected, field, val, &expected_len);
+            assert(v && len == expected_len && !memcmp(v, e, len));
+            if (len >= sizeof(PREFIX) - 1 && !memcmp(v, PREFIX, sizeof(PREFIX) - 1))
+                ++num_prefixed;
+            /* values stay valid while three other blocks are accessed */
+            for (k = 1; k < 4; k++)
+                if (val + k * 16 < tdb_lexicon_size(t, field))
+                    assert(tdb_get_value(t, field, val + k * 16, &len2));
+            assert(!memcmp(v, e, len));
+            assert(tdb_get_item(t, field, e, len) == tdb_make_item(field, val));
+        }
+        assert(tdb_get_item(t, field, "missing", 7) == 0);
+
+        assert(tdb_lexicon_prefix_range(t,
+                                        field,
+                                        PREFIX,
+                                        sizeof(PREFIX) - 1,
+                                        &first,
+                                        &last) == 0);
+        assert(last - first == num_prefixed);
+        if (field == 1)
+            assert(num_prefixed > 0);
+    }
+    tdb_close(t);
+}
+
+/* values that are not read through tdb_get_value() are found too */
+static void check_cold(const char *root, const tdb *expected)
+{
+    uint64_t val;
+    tdb *t = tdb_init();
+    assert(tdb_open(t, root) == 0);
+    for (val = 1; val < tdb_lexicon_size(t, 1); val++){
+        uint64_t len;
+        const char *e = tdb_get_value(expected, 1, val, &len);
+        assert(tdb_get_item(t, 1, e, len) == tdb_make_item(1, val));
+    }
+    tdb_close(t);
+}
+
+int main(int argc, char** argv)
+{
+    char plain_path[4096], path[4096], append_path[4096];
+    tdb_opt_value value;
+    tdb *plain, *t;
+    tdb_cons *c = tdb_cons_init();
+
+    assert(tdb_cons_get_opt(c, TDB_OPT_CONS_FRONT_CODED_LEXICONS, &value) == 0);
+    assert(value.value == 0);
+    tdb_cons_close(c);
+
+    snprintf(plain_path, sizeof(plain_path), "%s/plain", getenv("TDB_TMP_DIR"));
+    create(plain_path, 0, 0);
+    plain = tdb_init();
+    assert(tdb_open(plain, plain_path) == 0);
+
+    snprintf(path, sizeof(path), "%s/fc", getenv("TDB_TMP_DIR"));
+    create(path, 1, 0);
+    check(path, plain);
+    check_cold(path, plain);
+    assert(file_size(path, "lexicon.url") * 4 <
+           file_size(plain_path, "lexicon.url") * 3);
+
+    /* appending a front-coded tdb to a plain one */
+    snprintf(append_path, sizeof(append_path), "%s/append",
+             getenv("TDB_TMP_DIR"));
+    {
+        const char *fields[] = {"url", "small", "empty"};
+        c = tdb_cons_init();
+        test_cons_settings(c);
+        assert(tdb_cons_open(c, append_path, fields, 3) == 0);
+        t = tdb_init();
+        assert(tdb_open(t, path) == 0);
+        assert(tdb_cons_append(c, t) == 0);
+        tdb_close(t);
+        assert(tdb_cons_finalize(c) == 0);
+        tdb_cons_close(c);
+        t = tdb_init();
+        assert(tdb_open(t, append_path) == 0);
+        assert(tdb_num_events(t) == NUM_EVENTS);
+        assert(tdb_lexicon_size(t, 1) == tdb_lexicon_size(plain, 1));
+        tdb_close(t);
+    }
+
+#ifdef HAVE_ARCHIVE_H
+    snprintf(path, sizeof(path), "%s/package", getenv("TDB_TMP_DIR"));
+    create(path, 1, 1);
+    check(path, plain);
+#endif
+    tdb_close(plain);
+    return 0;
+}
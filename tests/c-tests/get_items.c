@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+tdb_get_item() and tdb_get_items() find every value of a small lexicon,
+which is scanned, and of a large lexicon, which is hashed
+*/
+
+#define NUM_VALUES 10000
+#define NUM_SMALL 10
+
+static void check_field(tdb *t, tdb_field field, uint64_t num_values)
+{
+    const char **values = malloc((num_values + 2) * sizeof(char*));
+    uint64_t *lengths = malloc((num_values + 2) * 8);
+    tdb_item *items = malloc((num_values + 2) * sizeof(tdb_item));
+    uint64_t i;
+    assert(values && lengths && items);
+
+    assert(tdb_lexicon_size(t, field) == num_values + 1);
+
+    for (i = 0; i < num_values; i++){
+        tdb_item item;
+        values[i] = tdb_get_value(t, field, i + 1, &lengths[i]);
+        item = tdb_get_item(t, field, values[i], lengths[i]);
+        assert(item == tdb_make_item(field, i + 1));
+    }
+    values[num_values] = "missing";
+    lengths[num_values] = 7;
+    values[num_values + 1] = "";
+    lengths[num_values + 1] = 0;
+
+    assert(tdb_get_item(t, field, "missing", 7) == 0);
+    /* a prefix of a value is not the value */
+    if (lengths[0] > 1)
+        assert(tdb_get_item(t, field, values[0], lengths[0] - 1) == 0);
+    assert(tdb_get_item(t, field, "", 0) == tdb_make_item(field, 0));
+
+    memset(items, 0xff, (num_values + 2) * sizeof(tdb_item));
+    assert(tdb_get_items(t, field, values, lengths, num_values + 2, items) == 0);
+    for (i = 0; i < num_values; i++)
+        assert(items[i] == tdb_make_item(field, i + 1));
+    assert(items[num_values] == 0);
+    assert(items[num_values + 1] == tdb_make_item(field, 0));
+
+    free(values);
+    free(lengths);
+    free(items);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"large", "small"};
+    char buf1[32], buf2[32];
+    const char *vals[] = {buf1, buf2};
+    uint64_t lengths[2];
+    const char *values[1];
+    tdb_item items[1];
+    uint64_t i;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 2) == 0);
+    for (i = 0; i < NUM_VALUES; i++){
+        memcpy(uuid, &i, 4);
+        lengths[0] = (uint64_t)sprintf(buf1, "value-%" PRIu64, i * 7919);
+        lengths[1] = (uint64_t)sprintf(buf2, "%" PRIu64, i % NUM_SMALL);
+        assert(tdb_cons_add(c, uuid, i, vals, lengths) == 0);
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+
+    check_field(t, 1, NUM_VALUES);
+    check_field(t, 2, NUM_SMALL);
+
+    values[0] = "0";
+    lengths[0] = 1;
+    assert(tdb_get_items(t, 0, values, lengths, 1, items) ==
+           TDB_ERR_UNKNOWN_FIELD);
+    assert(tdb_get_items(t, 3, values, lengths, 1, items) ==
+           TDB_ERR_UNKNOWN_FIELD);
+    assert(tdb_get_item(t, 3, "0", 1) == 0);
+
+    tdb_close(t);
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <traildb.h>
+#include "tdb_test.h"
+
+/*
+tdb_lexicon_range() and tdb_lexicon_prefix_range() match the same values
+as a linear scan, with and without TDB_OPT_CONS_SORTED_LEXICONS
+*/
+
+#define NUM_EVENTS 2000
+#define MAX_LENGTH 6
+
+/* a short string over a small alphabet, so that prefixes are shared */
+static uint64_t random_string(char *buf)
+{
+    static const char ALPHABET[] = "ab/";
+    uint64_t i, n = test_rand() % (MAX_LENGTH + 1);
+    for (i = 0; i < n; i++)
+        buf[i] = ALPHABET[test_rand() % 3];
+    return n;
+}
+
+static int compare(const char *a, uint64_t a_len, const char *b, uint64_t b_len)
+{
+    int cmp = memcmp(a, b, a_len < b_len ? a_len: b_len);
+    if (cmp)
+        return cmp;
+    return a_len < b_len ? -1: (a_len > b_len ? 1: 0);
+}
+
+static void create(const char *root, int sorted, int package)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "empty"};
+    char buf[MAX_LENGTH];
+    const char *vals[] = {buf, ""};
+    uint64_t lengths[] = {0, 0};
+    uint64_t i;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_set_opt(c,
+                            TDB_OPT_CONS_SORTED_LEXICONS,
+                            opt_val((uint64_t)sorted)) == 0);
+    if (package)
+        assert(tdb_cons_set_opt(c,
+                                TDB_OPT_CONS_OUTPUT_FORMAT,
+                                opt_val(TDB_OPT_CONS_OUTPUT_FORMAT_PACKAGE)) == 0);
+    assert(tdb_cons_open(c, root, fields, 2) == 0);
+    for (i = 0; i < NUM_EVENTS; i++){
+        lengths[0] = random_string(buf);
+        assert(tdb_cons_add(c, uuid, i, vals, lengths) == 0);
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+/* check that ranks [first, last) are exactly the values that match */
+static void check_ranks(const tdb *t,
+                        uint64_t first,
+                        uint64_t last,
+                        const char *min_value,
+                        uint64_t min_length,
+                        const char *max_value,
+                        uint64_t max_length,
+                        int prefix)
+{
+    const uint64_t num_values = tdb_lexicon_size(t, 1) - 1;
+    uint64_t val, rank, num_matches = 0;
+
+    /* the order is consistent with ranks */
+    for (rank = first; rank < last; rank++){
+        uint64_t len;
+        const char *v = tdb_get_value(t, 1, tdb_lexicon_sorted_val(t, 1, rank),
+                                      &len);
+        if (rank > first){
+            uint64_t prev_len;
+            const char *prev = tdb_get_value(
+                t, 1, tdb_lexicon_sorted_val(t, 1, rank - 1), &prev_len);
+            assert(compare(prev, prev_len, v, len) < 0);
+        }
+    }
+
+    for (val = 1; val <= num_values; val++){
+        uint64_t len;
+        const char *v = tdb_get_value(t, 1, val, &len);
+        int match;
+        if (prefix)
+            match = len >= min_length && !memcmp(v, min_value, min_length);
+        else
+            match = (!min_value || compare(v, len, min_value, min_length) >= 0) &&
+                    (!max_value || compare(v, len, max_value, max_length) < 0);
+        if (match){
+            ++num_matches;
+            for (rank = first; rank < last; rank++)
+                if (tdb_lexicon_sorted_val(t, 1, rank) == val)
+                    break;
+            assert(rank < last);
+        }
+    }
+    assert(num_matches == last - first);
+}
+
+static void check(const char *root)
+{
+    uint64_t i, first, last;
+    char min_buf[MAX_LENGTH], max_buf[MAX_LENGTH];
+    tdb* t = tdb_init();
+    assert(tdb_open(t, root) == 0);
+
+    assert(tdb_lexicon_range(t, 1, NULL, 0, NULL, 0, &first, &last) == 0);
+    assert(first == 0 && last == tdb_lexicon_size(t, 1) - 1);
+    check_ranks(t, first, last, NULL, 0, NULL, 0, 0);
+
+    for (i = 0; i < 50; i++){
+        uint64_t min_length = random_string(min_buf);
+        uint64_t max_length = random_string(max_buf);
+
+        assert(tdb_lexicon_prefix_range(t,
+                                        1,
+                                        min_buf,
+                                        min_length,
+                                        &first,
+                                        &last) == 0);
+        check_ranks(t, first, last, min_buf, min_length, NULL, 0, 1);
+
+        assert(tdb_lexicon_range(t,
+                                 1,
+                                 min_buf,
+                                 min_length,
+                                 max_buf,
+                                 max_length,
+                                 &first,
+                                 &last) == 0);
+        check_ranks(t, first, last, min_buf, min_length, max_buf, max_length, 0);
+
+        assert(tdb_lexicon_range(t,
+                                 1,
+                                 NULL,
+                                 0,
+                                 max_buf,
+                                 max_length,
+                                 &first,
+                                 &last) == 0);
+        check_ranks(t, first, last, NULL, 0, max_buf, max_length, 0);
+    }
+
+    assert(tdb_lexicon_prefix_range(t, 2, "a", 1, &first, &last) == 0);
+    assert(first == 0 && last == 0);
+    assert(tdb_lexicon_range(t, 3, NULL, 0, NULL, 0, &first, &last) ==
+           TDB_ERR_UNKNOWN_FIELD);
+    assert(tdb_lexicon_sorted_val(t, 1, tdb_lexicon_size(t, 1)) == 0);
+    tdb_close(t);
+}
+
+int main(int argc, char** argv)
+{
+    char path[4096];
+    tdb_opt_value value;
+    tdb_cons *c = tdb_cons_init();
+
+    assert(tdb_cons_get_opt(c, TDB_OPT_CONS_SORTED_LEXICONS, &value) == 0);
+    assert(value.value == 0);
+    tdb_cons_close(c);
+
+    test_srand(7);
+    snprintf(path, sizeof(path), "%s/unsorted", getenv("TDB_TMP_DIR"));
+    create(path, 0, 0);
+    check(path);
+
+    snprintf(path, sizeof(path), "%s/sorted", getenv("TDB_TMP_DIR"));
+    create(path, 1, 0);
+    check(path);
+    snprintf(path, sizeof(path), "%s/sorted/lexicon.a.sorted",
+             getenv("TDB_TMP_DIR"));
+    assert(access(path, F_OK) == 0);
+    snprintf(path, sizeof(path), "%s/sorted/lexicon.empty.sorted",
+             getenv("TDB_TMP_DIR"));
+    assert(access(path, F_OK) == -1);
+
+#ifdef HAVE_ARCHIVE_H
+    snprintf(path, sizeof(path), "%s/package", getenv("TDB_TMP_DIR"));
+    create(path, 1, 1);
+    check(path);
+#endif
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+merge hundreds of cursors with many equal timestamps. Events must come
+out ordered by timestamp, ties ordered by cursor index, with both
+tdb_multi_cursor_next() and tdb_multi_cursor_next_batch().
+*/
+
+#define NUM_CURSORS 600
+#define MAX_EVENTS 50
+
+struct merged_event{
+    uint64_t timestamp;
+    uint64_t cursor_idx;
+};
+
+static struct merged_event expected[NUM_CURSORS * MAX_EVENTS];
+static tdb_multi_event mevents[NUM_CURSORS * MAX_EVENTS];
+
+static int event_cmp(const void *a, const void *b)
+{
+    const struct merged_event *aa = (const struct merged_event*)a;
+    const struct merged_event *bb = (const struct merged_event*)b;
+
+    if (aa->timestamp != bb->timestamp)
+        return aa->timestamp > bb->timestamp ? 1: -1;
+    if (aa->cursor_idx != bb->cursor_idx)
+        return aa->cursor_idx > bb->cursor_idx ? 1: -1;
+    return 0;
+}
+
+static void get_trails(tdb_cursor **cursors, uint64_t num_cursors)
+{
+    uint64_t i;
+    for (i = 0; i < num_cursors; i++)
+        assert(tdb_get_trail(cursors[i], i) == 0);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a"};
+    const char *vals[] = {""};
+    uint64_t lengths[] = {0};
+    tdb_cursor *cursors[NUM_CURSORS];
+    const uint64_t BATCH_SIZES[] = {1, 1000, NUM_CURSORS * MAX_EVENTS};
+    const tdb_multi_event *mevent;
+    tdb_multi_cursor *mc;
+    uint64_t i, j, n = 0;
+
+    test_srand(47);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 1) == 0);
+    for (i = 0; i < NUM_CURSORS; i++){
+        /* trails without events are not stored */
+        uint64_t num = test_rand() % MAX_EVENTS;
+        uint64_t tstamp = test_rand() % 100;
+        memcpy(uuid, &i, sizeof(i));
+        for (j = 0; j < num; j++){
+            tstamp += test_rand() % 3;
+            assert(tdb_cons_add(c, uuid, tstamp, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    /* small buffers make cursors run out of buffered events often */
+    assert(tdb_set_opt(t,
+                       TDB_OPT_CURSOR_EVENT_BUFFER_SIZE,
+                       opt_val(3)) == 0);
+
+    for (i = 0; i < tdb_num_trails(t); i++){
+        const tdb_event *event;
+        cursors[i] = tdb_cursor_new(t);
+        assert(tdb_get_trail(cursors[i], i) == 0);
+        while ((event = tdb_cursor_next(cursors[i]))){
+            expected[n].timestamp = event->timestamp;
+            expected[n++].cursor_idx = i;
+        }
+    }
+    qsort(expected, n, sizeof(expected[0]), event_cmp);
+
+    mc = tdb_multi_cursor_new(cursors, tdb_num_trails(t));
+    assert(mc);
+
+    get_trails(cursors, tdb_num_trails(t));
+    tdb_multi_cursor_reset(mc);
+    for (i = 0; (mevent = tdb_multi_cursor_next(mc)); i++){
+        assert(i < n);
+        assert(mevent->event->timestamp == expected[i].timestamp);
+        assert(mevent->cursor_idx == expected[i].cursor_idx);
+        mevent = tdb_multi_cursor_peek(mc);
+        if (i + 1 < n){
+            assert(mevent->event->timestamp == expected[i + 1].timestamp);
+            assert(mevent->cursor_idx == expected[i + 1].cursor_idx);
+        }else
+            assert(mevent == NULL);
+    }
+    assert(i == n);
+
+    for (j = 0; j < sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]); j++){
+        uint64_t k, num, total = 0;
+        get_trails(cursors, tdb_num_trails(t));
+        tdb_multi_cursor_reset(mc);
+        while ((num = tdb_multi_cursor_next_batch(mc, mevents, BATCH_SIZES[j]))){
+            assert(num <= BATCH_SIZES[j]);
+            for (k = 0; k < num; k++, total++){
+                assert(total < n);
+                assert(mevents[k].event->timestamp == expected[total].timestamp);
+                assert(mevents[k].cursor_idx == expected[total].cursor_idx);
+            }
+        }
+        assert(total == n);
+    }
+
+    tdb_multi_cursor_free(mc);
+    for (i = 0; i < tdb_num_trails(t); i++)
+        tdb_cursor_free(cursors[i]);
+
+    /* no cursors */
+    mc = tdb_multi_cursor_new(NULL, 0);
+    assert(mc);
+    assert(tdb_multi_cursor_next(mc) == NULL);
+    assert(tdb_multi_cursor_next_batch(mc, mevents, 10) == 0);
+    tdb_multi_cursor_free(mc);
+
+    tdb_close(t);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+tdb_parallel_scan() must visit every trail exactly once, regardless of
+the number of threads and how skewed the sizes of trails are
+*/
+
+#define NUM_TRAILS 2000
+#define MAX_THREADS 16
+
+struct scan_state{
+    uint64_t num_trails;
+    uint64_t num_events;
+    uint64_t sum;
+};
+
+static uint8_t visited[NUM_TRAILS];
+static uint64_t expected_events[NUM_TRAILS];
+
+static int count_events(tdb_cursor *cursor, uint64_t trail_id, void *arg)
+{
+    struct scan_state *state = (struct scan_state*)arg;
+    const tdb_event *event;
+    uint64_t n = 0;
+
+    ++visited[trail_id];
+    ++state->num_trails;
+    while ((event = tdb_cursor_next(cursor))){
+        state->sum += event->timestamp;
+        if (event->num_items)
+            state->sum += tdb_item_val(event->items[0]);
+        ++n;
+    }
+    assert(n == expected_events[trail_id]);
+    state->num_events += n;
+    return 0;
+}
+
+static int stop_early(tdb_cursor *cursor, uint64_t trail_id, void *arg)
+{
+    struct scan_state *state = (struct scan_state*)arg;
+    return ++state->num_trails == 10;
+}
+
+static void check(const tdb *t,
+                  const struct tdb_event_filter *filter,
+                  const tdb_field *fields,
+                  uint64_t num_fields,
+                  uint64_t num_threads)
+{
+    struct scan_state states[MAX_THREADS];
+    void *state_ptrs[MAX_THREADS];
+    struct scan_state expected = {0, 0, 0}, total = {0, 0, 0};
+    uint64_t i;
+
+    /* sequential reference */
+    memset(visited, 0, sizeof(visited));
+    memset(states, 0, sizeof(states));
+    for (i = 0; i < NUM_TRAILS; i++){
+        tdb_cursor *cursor = tdb_cursor_new(t);
+        if (filter)
+            assert(tdb_cursor_set_event_filter(cursor, filter) == 0);
+        if (fields)
+            assert(tdb_cursor_set_fields(cursor, fields, num_fields) == 0);
+        assert(tdb_get_trail(cursor, i) == 0);
+        expected_events[i] = tdb_get_trail_length(cursor);
+        assert(tdb_get_trail(cursor, i) == 0);
+        assert(count_events(cursor, i, &expected) == 0);
+        tdb_cursor_free(cursor);
+    }
+
+    memset(visited, 0, sizeof(visited));
+    for (i = 0; i < num_threads; i++)
+        state_ptrs[i] = &states[i];
+    assert(tdb_parallel_scan(t,
+                             filter,
+                             fields,
+                             num_fields,
+                             count_events,
+                             state_ptrs,
+                             num_threads) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++)
+        assert(visited[i] == 1);
+    for (i = 0; i < num_threads; i++){
+        total.num_trails += states[i].num_trails;
+        total.num_events += states[i].num_events;
+        total.sum += states[i].sum;
+    }
+    assert(total.num_trails == expected.num_trails);
+    assert(total.num_events == expected.num_events);
+    assert(total.sum == expected.sum);
+
+    /* stopping the scan */
+    memset(states, 0, sizeof(states));
+    assert(tdb_parallel_scan(t,
+                             NULL,
+                             NULL,
+                             0,
+                             stop_early,
+                             state_ptrs,
+                             num_threads) == TDB_ERR_SCAN_ABORTED);
+    for (i = 0; i < num_threads; i++)
+        assert(states[i].num_trails <= 10);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b"};
+    char buf[2][32];
+    const char *vals[2] = {buf[0], buf[1]};
+    uint64_t lengths[2];
+    uint64_t i, j, threads;
+    tdb_field field_b = 2;
+    struct tdb_event_filter *f = tdb_event_filter_new();
+
+    test_srand(37);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 2) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        /* a few very long trails, many short ones */
+        uint64_t n = i % 300 == 0 ? 20000: 1 + test_rand() % 20;
+        memcpy(uuid, &i, sizeof(i));
+        for (j = 0; j < n; j++){
+            lengths[0] = (uint64_t)sprintf(buf[0], "%u", test_rand() % 100);
+            lengths[1] = (uint64_t)sprintf(buf[1], "%u", test_rand() % 5);
+            assert(tdb_cons_add(c, uuid, j, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+
+    assert(tdb_event_filter_add_term(f, tdb_get_item(t, 2, "1", 1), 0) == 0);
+
+    assert(tdb_parallel_scan(t, NULL, NULL, 0, count_events, NULL, 0) ==
+           TDB_ERR_INVALID_OPTION_VALUE);
+
+    for (threads = 1; threads <= MAX_THREADS; threads *= 4){
+        check(t, NULL, NULL, 0, threads);
+        check(t, f, &field_b, 1, threads);
+    }
+
+    tdb_event_filter_free(f);
+    tdb_close(t);
+    return 0;
+}
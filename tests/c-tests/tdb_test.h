@@ -1,6 +1,7 @@
 #ifndef __TDB_TEST_H__
 #define __TDB_TEST_H__
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 
@@ -30,5 +31,30 @@ static inline void test_cons_settings(tdb_cons *cons)
                             opt_val(TDB_OPT_CONS_OUTPUT_FORMAT_DIR)) == 0);
 }
 
+/*
+xorshift32, a deterministic pseudo-random sequence for generating test
+data. test_srand() restarts the sequence, so the same data can be
+generated again.
+*/
+static inline uint32_t *test_rand_state(void)
+{
+    static uint32_t state = 1;
+    return &state;
+}
+
+static inline void test_srand(uint32_t seed)
+{
+    *test_rand_state() = seed ? seed: 1;
+}
+
+static inline uint32_t test_rand(void)
+{
+    uint32_t *state = test_rand_state();
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
 #endif /* __TDB_TEST_H__ */
 
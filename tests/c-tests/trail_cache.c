@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+cursors return the same events whether trails are replayed from the
+trail cache or decoded from scratch, with all cursor options
+*/
+
+#define NUM_TRAILS 300
+#define NUM_THREADS 4
+
+static uint64_t checksum(tdb_cursor *cursor)
+{
+    const tdb_event *event;
+    uint64_t k, sum = 0;
+
+    while ((event = tdb_cursor_next(cursor))){
+        sum = sum * 31 + event->timestamp;
+        sum = sum * 31 + event->num_items;
+        for (k = 0; k < event->num_items; k++)
+            sum = sum * 31 + event->items[k];
+    }
+    return sum;
+}
+
+/* checksums of all trails with the given options */
+static void read_trails(tdb *t,
+                        const struct tdb_event_filter *f,
+                        const tdb_field *fields,
+                        uint64_t limit,
+                        uint64_t seek,
+                        uint64_t *sums)
+{
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    uint64_t i;
+
+    if (f)
+        assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+    if (fields)
+        assert(tdb_cursor_set_fields(cursor, fields, 1) == 0);
+    tdb_cursor_set_limit(cursor, limit);
+    for (i = 0; i < NUM_TRAILS; i++){
+        assert(tdb_get_trail(cursor, i) == 0);
+        if (seek)
+            assert(tdb_cursor_seek_time(cursor, seek) == 0);
+        sums[i] = checksum(cursor);
+        assert(tdb_get_trail(cursor, i) == 0);
+        sums[i] = sums[i] * 31 + tdb_get_trail_length(cursor);
+    }
+    tdb_cursor_free(cursor);
+}
+
+static void compare(tdb *t,
+                    const struct tdb_event_filter *f,
+                    const tdb_field *fields,
+                    uint64_t limit,
+                    uint64_t seek)
+{
+    static uint64_t expected[NUM_TRAILS];
+    static uint64_t sums[NUM_TRAILS];
+
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(0)) == 0);
+    read_trails(t, f, fields, limit, seek, expected);
+
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(1 << 30)) == 0);
+    /* the first pass fills the cache, the second one replays it */
+    read_trails(t, f, fields, limit, seek, sums);
+    assert(!memcmp(sums, expected, sizeof(sums)));
+    read_trails(t, f, fields, limit, seek, sums);
+    assert(!memcmp(sums, expected, sizeof(sums)));
+}
+
+static int sum_trail(tdb_cursor *cursor, uint64_t trail_id, void *state)
+{
+    *(uint64_t*)state += checksum(cursor);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b"};
+    char buf[2][32];
+    const char *vals[2] = {buf[0], buf[1]};
+    uint64_t lengths[2];
+    uint64_t i, j, hits, misses, size, prev_hits;
+    uint64_t sums[NUM_THREADS];
+    static uint64_t trail_sums[NUM_TRAILS];
+    void *states[NUM_THREADS];
+    uint64_t expected, total;
+    tdb_field field_b = 2;
+    tdb_opt_value value;
+    const tdb_event *event;
+    tdb_cursor *cursor;
+    struct tdb_event_filter *f = tdb_event_filter_new();
+
+    test_srand(61);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, 2) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t n = i % 50 == 0 ? 10000: 1 + test_rand() % 100;
+        memcpy(uuid, &i, sizeof(i));
+        for (j = 0; j < n; j++){
+            lengths[0] = (uint64_t)sprintf(buf[0], "%u", test_rand() % 5);
+            lengths[1] = (uint64_t)sprintf(buf[1], "%u", test_rand() % 1000);
+            assert(tdb_cons_add(c, uuid, j * 2, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    assert(tdb_event_filter_add_term(f, tdb_get_item(t, 1, "1", 1), 0) == 0);
+
+    /* disabled by default */
+    assert(tdb_get_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, &value) == 0);
+    assert(value.value == 0);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    assert(hits == 0 && misses == 0 && size == 0);
+
+    compare(t, NULL, NULL, 0, 0);
+    compare(t, f, NULL, 0, 0);
+    compare(t, NULL, &field_b, 0, 0);
+    compare(t, NULL, NULL, 7, 0);
+    compare(t, NULL, NULL, 0, 61);
+    compare(t, f, NULL, 5, 61);
+
+    assert(tdb_get_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, &value) == 0);
+    assert(value.value == 1 << 30);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    /* the cache is emptied by compare(), the first read of a trail misses */
+    assert(misses == 6 * NUM_TRAILS);
+    assert(hits > 0);
+    assert(size > 0);
+
+    assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, TDB_TRUE) == 0);
+    compare(t, NULL, &field_b, 0, 61);
+    assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, TDB_FALSE) == 0);
+
+    /* a small cache evicts trails */
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(20000)) == 0);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    assert(size <= 20000);
+    compare(t, NULL, NULL, 0, 0);
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(20000)) == 0);
+    read_trails(t, NULL, NULL, 0, 0, trail_sums);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    assert(size <= 20000);
+
+    /* an evicted trail stays valid until the cursor moves on */
+    cursor = tdb_cursor_new(t);
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(1 << 30)) == 0);
+    assert(tdb_get_trail(cursor, 0) == 0);
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(0)) == 0);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    assert(size == 0);
+    for (i = 0; (event = tdb_cursor_next(cursor)); i++)
+        assert(event->timestamp == i * 2);
+    assert(i == 10000);
+
+    /* a disabled cache isn't used */
+    prev_hits = hits;
+    assert(tdb_get_trail(cursor, 0) == 0);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    assert(hits == prev_hits && size == 0);
+    tdb_cursor_free(cursor);
+
+    /* the cache is shared by threads */
+    expected = 0;
+    states[0] = &expected;
+    assert(tdb_parallel_scan(t, NULL, NULL, 0, sum_trail, states, 1) == 0);
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(1 << 30)) == 0);
+
+    /* scans don't add trails to the cache, but they replay cached ones */
+    total = 0;
+    states[0] = &total;
+    assert(tdb_parallel_scan(t, NULL, NULL, 0, sum_trail, states, 1) == 0);
+    assert(total == expected);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    assert(size == 0);
+    read_trails(t, NULL, NULL, 0, 0, trail_sums);
+    tdb_get_trail_cache_stats(t, &prev_hits, &misses, &size);
+    assert(size > 0);
+
+    memset(sums, 0, sizeof(sums));
+    for (i = 0; i < NUM_THREADS; i++)
+        states[i] = &sums[i];
+    assert(tdb_parallel_scan(t,
+                             NULL,
+                             NULL,
+                             0,
+                             sum_trail,
+                             states,
+                             NUM_THREADS) == 0);
+    for (total = 0, i = 0; i < NUM_THREADS; i++)
+        total += sums[i];
+    assert(total == expected);
+    tdb_get_trail_cache_stats(t, &hits, &misses, &size);
+    assert(hits == prev_hits + NUM_TRAILS);
+
+    tdb_event_filter_free(f);
+    tdb_close(t);
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+tdb_trail_foreach() passes the same events to the callback as
+tdb_cursor_next() returns, with all cursor options
+*/
+
+#define NUM_TRAILS 200
+#define NUM_FIELDS 4
+
+struct visit_state{
+    tdb_cursor *cursor;
+    uint64_t sum;
+    uint64_t num_events;
+    uint64_t stop_at;
+};
+
+static uint64_t event_sum(uint64_t sum,
+                          uint64_t timestamp,
+                          const tdb_item *items,
+                          uint64_t num_items,
+                          const uint64_t *matches)
+{
+    uint64_t k;
+
+    sum = sum * 31 + timestamp;
+    sum = sum * 31 + num_items;
+    for (k = 0; k < num_items; k++)
+        sum = sum * 31 + items[k];
+    if (matches)
+        sum = sum * 31 + matches[0];
+    return sum;
+}
+
+static int visit(uint64_t timestamp,
+                 const tdb_item *items,
+                 uint64_t num_items,
+                 void *ctx)
+{
+    struct visit_state *state = (struct visit_state*)ctx;
+
+    state->sum = event_sum(state->sum,
+                           timestamp,
+                           items,
+                           num_items,
+                           tdb_cursor_event_matches(state->cursor));
+    return ++state->num_events == state->stop_at;
+}
+
+static void check(tdb_cursor *cursor, tdb_cursor *reference)
+{
+    uint64_t i;
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        struct visit_state state = {cursor, 0, 0, 0};
+        uint64_t sum = 0, num_events = 0;
+        const tdb_event *event;
+
+        assert(tdb_get_trail(reference, i) == 0);
+        while ((event = tdb_cursor_next(reference))){
+            /* tdb_event is packed, copy its fields before passing them */
+            const uint64_t timestamp = event->timestamp;
+            const uint64_t num_items = event->num_items;
+            tdb_item items[NUM_FIELDS];
+            uint64_t k;
+            for (k = 0; k < num_items; k++)
+                items[k] = event->items[k];
+            sum = event_sum(sum,
+                            timestamp,
+                            items,
+                            num_items,
+                            tdb_cursor_event_matches(reference));
+            ++num_events;
+        }
+
+        assert(tdb_trail_foreach(cursor, i, visit, &state) == 0);
+        assert(state.sum == sum);
+        assert(state.num_events == num_events);
+        assert(tdb_cursor_next(cursor) == NULL);
+
+        /* stop early */
+        if (num_events > 1){
+            memset(&state, 0, sizeof(state));
+            state.cursor = cursor;
+            state.stop_at = num_events / 2;
+            assert(tdb_trail_foreach(cursor, i, visit, &state) ==
+                   TDB_ERR_SCAN_ABORTED);
+            assert(state.num_events == num_events / 2);
+        }
+    }
+}
+
+static void check_options(tdb *t,
+                          const struct tdb_event_filter **filters,
+                          uint64_t num_filters,
+                          const tdb_field *fields,
+                          uint64_t limit)
+{
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    tdb_cursor *reference = tdb_cursor_new(t);
+
+    if (num_filters == 1){
+        assert(tdb_cursor_set_event_filter(cursor, filters[0]) == 0);
+        assert(tdb_cursor_set_event_filter(reference, filters[0]) == 0);
+    }else if (num_filters){
+        assert(tdb_cursor_set_event_filters(cursor,
+                                            filters,
+                                            num_filters) == 0);
+        assert(tdb_cursor_set_event_filters(reference,
+                                            filters,
+                                            num_filters) == 0);
+    }
+    if (fields){
+        assert(tdb_cursor_set_fields(cursor, fields, 2) == 0);
+        assert(tdb_cursor_set_fields(reference, fields, 2) == 0);
+    }
+    tdb_cursor_set_limit(cursor, limit);
+    tdb_cursor_set_limit(reference, limit);
+
+    check(cursor, reference);
+
+    tdb_cursor_free(cursor);
+    tdb_cursor_free(reference);
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t uuid[16];
+    const char *fields[] = {"a", "b", "c", "d"};
+    char buf[NUM_FIELDS][32];
+    const char *vals[NUM_FIELDS] = {buf[0], buf[1], buf[2], buf[3]};
+    uint64_t lengths[NUM_FIELDS];
+    uint64_t i, j, k;
+    const tdb_field projection[] = {3, 1};
+    struct tdb_event_filter *f1 = tdb_event_filter_new();
+    struct tdb_event_filter *f2 = tdb_event_filter_new();
+    const struct tdb_event_filter *filters[] = {f1, f2};
+    struct visit_state state = {NULL, 0, 0, 0};
+    tdb_cursor *cursor;
+
+    test_srand(67);
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, getenv("TDB_TMP_DIR"), fields, NUM_FIELDS) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t n = i % 40 == 0 ? 20000: 1 + test_rand() % 100;
+        memcpy(uuid, &i, sizeof(i));
+        for (j = 0; j < n; j++){
+            for (k = 0; k < NUM_FIELDS; k++)
+                lengths[k] = (uint64_t)sprintf(buf[k], "%" PRIu64,
+                                               test_rand() % (3 + k * 100));
+            assert(tdb_cons_add(c, uuid, j, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+
+    tdb* t = tdb_init();
+    assert(tdb_open(t, getenv("TDB_TMP_DIR")) == 0);
+    assert(tdb_event_filter_add_term(f1, tdb_get_item(t, 1, "1", 1), 0) == 0);
+    assert(tdb_event_filter_add_term(f2, tdb_get_item(t, 1, "2", 1), 0) == 0);
+    assert(tdb_event_filter_new_clause(f2) == 0);
+    assert(tdb_event_filter_add_time_range(f2, 10, 5000) == 0);
+
+    check_options(t, NULL, 0, NULL, 0);
+    check_options(t, filters, 2, NULL, 0);
+    check_options(t, filters, 1, projection, 13);
+
+    assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, TDB_TRUE) == 0);
+    check_options(t, NULL, 0, projection, 7);
+    assert(tdb_set_opt(t, TDB_OPT_ONLY_DIFF_ITEMS, TDB_FALSE) == 0);
+
+    assert(tdb_set_opt(t, TDB_OPT_TRAIL_CACHE_SIZE, opt_val(1 << 30)) == 0);
+    check_options(t, filters, 1, NULL, 0);
+
+    cursor = tdb_cursor_new(t);
+    assert(tdb_trail_foreach(cursor, NUM_TRAILS, visit, &state) ==
+           TDB_ERR_INVALID_TRAIL_ID);
+    assert(state.num_events == 0);
+    tdb_cursor_free(cursor);
+
+    tdb_event_filter_free(f1);
+    tdb_event_filter_free(f2);
+    tdb_close(t);
+    return 0;
+}
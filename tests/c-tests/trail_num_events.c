@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+trail lengths are read from trails.lengths if possible. Check that
+tdb_get_trail_length() still counts the remaining events if the cursor
+has been advanced, or if a filter or a limit is set.
+*/
+
+#define NUM_TRAILS 1000
+#define LONG_TRAIL 100000
+
+static uint64_t num_events[NUM_TRAILS];
+static uint64_t num_even[NUM_TRAILS];
+
+static void create(const char *root)
+{
+    const char *fields[] = {"a"};
+    const char *vals[] = {"0", "1"};
+    uint64_t lengths[] = {1};
+    uint8_t uuid[16];
+    uint64_t i, j;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, root, fields, 1) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        memset(uuid, 0, sizeof(uuid));
+        memcpy(uuid, &i, sizeof(i));
+        num_events[i] = i == NUM_TRAILS / 2 ? LONG_TRAIL:
+                                              1 + test_rand() % 100;
+        for (j = 0; j < num_events[i]; j++){
+            uint32_t r = test_rand() % 2;
+            num_even[i] += r == 0;
+            assert(tdb_cons_add(c, uuid, j, &vals[r], lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+static void check(const char *root)
+{
+    struct tdb_event_filter *f = tdb_event_filter_new();
+    tdb_cursor *cursor;
+    uint64_t i, n;
+    tdb* t = tdb_init();
+
+    assert(tdb_open(t, root) == 0);
+    /* with one event per batch, no events are buffered after tdb_cursor_next() */
+    assert(tdb_set_opt(t,
+                       TDB_OPT_CURSOR_EVENT_BUFFER_SIZE,
+                       opt_val(1)) == 0);
+    cursor = tdb_cursor_new(t);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        assert(tdb_trail_num_events(t, i, &n) == 0);
+        assert(n == num_events[i]);
+
+        assert(tdb_get_trail(cursor, i) == 0);
+        assert(tdb_get_trail_length(cursor) == num_events[i]);
+        assert(tdb_cursor_next(cursor) == NULL);
+        assert(tdb_get_trail_length(cursor) == 0);
+
+        assert(tdb_get_trail(cursor, i) == 0);
+        assert(tdb_cursor_next(cursor));
+        assert(tdb_get_trail_length(cursor) == num_events[i] - 1);
+    }
+    assert(tdb_trail_num_events(t, NUM_TRAILS, &n) ==
+           TDB_ERR_INVALID_TRAIL_ID);
+
+    tdb_cursor_set_limit(cursor, 10);
+    for (i = 0; i < NUM_TRAILS; i++){
+        assert(tdb_get_trail(cursor, i) == 0);
+        assert(tdb_get_trail_length(cursor) ==
+               (num_events[i] < 10 ? num_events[i]: 10));
+    }
+    tdb_cursor_set_limit(cursor, 0);
+
+    assert(tdb_event_filter_add_term(f, tdb_get_item(t, 1, "0", 1), 0) == 0);
+    assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+    for (i = 0; i < NUM_TRAILS; i++){
+        assert(tdb_trail_num_events(t, i, &n) == 0);
+        assert(n == num_events[i]);
+        assert(tdb_get_trail(cursor, i) == 0);
+        assert(tdb_get_trail_length(cursor) == num_even[i]);
+    }
+
+    tdb_cursor_free(cursor);
+    tdb_event_filter_free(f);
+    tdb_close(t);
+}
+
+int main(int argc, char** argv)
+{
+    char path[1024];
+
+    test_srand(29);
+    create(getenv("TDB_TMP_DIR"));
+    check(getenv("TDB_TMP_DIR"));
+
+    /* older tdbs don't have trails.lengths (not removable in packages) */
+    snprintf(path, sizeof(path), "%s/trails.lengths", getenv("TDB_TMP_DIR"));
+    unlink(path);
+    check(getenv("TDB_TMP_DIR"));
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <traildb.h>
+
+#include "tdb_test.h"
+
+/*
+tdb_trail_time_bounds() returns the first and the last timestamp of a
+trail, with and without trails.summary. Cursors use the bounds to skip
+trails that don't overlap with the time ranges of a filter.
+*/
+
+#define NUM_TRAILS 100
+#define MAX_EVENTS 50
+
+static uint64_t timestamps[NUM_TRAILS][MAX_EVENTS];
+static uint64_t num_events[NUM_TRAILS];
+
+static void create(const char *root, uint64_t step)
+{
+    const char *fields[] = {"a"};
+    const char *vals[] = {"x"};
+    uint64_t lengths[] = {1};
+    uint8_t uuid[16];
+    uint64_t i, j;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, root, fields, 1) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        uint64_t tstamp = 1000 + (test_rand() % 1000) * step;
+        memset(uuid, 0, sizeof(uuid));
+        memcpy(uuid, &i, sizeof(i));
+        num_events[i] = 1 + test_rand() % MAX_EVENTS;
+        for (j = 0; j < num_events[i]; j++){
+            tstamp += (test_rand() % 10) * step;
+            timestamps[i][j] = tstamp;
+            assert(tdb_cons_add(c, uuid, tstamp, vals, lengths) == 0);
+        }
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+static void check_filter(tdb *t, uint64_t start, uint64_t end, int with_item)
+{
+    struct tdb_event_filter *f = tdb_event_filter_new();
+    tdb_cursor *cursor = tdb_cursor_new(t);
+    uint64_t i, j;
+
+    assert(tdb_event_filter_add_time_range(f, start, end) == 0);
+    if (with_item){
+        assert(tdb_event_filter_new_clause(f) == 0);
+        assert(tdb_event_filter_add_term(f,
+                                         tdb_get_item(t, 1, "x", 1),
+                                         0) == 0);
+    }
+    assert(tdb_cursor_set_event_filter(cursor, f) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        const tdb_event *event;
+        assert(tdb_get_trail(cursor, i) == 0);
+        for (j = 0; j < num_events[i]; j++){
+            if (timestamps[i][j] >= start && timestamps[i][j] < end){
+                event = tdb_cursor_next(cursor);
+                assert(event);
+                assert(event->timestamp == timestamps[i][j]);
+            }
+        }
+        assert(tdb_cursor_next(cursor) == NULL);
+    }
+    tdb_cursor_free(cursor);
+    tdb_event_filter_free(f);
+}
+
+static void check(const char *root, uint64_t step)
+{
+    /* a db-level filter doesn't affect the bounds */
+    struct tdb_event_filter *none = tdb_event_filter_new_match_none();
+    tdb_opt_value value = {.ptr = none};
+    uint64_t i, first, last;
+    tdb* t = tdb_init();
+
+    assert(tdb_open(t, root) == 0);
+    assert(tdb_set_opt(t, TDB_OPT_EVENT_FILTER, value) == 0);
+
+    for (i = 0; i < NUM_TRAILS; i++){
+        assert(tdb_trail_time_bounds(t, i, &first, &last) == 0);
+        assert(first == timestamps[i][0]);
+        assert(last == timestamps[i][num_events[i] - 1]);
+    }
+    assert(tdb_trail_time_bounds(t, NUM_TRAILS, &first, &last) ==
+           TDB_ERR_INVALID_TRAIL_ID);
+
+    value.ptr = NULL;
+    assert(tdb_set_opt(t, TDB_OPT_EVENT_FILTER, value) == 0);
+
+    check_filter(t, 0, 1, 0);
+    check_filter(t, 1000, 1000 + 100 * step, 0);
+    check_filter(t, 1000 + 500 * step, 1000 + 501 * step, 0);
+    check_filter(t, 1000 + 900 * step, UINT64_MAX, 1);
+    check_filter(t, 1000 + 300 * step, 1000 + 700 * step, 1);
+
+    tdb_close(t);
+    tdb_event_filter_free(none);
+}
+
+int main(int argc, char** argv)
+{
+    char root[1024];
+    char path[1100];
+    /* narrow and wide timestamps are stored with different widths */
+    const uint64_t steps[] = {1, 1LLU << 24};
+    uint64_t i;
+
+    test_srand(23);
+    for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++){
+        snprintf(root, sizeof(root), "%s/%"PRIu64, getenv("TDB_TMP_DIR"), i);
+        create(root, steps[i]);
+        check(root, steps[i]);
+
+        /* older tdbs don't have trails.summary (not removable in packages) */
+        snprintf(path, sizeof(path), "%s/trails.summary", root);
+        unlink(path);
+        check(root, steps[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <traildb.h>
+#include <tdb_uuid_index.h>
+#include "tdb_test.h"
+
+/*
+tdb_get_trail_id() finds the same trails with and without
+TDB_OPT_UUID_INDEX, for UUIDs that are uniformly distributed and UUIDs
+that share a long prefix
+*/
+
+#define NUM_EVENTS 20000
+#define NUM_MISSING 1000
+
+static void random_uuid(uint8_t *uuid, uint32_t num_random_bytes)
+{
+    uint32_t i;
+    memset(uuid, 0, 16);
+    for (i = 0; i < num_random_bytes; i++)
+        uuid[i] = (uint8_t)test_rand();
+}
+
+static void create(const char *root, uint32_t num_random_bytes)
+{
+    uint8_t uuid[16];
+    uint64_t i;
+
+    tdb_cons* c = tdb_cons_init();
+    test_cons_settings(c);
+    assert(tdb_cons_open(c, root, NULL, 0) == 0);
+    for (i = 0; i < NUM_EVENTS; i++){
+        random_uuid(uuid, num_random_bytes);
+        assert(tdb_cons_add(c, uuid, i, NULL, NULL) == 0);
+    }
+    assert(tdb_cons_finalize(c) == 0);
+    tdb_cons_close(c);
+}
+
+static void check(const tdb *t, const tdb *expected, uint32_t num_random_bytes)
+{
+    uint8_t uuid[16];
+    uint64_t i, trail_id, expected_id;
+    tdb_error err;
+
+    for (i = 0; i < tdb_num_trails(t); i++){
+        assert(tdb_get_trail_id(t, tdb_get_uuid(t, i), &trail_id) == 0);
+        assert(trail_id == i);
+    }
+
+    for (i = 0; i < NUM_MISSING; i++){
+        random_uuid(uuid, num_random_bytes);
+        err = tdb_get_trail_id(t, uuid, &trail_id);
+        assert(err == tdb_get_trail_id(expected, uuid, &expected_id));
+        if (!err)
+            assert(trail_id == expected_id);
+    }
+
+    /* below the first and above the last UUID */
+    memset(uuid, 0, 16);
+    assert(tdb_get_trail_id(t, uuid, &trail_id) == TDB_ERR_UNKNOWN_UUID);
+    memset(uuid, 0xff, 16);
+    assert(tdb_get_trail_id(t, uuid, &trail_id) == TDB_ERR_UNKNOWN_UUID);
+}
+
+static void test_tdb(const char *root, uint32_t num_random_bytes)
+{
+    tdb_opt_value value;
+    tdb *plain, *t;
+
+    test_srand(3);
+    create(root, num_random_bytes);
+    plain = tdb_init();
+    assert(tdb_open(plain, root) == 0);
+    assert(tdb_get_opt(plain, TDB_OPT_UUID_INDEX, &value) == 0);
+    assert(value.value == 0);
+
+    /* the index is built by tdb_open() */
+    t = tdb_init();
+    assert(tdb_set_opt(t, TDB_OPT_UUID_INDEX, TDB_TRUE) == 0);
+    assert(tdb_open(t, root) == 0);
+    assert(tdb_get_opt(t, TDB_OPT_UUID_INDEX, &value) == 0);
+    assert(value.value == 1);
+    check(t, plain, num_random_bytes);
+
+    /* disabling the index falls back to binary search */
+    assert(tdb_set_opt(t, TDB_OPT_UUID_INDEX, TDB_FALSE) == 0);
+    check(t, plain, num_random_bytes);
+    tdb_close(t);
+
+    /* the index is built by tdb_set_opt() */
+    t = tdb_init();
+    assert(tdb_open(t, root) == 0);
+    assert(tdb_set_opt(t, TDB_OPT_UUID_INDEX, TDB_TRUE) == 0);
+    check(t, plain, num_random_bytes);
+    tdb_close(t);
+
+    tdb_close(plain);
+}
+
+/* UUIDs of TDB_VERSION_V0 are not sorted */
+static void test_unsorted(void)
+{
+    static char uuids[NUM_EVENTS * 16];
+    struct uuid_index *index;
+    uint64_t i, trail_id;
+
+    test_srand(3);
+    for (i = 0; i < NUM_EVENTS; i++)
+        random_uuid((uint8_t*)&uuids[i * 16], 4);
+    /* a duplicate resolves to the first trail, like a linear scan */
+    memcpy(&uuids[100 * 16], &uuids[200 * 16], 16);
+
+    assert((index = uuid_index_new(uuids, NUM_EVENTS, 0)));
+    for (i = 0; i < NUM_EVENTS; i++){
+        assert(uuid_index_find(index,
+                               (const uint8_t*)&uuids[i * 16],
+                               &trail_id) == 0);
+        assert(!memcmp(&uuids[trail_id * 16], &uuids[i * 16], 16));
+        assert(trail_id <= i);
+    }
+    assert(uuid_index_find(index,
+                           (const uint8_t*)&uuids[200 * 16],
+                           &trail_id) == 0);
+    assert(trail_id == 100);
+    uuid_index_free(index);
+}
+
+int main(int argc, char** argv)
+{
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/uniform", getenv("TDB_TMP_DIR"));
+    test_tdb(path, 16);
+
+    /* UUIDs whose high bytes are all zero share a long prefix */
+    snprintf(path, sizeof(path), "%s/prefix", getenv("TDB_TMP_DIR"));
+    test_tdb(path, 2);
+
+    test_unsorted();
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "traildb.h"
 #include "tdb_profile.h"
 
@@ -435,6 +437,87 @@ static int cmd_info(const char* db_path)
        return err;
 }
 
+#define SCAN_ROUNDS 5
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+/**
+ * decodes every trail once, returns the number of events
+ */
+static uint64_t do_scan(const tdb* db, tdb_cursor* c, uint64_t* checksum)
+{
+	const uint64_t num_trails = tdb_num_trails(db);
+	uint64_t num_events = 0;
+
+	for(uint64_t trail_id = 0; trail_id < num_trails; ++trail_id) {
+		const tdb_event* e;
+		if(tdb_get_trail(c, trail_id))
+			return 0;
+		while((e = tdb_cursor_next(c))) {
+			for(uint64_t i = 0; i < e->num_items; ++i)
+				*checksum += e->items[i];
+			++num_events;
+		}
+	}
+	return num_events;
+}
+
+/**
+ * measures the decoding throughput of full and edge-encoded cursors,
+ * reporting the best of SCAN_ROUNDS full scans
+ */
+static int cmd_scan(char** dbs, int argc)
+{
+	for(int i = 0; i < argc; ++i) {
+		const char* path = dbs[i];
+		char data_path[4096];
+		struct stat st;
+		tdb* db = tdb_init(); assert(db);
+		int err = tdb_open(db, path);
+		if(err) {
+			REPORT_ERROR("Failed to open TDB at directory %s. error=%i\n",
+				     path, err);
+			return 1;
+		}
+
+		/* a packaged tdb is a single file, report its size instead */
+		snprintf(data_path, sizeof(data_path), "%s/trails.data", path);
+		if(stat(data_path, &st) && stat(path, &st))
+			st.st_size = 0;
+		const double data_mb = (double)st.st_size / 1e6;
+
+		for(int edge = 0; edge < 2; ++edge) {
+			const tdb_opt_value value = {.value = (uint64_t)edge};
+			uint64_t checksum = 0, num_events = 0;
+			double best = 0;
+
+			/* the option applies to cursors created after it */
+			tdb_set_opt(db, TDB_OPT_ONLY_DIFF_ITEMS, value);
+			tdb_cursor* const c = tdb_cursor_new(db); assert(c);
+			for(int round = 0; round < SCAN_ROUNDS; ++round) {
+				const double start = now_ms();
+				num_events = do_scan(db, c, &checksum);
+				const double took = now_ms() - start;
+				if(!round || took < best)
+					best = took;
+			}
+			printf("%s %s: %" PRIu64 " events, best %.1fms, "
+			       "%.1fM events/s, %.1fMB/s (checksum %" PRIu64 ")\n",
+			       path, edge ? "edge" : "full", num_events, best,
+			       (double)num_events / best / 1e3, data_mb / best * 1e3,
+			       checksum);
+			tdb_cursor_free(c);
+		}
+		tdb_close(db);
+	}
+	return 0;
+}
+
 static void print_help(void)
 {
 	printf(
@@ -455,6 +538,9 @@ static void print_help(void)
 "  recode <output path> <input path> <column name>+\n"
 "  :: copies the given (sub)set of columns from the DB at\n"
 "      /input path/ into /output path/\n"
+"  scan <database directory>*\n"
+"  :: measures decoding throughput over all trails,\n"
+"     with and without edge encoding\n"
 "  info <path>\n"
 "  :: displays information on a TDB\n"
 "  dump <path>\n"
@@ -485,6 +571,9 @@ int main(int argc, char** argv)
 	else if(IS_CMD("recode", 3)) {
 		return cmd_recode(argv[2], argv[3], cargv + 4, argc - 4);
 	}
+	else if(IS_CMD("scan", 1)) {
+		return cmd_scan(argv + 2, argc - 2);
+	}
 	else if(IS_CMD("info", 1)) {
 		return cmd_info(argv[2]);
 	}